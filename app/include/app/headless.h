@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+
+#include <zest/file/file.h>
+
+#include <glm/glm.hpp>
+
+struct IDevice;
+
+// Offline rendering from the command line, with no window, editor or audio:
+// Rezonality --render project_dir [--frames 0-600] [--size 3840x2160] [--out dir]
+// Frames are stepped at the project's record_fps and written through the recording pipeline (record_format etc.)
+// Long renders can be split across worker processes, each with its own device:
+// [--workers 4] [--chunk 100] [--warmup 30]
+// Sizes beyond the device's image limits are drawn in tiles and stitched into PNGs: [--tile 4096] or [--tile 4096x1024]
+struct HeadlessSettings
+{
+    bool enabled = false;
+    fs::path projectPath;
+    uint32_t firstFrame = 0;
+    uint32_t lastFrame = 600; // Inclusive
+    glm::uvec2 size = glm::uvec2(1920, 1080);
+    fs::path outPath; // renders in the run tree if not set
+
+    uint32_t workers = 1;
+    uint32_t chunkFrames = 0; // Frames handed to a worker at a time; 0 splits the range evenly
+    uint32_t warmupFrames = 0; // Rendered, but not written, before the first frame; for passes that feed back
+    int32_t deviceIndex = -1;
+    glm::uvec2 tileSize = glm::uvec2(0); // 0 draws the whole output at once
+
+    bool worker = false; // Started by a coordinator; always writes images, which it joins up
+    std::string executable;
+};
+
+// Returns false, with the exit code, if the app shouldn't continue
+bool headless_read_command_line(int argc, char** argv, HeadlessSettings& settings, int& exitCode);
+
+// Render the frames on a device created without a window; returns the process exit code
+int headless_render(IDevice& device, const HeadlessSettings& settings);
+
+// Hand the frames out in chunks to worker processes, then join the results; returns the process exit code
+int headless_coordinate(const HeadlessSettings& settings);
@@ -0,0 +1,429 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include <fmt/format.h>
+
+#include <zest/file/runtree.h>
+#include <zest/time/profiler.h>
+
+#include <vklive/IDevice.h>
+#include <vklive/process/process.h>
+#include <vklive/scene.h>
+
+#include <app/headless.h>
+
+namespace
+{
+
+void headless_usage()
+{
+    std::cout << "Usage: Rezonality --render project_dir [--frames 0-600] [--size 3840x2160] [--out dir] [--workers 1] [--chunk 0] [--warmup 0] [--device -1] [--tile 0]" << std::endl;
+}
+
+// There is no editor to show them in
+void headless_report_messages(Scene& scene)
+{
+    auto report = [](const char* pszType, const Message& msg) {
+        if (msg.path.empty())
+        {
+            std::cout << pszType << ": " << msg.text << std::endl;
+        }
+        else
+        {
+            std::cout << pszType << ": " << msg.path.string() << "(" << (msg.line + 1) << "): " << msg.text << std::endl;
+        }
+    };
+
+    for (auto& err : scene.errors)
+    {
+        report("Error", err);
+    }
+    scene.errors.clear();
+
+    for (auto& warn : scene.warnings)
+    {
+        report("Warning", warn);
+    }
+    scene.warnings.clear();
+}
+
+bool headless_create_output(const HeadlessSettings& settings, fs::path& outPath)
+{
+    outPath = settings.outPath.empty() ? (Zest::runtree_path() / "renders") : settings.outPath;
+
+    std::error_code ec;
+    fs::create_directories(outPath, ec);
+    if (ec)
+    {
+        std::cout << "Could not create output directory: " << outPath.string() << ", " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool headless_read_command_line(int argc, char** argv, HeadlessSettings& settings, int& exitCode)
+{
+    const std::set<std::string> valueOptions = { "--render", "--frames", "--size", "--out", "--workers", "--chunk", "--warmup", "--device", "--tile" };
+
+    settings.executable = argc > 0 ? argv[0] : "";
+
+    bool options = false;
+    for (int arg = 1; arg < argc; arg++)
+    {
+        std::string option = argv[arg];
+        if (option == "--worker")
+        {
+            settings.worker = true;
+            continue;
+        }
+
+        if (valueOptions.find(option) == valueOptions.end())
+        {
+            // Not ours
+            continue;
+        }
+
+        if (arg + 1 >= argc)
+        {
+            std::cout << "Missing value for " << option << std::endl;
+            headless_usage();
+            exitCode = 1;
+            return false;
+        }
+
+        std::string value = argv[++arg];
+        bool valid = true;
+        if (option == "--render")
+        {
+            settings.enabled = true;
+            settings.projectPath = fs::absolute(value);
+        }
+        else
+        {
+            options = true;
+        }
+
+        if (option == "--frames")
+        {
+            valid = std::sscanf(value.c_str(), "%u-%u", &settings.firstFrame, &settings.lastFrame) == 2 && settings.firstFrame <= settings.lastFrame;
+        }
+        else if (option == "--size")
+        {
+            valid = std::sscanf(value.c_str(), "%ux%u", &settings.size.x, &settings.size.y) == 2 && settings.size.x != 0 && settings.size.y != 0;
+        }
+        else if (option == "--out")
+        {
+            settings.outPath = fs::absolute(value);
+        }
+        else if (option == "--workers")
+        {
+            valid = std::sscanf(value.c_str(), "%u", &settings.workers) == 1 && settings.workers != 0;
+        }
+        else if (option == "--chunk")
+        {
+            valid = std::sscanf(value.c_str(), "%u", &settings.chunkFrames) == 1;
+        }
+        else if (option == "--warmup")
+        {
+            valid = std::sscanf(value.c_str(), "%u", &settings.warmupFrames) == 1;
+        }
+        else if (option == "--device")
+        {
+            valid = std::sscanf(value.c_str(), "%d", &settings.deviceIndex) == 1;
+        }
+        else if (option == "--tile")
+        {
+            // Square tiles, unless both sides are given
+            auto count = std::sscanf(value.c_str(), "%ux%u", &settings.tileSize.x, &settings.tileSize.y);
+            if (count == 1)
+            {
+                settings.tileSize.y = settings.tileSize.x;
+            }
+            valid = count >= 1 && (settings.tileSize.x == 0) == (settings.tileSize.y == 0);
+        }
+
+        if (!valid)
+        {
+            std::cout << "Bad value for " << option << ": " << value << std::endl;
+            headless_usage();
+            exitCode = 1;
+            return false;
+        }
+    }
+
+    // The render options mean nothing without a project
+    if (!settings.enabled && options)
+    {
+        headless_usage();
+        exitCode = 1;
+        return false;
+    }
+
+    return true;
+}
+
+int headless_render(IDevice& device, const HeadlessSettings& settings)
+{
+    PROFILE_SCOPE(headless_render);
+
+    fs::path outPath;
+    if (!headless_create_output(settings, outPath))
+    {
+        return 1;
+    }
+
+    auto spScene = scene_build(settings.projectPath);
+    if (spScene->valid)
+    {
+        device.InitScene(*spScene);
+    }
+    headless_report_messages(*spScene);
+
+    if (!spScene->valid)
+    {
+        std::cout << "Project failed to load: " << settings.projectPath.string() << std::endl;
+        return 1;
+    }
+
+    auto& scene = *spScene;
+
+    // The coordinator joins the images into a video once all the workers are done
+    if (settings.worker)
+    {
+        scene.recordSettings.video = false;
+    }
+
+    // Every frame at full size; there is no frame budget offline
+    scene.dynamicResolution.enabled = false;
+    scene.dynamicResolution.scale = 1.0f;
+
+    // Settle the output size up front, so the targets are allocated once, at the size asked for.
+    // When tiling, the targets are only ever tile sized
+    bool tiled = settings.tileSize.x != 0;
+    auto size = glm::vec2(tiled ? settings.tileSize : settings.size);
+    scene_update_output_size(scene, size);
+
+    // Recording steps the clock by a fixed 1/record_fps, and writes up to the last frame
+    scene.recording = true;
+    scene.maxRecordFrame = settings.lastFrame + 1;
+
+    std::cout << fmt::format("Rendering {}, frames {}-{} at {}x{} to {}", settings.projectPath.string(), settings.firstFrame, settings.lastFrame, settings.size.x, settings.size.y, outPath.string()) << std::endl;
+    if (tiled)
+    {
+        std::cout << fmt::format("Drawing in {}x{} tiles", settings.tileSize.x, settings.tileSize.y) << std::endl;
+    }
+
+    // Feedback passes need some history before the first frame looks as it would in a longer render
+    uint64_t startFrame = settings.firstFrame - std::min(settings.warmupFrames, settings.firstFrame);
+
+    auto startTime = std::chrono::steady_clock::now();
+    int exitCode = 0;
+    uint64_t frames = 0;
+    for (uint64_t frame = startFrame; frame <= settings.lastFrame; frame++)
+    {
+        // The render steps the count before it draws
+        Scene::GlobalFrameCount = frame - 1;
+
+        // Tiles go straight to an image each frame, so warmup frames are skipped; feedback doesn't cross tiles anyway
+        if (tiled)
+        {
+            if (frame < settings.firstFrame)
+            {
+                continue;
+            }
+
+            auto fileName = outPath / fmt::format("Frame_{:05}.png", frame);
+            if (!device.Render_Tiled(scene, settings.size, settings.tileSize, fileName) || device.Context().deviceState != DeviceState::Normal)
+            {
+                std::cout << "Tiled render failed at frame " << frame << std::endl;
+                exitCode = 1;
+                break;
+            }
+            scene.sceneFlags &= ~SceneFlags::DefaultTargetResize;
+            frames++;
+            continue;
+        }
+
+        auto renderOutput = device.Render_3D(scene, size);
+        if (!scene.valid || device.Context().deviceState != DeviceState::Normal)
+        {
+            std::cout << "Render failed at frame " << frame << std::endl;
+            exitCode = 1;
+            break;
+        }
+
+        if (renderOutput.pSurface)
+        {
+            scene.sceneFlags &= ~SceneFlags::DefaultTargetResize;
+        }
+
+        if (frame >= settings.firstFrame)
+        {
+            device.WriteToFile(scene, outPath);
+            frames++;
+        }
+        device.Present();
+    }
+    headless_report_messages(scene);
+
+    // No longer recording, so this writes out whatever is still in flight
+    scene.recording = false;
+    if (!tiled)
+    {
+        device.WriteToFile(scene, outPath);
+    }
+
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << fmt::format("Rendered {} frames in {:.1f}s, {:.1f} fps", frames, seconds, frames / std::max(seconds, 0.001)) << std::endl;
+
+    device.DestroyScene(scene);
+    return exitCode;
+}
+
+int headless_coordinate(const HeadlessSettings& settings)
+{
+    PROFILE_SCOPE(headless_coordinate);
+
+    fs::path outPath;
+    if (!headless_create_output(settings, outPath))
+    {
+        return 1;
+    }
+
+    // Only the settings are needed here; each worker builds the scene on its own device
+    auto spScene = scene_build(settings.projectPath);
+    headless_report_messages(*spScene);
+    if (!spScene->valid)
+    {
+        std::cout << "Project failed to load: " << settings.projectPath.string() << std::endl;
+        return 1;
+    }
+    auto recordSettings = spScene->recordSettings;
+    spScene.reset();
+
+    uint32_t frameCount = settings.lastFrame - settings.firstFrame + 1;
+    uint32_t workers = std::min(settings.workers, frameCount);
+    uint32_t chunkFrames = settings.chunkFrames != 0 ? settings.chunkFrames : (frameCount + workers - 1) / workers;
+    uint32_t chunkCount = (frameCount + chunkFrames - 1) / chunkFrames;
+
+    std::cout << fmt::format("Rendering {}, frames {}-{} at {}x{} to {}, {} chunks of {} frames on {} workers",
+        settings.projectPath.string(),
+        settings.firstFrame,
+        settings.lastFrame,
+        settings.size.x,
+        settings.size.y,
+        outPath.string(),
+        chunkCount,
+        chunkFrames,
+        workers)
+              << std::endl;
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    // Chunks are taken in order as workers come free, so a slow chunk doesn't hold up the others
+    std::atomic<uint32_t> nextChunk = 0;
+    std::atomic<uint32_t> chunksDone = 0;
+    std::atomic<bool> failed = false;
+    std::mutex outputMutex;
+
+    std::vector<std::thread> threads;
+    for (uint32_t slot = 0; slot < workers; slot++)
+    {
+        threads.emplace_back([&, slot]() {
+            while (!failed)
+            {
+                auto chunk = nextChunk++;
+                if (chunk >= chunkCount)
+                {
+                    break;
+                }
+
+                auto first = settings.firstFrame + chunk * chunkFrames;
+                auto last = std::min(first + chunkFrames - 1, settings.lastFrame);
+
+                // Warm up from the frames before the chunk, as a single process render does before the range
+                auto warmup = std::min(settings.warmupFrames, first);
+
+                // Each slot keeps to a device, so workers are spread across the GPUs
+                std::vector<std::string> args = {
+                    settings.executable,
+                    "--render", settings.projectPath.string(),
+                    "--frames", fmt::format("{}-{}", first, last),
+                    "--size", fmt::format("{}x{}", settings.size.x, settings.size.y),
+                    "--out", outPath.string(),
+                    "--warmup", std::to_string(warmup),
+                    "--device", std::to_string(slot),
+                    "--tile", fmt::format("{}x{}", settings.tileSize.x, settings.tileSize.y),
+                    "--worker"
+                };
+
+                std::error_code ec;
+                auto spWorker = process_pipe_start(args, ec, true);
+                if (!spWorker || process_pipe_finish(*spWorker) != 0)
+                {
+                    std::lock_guard<std::mutex> lock(outputMutex);
+                    std::cout << fmt::format("Worker failed on frames {}-{}", first, last) << std::endl;
+                    failed = true;
+                    break;
+                }
+
+                std::lock_guard<std::mutex> lock(outputMutex);
+                std::cout << fmt::format("Chunk {}/{} done, frames {}-{}", ++chunksDone, chunkCount, first, last) << std::endl;
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    if (failed)
+    {
+        return 1;
+    }
+
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << fmt::format("Rendered {} frames in {:.1f}s, {:.1f} fps", frameCount, seconds, frameCount / std::max(seconds, 0.001)) << std::endl;
+
+    if (!recordSettings.video)
+    {
+        return 0;
+    }
+
+    // The workers wrote numbered images, so the video is made from them in order; they are left in place
+    PROFILE_SCOPE(join_video);
+    auto videoPath = outPath / fmt::format("Recording.{}", recordSettings.container);
+    std::vector<std::string> args = {
+        recordSettings.encoder,
+        "-y",
+        "-loglevel", "error",
+        "-framerate", std::to_string(recordSettings.fps),
+        "-start_number", std::to_string(settings.firstFrame),
+        "-i", (outPath / "Frame_%05d.png").string(),
+        "-frames:v", std::to_string(frameCount),
+        "-vf", "pad=ceil(iw/2)*2:ceil(ih/2)*2", // Most pixel formats need even sizes
+        "-c:v", recordSettings.codec,
+        "-crf", std::to_string(recordSettings.crf),
+        "-pix_fmt", recordSettings.pixelFormat,
+        videoPath.string()
+    };
+
+    std::error_code ec;
+    auto spEncoder = process_pipe_start(args, ec, true);
+    if (!spEncoder || process_pipe_finish(*spEncoder) != 0)
+    {
+        std::cout << "Couldn't join the frames with '" << recordSettings.encoder << "'; the images are in " << outPath.string() << std::endl;
+        return 1;
+    }
+
+    std::cout << "Recorded video: " << videoPath.string() << std::endl;
+    return 0;
+}
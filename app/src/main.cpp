@@ -34,6 +34,7 @@
 #include <app/config.h>
 #include <app/controller.h>
 #include <app/editor.h>
+#include <app/headless.h>
 #include <app/menu.h>
 #include <app/project.h>
 #include <app/window_render.h>
@@ -66,13 +67,13 @@ IDevice* GetDevice()
 
 namespace vulkan
 {
-extern std::shared_ptr<IDevice> create_vulkan_device(SDL_Window* pWindow, const std::string& settingsPath, bool viewports = false);
+extern std::shared_ptr<IDevice> create_vulkan_device(SDL_Window* pWindow, const std::string& settingsPath, bool viewports = false, int32_t deviceIndex = -1);
 }
 
 namespace
 {
 
-bool read_command_line(int argc, char** argv, int& exitCode)
+bool read_command_line(int argc, char** argv, HeadlessSettings& headless, int& exitCode)
 {
     /*
     auto cli = group(opt_value("viewports", appConfig.viewports));
@@ -81,7 +82,7 @@ bool read_command_line(int argc, char** argv, int& exitCode)
         parse(argc, argv, cli);
     }
     */
-    return true;
+    return headless_read_command_line(argc, argv, headless, exitCode);
 }
 
 SDL_Window* init_sdl_window()
@@ -196,7 +197,8 @@ int main(int argc, char** argv)
 #endif
 
     int exitCode = 0;
-    if (!read_command_line(argc, argv, exitCode))
+    HeadlessSettings headless;
+    if (!read_command_line(argc, argv, headless, exitCode))
     {
         return exitCode;
     }
@@ -204,6 +206,26 @@ int main(int argc, char** argv)
     // Asset paths
     Zest::runtree_init(SDL_GetBasePath(), VKLIVE_ROOT);
 
+    // Offline render: a device with no window, and none of the editor, UI or audio.
+    // With several workers, this process only hands out the frames
+    if (headless.enabled)
+    {
+        if (headless.workers > 1)
+        {
+            exitCode = headless_coordinate(headless);
+        }
+        else
+        {
+            g_pDevice = vulkan::create_vulkan_device(nullptr, std::string(), false, headless.deviceIndex);
+            exitCode = headless_render(*g_pDevice, headless);
+            g_pDevice.reset();
+        }
+
+        scene_destroy_parser();
+        Zest::Profiler::Finish();
+        return exitCode;
+    }
+
     // Get the settings
     auto settings_path = Zest::file_init_settings("VkLive",
         Zest::runtree_find_path("settings.toml"),
@@ -38,12 +38,7 @@ void window_render(IDevice* pDevice, Scene& scene, bool background, const std::f
     bool drawn = false;
     if (scene.valid)
     {
-        if (outputSize != scene.lastOutputSize)
-        {
-            scene.lastOutputSize = outputSize;
-            scene.sceneFlags |= SceneFlags::DefaultTargetResize;
-            Scene::GlobalFrameCount = 0;
-        }
+        scene_update_output_size(scene, outputSize);
 
         auto renderOutput = fnRender(glm::vec2(outputSize.x, outputSize.y), scene);
         if (renderOutput.pSurface)
@@ -51,7 +46,7 @@ void window_render(IDevice* pDevice, Scene& scene, bool background, const std::f
             scene.sceneFlags &= ~SceneFlags::DefaultTargetResize;
 
             auto border = glm::vec2(0.0f);
-            auto currentSurfaceSize = renderOutput.pSurface->currentSize;
+            auto currentSurfaceSize = glm::round(renderOutput.displaySize);
             if (currentSurfaceSize.x < outputSize.x)
             {
                 border.x = (outputSize.x - currentSurfaceSize.x) * 0.5f;
@@ -78,7 +73,7 @@ void window_render(IDevice* pDevice, Scene& scene, bool background, const std::f
 
             if (renderOutput.textureId)
             {
-                pDrawList->AddImage(renderOutput.textureId, topLeft, bottomRight);
+                pDrawList->AddImage(renderOutput.textureId, topLeft, bottomRight, ImVec2(0.0f, 0.0f), ImVec2(renderOutput.uvMax.x, renderOutput.uvMax.y));
 
                 scene.targetViewport = glm::vec4(topLeft.x, topLeft.y, std::min(bottomRight.x, maxRect.x), std::min(bottomRight.y, maxRect.y));
 
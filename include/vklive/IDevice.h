@@ -35,6 +35,12 @@ struct RenderOutput
 {
     void* textureId = nullptr;
     Surface* pSurface = nullptr;
+
+    // Targets may be bigger than the area rendered to
+    glm::vec2 uvMax = glm::vec2(1.0f);
+
+    // Size to show the output at; bigger than the rendered area when the render scale is reduced
+    glm::vec2 displaySize = glm::vec2(0.0f);
 };
 
 struct DeviceContext
@@ -68,6 +74,7 @@ struct IDevice
 
     virtual RenderOutput Render_3D(Scene& scene, const glm::vec2& size) = 0;
     virtual void WriteToFile(Scene& scene, const fs::path& path) = 0;
+    virtual bool Render_Tiled(Scene& scene, const glm::uvec2& outputSize, const glm::uvec2& tileSize, const fs::path& fileName) = 0;
 
     virtual void WaitIdle() = 0;
     
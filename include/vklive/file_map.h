@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <zest/file/file.h>
+
+// A whole file mapped read only; the pages are read in by the OS as they are touched
+struct FileMap
+{
+    const uint8_t* pData = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* hFile = nullptr;
+    void* hMapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// Returns nullptr if the file can't be opened or is empty; the mapping goes when the last reference does
+std::shared_ptr<FileMap> file_map(const fs::path& path);
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Minimal OpenEXR writer: single part, scanline, uncompressed.
+// Cheap to produce, and readable by any compositing package.
+// Input is interleaved RGBA, 16 or 32 bit float; rowPitch is in bytes
+void exr_encode_rgba(std::vector<uint8_t>& out, const void* pPixels, uint32_t width, uint32_t height, size_t rowPitch, bool halfFloat);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#include <zest/file/file.h>
+
+struct z_stream_s;
+
+// PNG writer that takes the image a band of rows at a time, so the whole of it never has to be in memory.
+// Output is 8 bit RGB; rows are deflated as they arrive and written out in IDAT chunks
+struct PngStream
+{
+    std::ofstream file;
+    std::shared_ptr<z_stream_s> spDeflate;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t rowsWritten = 0;
+    std::vector<uint8_t> filtered; // One row, with its filter byte
+    std::vector<uint8_t> chunk; // Deflated data waiting to be written
+    bool failed = false;
+};
+
+bool png_stream_begin(PngStream& png, const fs::path& path, uint32_t width, uint32_t height);
+
+// RGB rows, rowPitch bytes apart; rows past the height are ignored
+bool png_stream_write_rows(PngStream& png, const uint8_t* pRows, uint32_t rows, size_t rowPitch);
+
+// Finishes the file; fails if fewer rows were written than the height
+bool png_stream_end(PngStream& png);
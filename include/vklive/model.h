@@ -1,11 +1,13 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <memory>
 #include <vector>
 #include <set>
 #include <string>
 
 struct aiScene;
+struct FileMap;
 namespace Assimp
 {
 class Importer;
@@ -25,6 +27,14 @@ enum Component
     VERTEX_COMPONENT_DUMMY_VEC4 = 0x8,
     VERTEX_COMPONENT_DUMMY_INT4 = 0x9,
     VERTEX_COMPONENT_DUMMY_UINT4 = 0xA,
+
+    // Quantized; see Model::Quantization, and shaders/include/vertex_quantized.h for decoding
+    VERTEX_COMPONENT_POSITION_HALF = 0xB, // rgba16f, relative to the model's bounds
+    VERTEX_COMPONENT_NORMAL_OCT = 0xC, // Octahedral, rg16 snorm
+    VERTEX_COMPONENT_TANGENT_OCT = 0xD,
+    VERTEX_COMPONENT_BITANGENT_OCT = 0xE,
+    VERTEX_COMPONENT_UV_UNORM16 = 0xF, // Relative to the model's UV range
+    VERTEX_COMPONENT_COLOR_UNORM8 = 0x10,
 };
 
 struct VertexLayout
@@ -37,6 +47,7 @@ struct VertexLayout
 };
 
 extern VertexLayout g_vertexLayout;
+extern VertexLayout g_quantizedVertexLayout; // g_vertexLayout's components in 20 bytes instead of 48
 
 // Create info
 struct ModelCreateInfo
@@ -47,16 +58,35 @@ struct ModelCreateInfo
     glm::vec3 scale{ 1 };
     glm::vec2 uvscale{ 1 };
     bool buildAS = false;
+    bool optimize = false;
+    bool lod = false; // Generate a chain of simplified index ranges
     
+    // Each field is mixed into the running hash in turn; XORing them together made swapped values,
+    // such as scales of (1, 2, 1) and (2, 1, 1), collide
     size_t hash() const
     {
-        using namespace std;
-        
         size_t result = std::hash<std::string>()(filename);
-        result ^= std::hash<glm::vec3>()(center);
-        result ^= std::hash<glm::vec3>()(scale);
-        result ^= std::hash<glm::vec2>()(uvscale);
-        result ^= buildAS ? 1 : 0;
+        auto combine = [&result](size_t value) {
+            result ^= value + size_t(0x9e3779b97f4a7c15ull) + (result << 6) + (result >> 2);
+        };
+
+        for (auto& component : vertexLayout.components)
+        {
+            combine(size_t(component));
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            combine(std::hash<float>()(center[i]));
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            combine(std::hash<float>()(scale[i]));
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            combine(std::hash<float>()(uvscale[i]));
+        }
+        combine((buildAS ? 1 : 0) | (optimize ? 2 : 0) | (lod ? 4 : 0));
         return result;
     }
     
@@ -68,7 +98,9 @@ struct ModelCreateInfo
             (createInfo.center == center) && 
             (createInfo.scale == scale) &&
             (createInfo.uvscale == uvscale) &&
-            (createInfo.buildAS == buildAS);
+            (createInfo.buildAS == buildAS) &&
+            (createInfo.optimize == optimize) &&
+            (createInfo.lod == lod);
     }
 };
 
@@ -141,12 +173,42 @@ struct Model
     };
 
     Dimension dim;
-    uint32_t indexCount = 0;
+    uint32_t indexCount = 0; // All of the index buffer, including any LODs
     uint32_t vertexCount = 0;
+
+    // Index ranges to draw, finest first, sharing the one vertex buffer.  LOD 0 is the parts' own indices;
+    // error is the furthest the simplified surface strays from it, in model units
+    struct ModelLod
+    {
+        uint32_t indexBase = 0;
+        uint32_t indexCount = 0;
+        float error = 0.0f;
+    };
+    std::vector<ModelLod> lods; // Empty without a LOD chain
     
+    // Quantized positions are stored as (p - positionOffset) / positionScale, and UVs as (uv - uvOffset) / uvScale
+    struct Quantization
+    {
+        glm::vec3 positionScale = glm::vec3(1.0f);
+        glm::vec3 positionOffset = glm::vec3(0.0f);
+        glm::vec2 uvScale = glm::vec2(1.0f);
+        glm::vec2 uvOffset = glm::vec2(0.0f);
+    };
+    Quantization quantization;
+
+    uint32_t vertexStride = 0;
     std::vector<uint8_t> vertexData;
     std::vector<uint32_t> indexData;
 
+    // Loaded from the mesh cache: the packed data is read from the mapped file instead of the vectors
+    std::shared_ptr<FileMap> spCacheMap;
+    const uint8_t* pCachedVertices = nullptr;
+    const uint32_t* pCachedIndices = nullptr;
+
+    // Set once the packed data has been dropped, after the upload; the counts, parts and bounds are kept
+    bool dataReleased = false;
+    uint64_t cacheKey = 0; // Mesh cache entry to read the data back from; 0 if it wasn't cached
+
     std::string errors;
 
     ModelCreateInfo createInfo;
@@ -155,6 +217,43 @@ struct Model
     int32_t refCount = 0;
 };
 
+// Where each component of a vertex comes from, and where it goes; worked out once per layout, not per vertex
+enum class VertexSource
+{
+    Position,
+    Normal,
+    UV,
+    Color,
+    Tangent,
+    Bitangent,
+    Zero // Padding
+};
+
+// How a component is stored
+enum class VertexEncoding
+{
+    Float,
+    Half,
+    Octahedral,
+    Unorm16,
+    Unorm8
+};
+
+struct VertexPackStep
+{
+    VertexSource source = VertexSource::Zero;
+    VertexEncoding encoding = VertexEncoding::Float;
+    uint32_t offset = 0; // Bytes into the vertex
+    uint32_t size = 0; // Bytes
+};
+
+struct VertexPackPlan
+{
+    std::vector<VertexPackStep> steps;
+    uint32_t stride = 0;
+    bool quantized = false; // Needs the model's Quantization before packing
+};
+
 extern const int DefaultModelFlags;
 
 uint32_t component_index(const VertexLayout& layout, Component component);
@@ -162,7 +261,40 @@ uint32_t component_size(Component component);
 uint32_t layout_size(const VertexLayout& layout);
 uint32_t layout_offset(const VertexLayout& layout, uint32_t index);
 void model_load(Model& model, const ModelCreateInfo& createInfo, int flags = DefaultModelFlags);
-void model_append_vertex(Model& model, std::vector<uint8_t>& outputBuffer, const aiScene* pScene, uint32_t meshIndex, uint32_t vertexIndex);
+VertexPackPlan model_vertex_plan(const VertexLayout& layout);
+
+// Weld duplicate vertices, then reorder each part's triangles for the post transform cache and overdraw,
+// and its vertices for fetch; logs the before and after statistics
+void model_optimize(Model& model, const VertexPackPlan& plan);
+
+// Simplify the parts into coarser LODs, appended to the index buffer; logs the triangle counts and errors
+void model_generate_lods(Model& model, const VertexPackPlan& plan);
+
+// The coarsest LOD whose error stays under maxPixelError, when a model unit covers pixelsPerUnit pixels
+uint32_t model_select_lod(const Model& model, float pixelsPerUnit, float maxPixelError);
+
+// The indices to draw for a LOD; all of them if the model has no LOD chain
+Model::ModelLod model_lod_range(const Model& model, uint32_t lod);
+
+// Unpacked positions of count vertices at pVertices, in the model's layout
+std::vector<glm::vec3> model_decode_positions(const Model& model, const uint8_t* pVertices, uint32_t count);
+
+// The packed data, wherever it is held
+const uint8_t* model_vertex_data(const Model& model);
+size_t model_vertex_bytes(const Model& model);
+const uint32_t* model_index_data(const Model& model);
+
+// Free the packed data once it's on the GPU, and read it back (from the mesh cache if possible) when it's
+// wanted again; returns false if it couldn't be.  Reloading can mean a full import, so keep it off the render thread
+void model_release_data(Model& model);
+bool model_reload_data(Model& model);
+
+// Bounds used to quantize the scene's positions and UVs, for layouts that have quantized components
+Model::Quantization model_quantization(const Model& model, const aiScene* pScene);
+
+// Pack all of a mesh's vertices into pOutput, which must have room for them at the plan's stride.
+// Safe to call for different meshes at once; the mesh's bounds are added to dim
+void model_pack_mesh(const Model& model, const VertexPackPlan& plan, const aiScene* pScene, uint32_t meshIndex, uint8_t* pOutput, Model::Dimension& dim);
 
 std::set<std::string> model_file_extensions();
 
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+#include <zest/file/file.h>
+
+struct Model;
+struct ModelCreateInfo;
+
+// Packed models are kept on disk in the temp directory, so loading the same model again maps the file
+// instead of running the importer.  Entries are keyed on the source file's contents (and the size and time
+// of the files it refers to, such as an OBJ's materials or a glTF's buffers), the create info and the importer
+// flags.  The least recently used entries are removed once the cache passes 2GB.
+// Returns 0 if the source can't be read
+uint64_t model_cache_key(const ModelCreateInfo& createInfo, int flags);
+fs::path model_cache_path(uint64_t key);
+
+// Fills the model from the cache entry; the vertices and indices stay in the mapping, so aren't copied
+bool model_cache_read(Model& model, uint64_t key);
+void model_cache_write(const Model& model, uint64_t key);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Pixel format conversion for frame export.
+// Each kernel has a scalar version and SSE4.1/AVX2 versions; the best the CPU supports is picked on first use.
+// Other architectures use the scalar versions.
+// Source and destination must not overlap, except for pixel_swap_red_blue which can work in place.
+
+// BGRA <-> RGBA
+void pixel_swap_red_blue(const uint8_t* pSrc, uint8_t* pDst, size_t pixels);
+
+// 4 channel to 3 channel, optionally swapping red and blue (BGRA -> RGB)
+void pixel_drop_alpha(const uint8_t* pSrc, uint8_t* pDst, size_t pixels, bool swapRedBlue);
+
+// Linear RGBA float/half to RGBA8: exposure, Reinhard, then gamma 2 as a cheap approximation of sRGB.
+// Alpha is clamped, not tone mapped
+void pixel_tonemap_float(const float* pSrc, uint8_t* pDst, size_t pixels, float exposure = 1.0f);
+void pixel_tonemap_half(const uint16_t* pSrc, uint8_t* pDst, size_t pixels, float exposure = 1.0f);
+
+// Name of the kernel set in use, for logging
+const char* pixel_convert_backend();
+
+// The kernel sets this CPU can run, best first, and a way to pick one; for checking and timing them against scalar.
+// Not thread safe, so only switch while nothing is converting
+std::vector<std::string> pixel_convert_backends();
+bool pixel_convert_set_backend(const std::string& name);
@@ -1,5 +1,27 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <system_error>
 #include <vector>
 
+namespace reproc
+{
+class process;
+}
+
 std::error_code run_process(const std::vector<std::string>& args, std::string* pOutput);
+
+// A long running process which is fed through its stdin; stderr goes to ours, and stdout too if asked for
+struct ProcessPipe
+{
+    std::shared_ptr<reproc::process> spProcess;
+    std::string name;
+};
+
+std::shared_ptr<ProcessPipe> process_pipe_start(const std::vector<std::string>& args, std::error_code& ec, bool forwardOutput = false);
+std::error_code process_pipe_write(ProcessPipe& pipe, const uint8_t* pData, size_t size);
+
+// Close stdin and wait for the process to finish with it; returns the exit status
+int process_pipe_finish(ProcessPipe& pipe);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <map>
 #include <memory>
 #include <string>
@@ -90,6 +91,9 @@ struct Geometry
     {
         return (other.path == path) &&
             (other.buildAS == buildAS) &&
+            (other.optimize == optimize) &&
+            (other.quantize == quantize) &&
+            (other.lod == lod) &&
             (other.transform == transform) &&
             (other.type == type) && 
             (other.loadScale == loadScale);
@@ -101,6 +105,10 @@ struct Geometry
     glm::vec3 loadScale = glm::vec3(1.0f);
     GeometryType type = GeometryType::Model;
     bool buildAS = false;
+    bool optimize = false; // Weld and reorder the mesh for the GPU's caches on load
+    bool quantize = false; // Load with g_quantizedVertexLayout
+    bool lod = false; // Simplified versions are drawn when the geometry is small on screen
+    int32_t line = -1; // Of the declaration in the scenegraph, for errors found when it loads
 };
 
 struct Shader
@@ -183,11 +191,78 @@ struct Pass
     fs::path script;
     std::string entry = "pass";
 
+    // Draw every N frames (0 = only when needed); otherwise the last output is sampled
+    uint32_t updateEvery = 1;
+
+    // Also draw when something this pass samples has been redrawn
+    bool updateOnChange = false;
+
     int scriptTargetsLine = 0;
     int scriptSamplersLine = 0;
     int scriptPassLine = 0;
 };
 
+// Optional render scale controller, configured in project.toml:
+// [settings]
+// dynamic_resolution = true
+// target_fps = 60
+// min_render_scale = 0.5
+// max_render_scale = 1.0
+struct DynamicResolution
+{
+    bool enabled = false;
+    float targetFps = 60.0f;
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+
+    // Current scale applied to targets that follow the output size
+    float scale = 1.0f;
+
+    // Smoothed GPU time for the scene's passes
+    double gpuMilliseconds = 0.0;
+    std::chrono::steady_clock::time_point lastChangeTime;
+};
+
+// Set while the output is drawn as a grid of tiles, for sizes beyond the device limits.
+// Targets that follow the output are tile sized; shaders see the whole output's size in iResolution,
+// and the tile's offset in ifFragCoordOffsetUniform (fragment shaders can use iFragCoord)
+struct RenderTile
+{
+    glm::uvec2 offset = glm::uvec2(0);
+    glm::uvec2 size = glm::uvec2(0);
+    glm::uvec2 outputSize = glm::uvec2(0); // 0 when not tiling
+};
+
+// Recorded frames are encoded in parallel, configured in project.toml:
+// [settings]
+// record_threads = 0 (encoder threads; 0 picks from the core count)
+// record_queue = 8 (frames allowed to be waiting or encoding before recording stalls)
+// Or streamed to a video encoder; PNGs are written instead if it can't be launched:
+// record_format = "video" ("png" by default)
+// record_encoder = "ffmpeg"
+// record_codec = "libx264"
+// record_crf = 18
+// record_pixel_format = "yuv420p"
+// record_container = "mp4"
+// record_fps = 60
+// Float targets can be written alongside, as uncompressed EXRs at full precision:
+// record_targets = ["Positions", "Normals"]
+struct RecordSettings
+{
+    uint32_t encodeThreads = 0;
+    uint32_t maxPendingFrames = 8;
+
+    bool video = false;
+    std::string encoder = "ffmpeg";
+    std::string codec = "libx264";
+    uint32_t crf = 18;
+    std::string pixelFormat = "yuv420p";
+    std::string container = "mp4";
+    uint32_t fps = 60;
+
+    std::vector<std::string> exportTargets;
+};
+
 namespace SceneFlags
 {
     enum
@@ -233,6 +308,18 @@ struct Scene
 
     glm::vec2 lastOutputSize = glm::vec2(0.0f);
 
+    // Interactive resizes are debounced; see scene_update_output_size
+    glm::vec2 settledOutputSize = glm::vec2(0.0f);
+    std::chrono::steady_clock::time_point outputSizeChangeTime;
+    bool outputResizing = false;
+
+    DynamicResolution dynamicResolution;
+    RenderTile renderTile;
+    RecordSettings recordSettings;
+
+    // Models no scene draws are kept up to this size, for a quick rebuild; model_cache_mb in project.toml
+    uint32_t modelCacheMB = 1024;
+
     uint32_t sceneFlags = SceneFlags::DefaultTargetResize;
 
     uint32_t reportedErrorCount = 0;
@@ -255,6 +342,7 @@ fs::path scene_find_asset(Scene& scene, const fs::path& path, AssetType assetTyp
 Surface* scene_get_surface(Scene& scene, const std::string& surfacename);
 Camera* scene_get_camera(Scene& scene, const std::string& cameraName);
 void scene_copy_state(Scene& dest, Scene& source);
+void scene_update_output_size(Scene& scene, const glm::vec2& outputSize);
 
 bool scene_is_raytracer(const fs::path& path);
 bool scene_is_shader(const fs::path& path);
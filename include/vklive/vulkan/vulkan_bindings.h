@@ -14,6 +14,9 @@ struct VulkanBindingMeta
     fs::path shaderPath;
     int32_t line = -1;
     std::pair<int32_t, int32_t> range = std::make_pair(-1, -1);
+
+    // [Offset, Size] of the uniform block members the shader actually reads
+    std::vector<std::pair<uint32_t, uint32_t>> usedRanges;
 };
 
 struct VulkanBindingSet
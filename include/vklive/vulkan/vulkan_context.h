@@ -21,6 +21,10 @@ namespace vulkan
 {
 
 struct VulkanImGuiTexture;
+struct VulkanTransfer;
+struct VulkanSurfacePool;
+struct VulkanModelCache;
+struct VulkanReadback;
 struct VulkanContext : DeviceContext
 {
     // Members
@@ -28,9 +32,22 @@ struct VulkanContext : DeviceContext
     vk::AllocationCallbacks allocator;
     vk::Instance instance;
     vk::PhysicalDevice physicalDevice;
+    int32_t physicalDeviceIndex = -1; // If set, use this device (modulo the count of devices of the preferred type)
     vk::Device device;
     uint32_t graphicsQueue = (uint32_t)-1;
     uint32_t presentQueue = (uint32_t)-1;
+    uint32_t transferQueue = (uint32_t)-1;
+    uint32_t transferQueueIndex = 0;
+
+    // Held for every submit, present and wait on the queues.  Uploads can submit from the update thread, and on a
+    // device with a single queue the transfer queue is the graphics queue
+    std::mutex queueMutex;
+
+    // Staging uploads, batched onto the transfer queue
+    std::shared_ptr<VulkanTransfer> spTransfer;
+
+    // Ring of host visible buffers for reading back recorded frames
+    std::shared_ptr<VulkanReadback> spReadback;
 
     glm::uvec2 frameBufferSize;
 
@@ -46,6 +63,12 @@ struct VulkanContext : DeviceContext
 
     vk::PhysicalDeviceMemoryProperties memoryProperties;
 
+    // Nanoseconds per GPU timestamp tick; 0 if the graphics queue can't write timestamps
+    float timestampPeriod = 0.0f;
+
+    // No window, swap chain or ImGui; the main window data only tracks the frames in flight
+    bool headless = false;
+
     VulkanWindow mainWindowData;
     vk::SampleCountFlagBits MSAASamples = vk::SampleCountFlagBits::e1;
 
@@ -63,6 +86,12 @@ struct VulkanContext : DeviceContext
 #endif
     std::map<Scene*, std::shared_ptr<VulkanScene>> mapVulkanScene;
 
+    // Targets from destroyed scenes, waiting to be picked up by the next one
+    std::shared_ptr<VulkanSurfacePool> spSurfacePool;
+
+    // Models shared between scenes, and kept for a while after the last one releases them
+    std::shared_ptr<VulkanModelCache> spModelCache;
+
     std::vector<vk::LayerProperties> supportedInstancelayerProperties;
     
     std::vector<vk::ExtensionProperties> supportedInstanceExtensions;
@@ -88,6 +117,7 @@ struct VulkanContext : DeviceContext
 
     VkPhysicalDeviceRayTracingPipelinePropertiesKHR rayTracingPipelineProperties{};
     VkPhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures{};
+    VkPhysicalDeviceAccelerationStructurePropertiesKHR accelerationStructureProperties{};
 
     VkPhysicalDeviceBufferDeviceAddressFeatures enabledBufferDeviceAddresFeatures{};
     VkPhysicalDeviceRayTracingPipelineFeaturesKHR enabledRayTracingPipelineFeatures{};
@@ -10,9 +10,10 @@ namespace vulkan
 {
 
 // A thin wrapper around the vulkan code; enables the app to be independent of device
+// A null window makes a headless device, for rendering offline
 struct VulkanDevice : public IDevice
 {
-    VulkanDevice(SDL_Window* pWindow, const std::string& iniPath, bool viewports = false);
+    VulkanDevice(SDL_Window* pWindow, const std::string& iniPath, bool viewports = false, int32_t deviceIndex = -1);
     ~VulkanDevice();
    
     // Interface
@@ -25,6 +26,7 @@ struct VulkanDevice : public IDevice
 
     virtual RenderOutput Render_3D(Scene& scene, const glm::vec2& size) override;
     virtual void WriteToFile(Scene& scene, const fs::path& path) override;
+    virtual bool Render_Tiled(Scene& scene, const glm::uvec2& outputSize, const glm::uvec2& tileSize, const fs::path& fileName) override;
     
     virtual void ValidateSwapChain() override;
     virtual void Present() override;
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <atomic>
+#include <list>
+#include <mutex>
+
 #include "vklive/model.h"
 
 #include "vulkan_context.h"
@@ -27,6 +31,10 @@ struct VulkanModel : Model
 
     std::vector<AccelerationStructure> accelerationStructures;
     AccelerationStructure topLevelAS;
+    VulkanBuffer asInstances; // Kept with the TLAS scratch, for refits
+    VulkanBuffer asScratch;
+    uint32_t asInstanceCount = 0;
+    glm::mat4 asTransform = glm::mat4(1.0f); // The instances' transform, as last built or refit
     bool initAccel = false;
 
     vk::WriteDescriptorSetAccelerationStructureKHR topLevelASDescriptor;
@@ -35,17 +43,71 @@ struct VulkanModel : Model
 
     std::string debugName;
 
-    static inline std::unordered_map<ModelCreateInfo, std::shared_ptr<VulkanModel>, ModelCreateInfoHash> ModelCache;
+    // Set while the import runs on a loader thread; the model isn't staged or drawn until it clears
+    std::atomic<bool> loading{ false };
+};
+
+// Loaded models, shared by create info.  Models no scene draws are kept, with their buffers, so that a rebuilt
+// scene picks them straight back up; the least recently released are freed when over the budget
+struct VulkanModelCache
+{
+    std::mutex mutex; // Scenes are built on the update thread, and destroyed on the render thread
+    std::unordered_map<ModelCreateInfo, std::shared_ptr<VulkanModel>, ModelCreateInfoHash> models;
+    std::list<std::shared_ptr<VulkanModel>> unused; // Least recently released first
+    uint64_t budgetBytes = uint64_t(1024) << 20;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
 };
 
+struct VulkanModelCacheStats
+{
+    size_t models = 0;
+    size_t unused = 0;
+    uint64_t cpuBytes = 0;
+    uint64_t gpuBytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+};
+
+// Push constants for drawing quantized geometry; see shaders/include/vertex_quantized.h
+struct VulkanModelConstants
+{
+    glm::vec4 positionScale;
+    glm::vec4 positionOffset;
+    glm::vec4 uvScaleOffset; // xy scale, zw offset
+};
+
+VulkanModelConstants vulkan_model_constants(const Model& model);
 
 vk::Format component_format(Component component);
 
-std::shared_ptr<VulkanModel> vulkan_model_load(VulkanContext& ctx, const ModelCreateInfo& createInfo);
+// Models with the same create info are shared; with async, the import runs on a loader thread
+std::shared_ptr<VulkanModel> vulkan_model_load(VulkanContext& ctx, const ModelCreateInfo& createInfo, bool async = false);
 
+// Releases a scene's reference; an unreferenced model stays in the cache until it is evicted
 void vulkan_model_destroy(VulkanContext& ctx, VulkanModel& model);
 void vulkan_model_stage(VulkanContext& ctx, VulkanModel& model);
 
+// True if the CPU copy is in memory.  If it was released, it is read back on a loader thread, and this returns
+// false until it's done
+bool vulkan_model_reload_data(const std::shared_ptr<VulkanModel>& spModel);
+
+// Drops the CPU copy of the vertices and indices once they're on the GPU, and any acceleration structure is built
+void vulkan_model_release_data(VulkanContext& ctx, VulkanModel& model);
+
 std::shared_ptr<VulkanModel> vulkan_model_create(VulkanContext& ctx, VulkanScene& vulkanScene, const Geometry& geom);
 
+// Imported and staged; passes draw without the model until it is
+bool vulkan_model_ready(const VulkanModel& model);
+
+// Reports a model that couldn't be loaded against its geometry in the scenegraph
+void vulkan_model_report_error(VulkanScene& vulkanScene, const Geometry& geom, const VulkanModel& model);
+
+void vulkan_model_cache_set_budget(VulkanContext& ctx, uint64_t budgetBytes);
+VulkanModelCacheStats vulkan_model_cache_stats(VulkanContext& ctx);
+void vulkan_model_cache_destroy(VulkanContext& ctx);
+
 } // namespace vulkan
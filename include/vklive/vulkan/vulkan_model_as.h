@@ -9,6 +9,12 @@
 namespace vulkan
 {
 
-void vulkan_model_build_acceleration_structure(VulkanContext& ctx, VulkanModel& model);
+// Builds the structures for any of the models that don't have them yet.  Every part's BLAS is built in one
+// submission and then compacted; each model gets a TLAS over its parts
+void vulkan_model_build_acceleration_structures(VulkanContext& ctx, const std::vector<VulkanModel*>& models);
+
+// Moves the model's instances to a new transform by refitting its TLAS; a TLAS with a different number of
+// instances is rebuilt.  Nothing is done if the transform hasn't changed
+void vulkan_model_update_acceleration_structure(VulkanContext& ctx, VulkanModel& model, const glm::mat4& transform);
 
 } // namespace vulkan
@@ -107,6 +107,12 @@ struct VulkanPassSwapFrameData
 
     vk::Pipeline pipeline;
     vk::PipelineLayout geometryPipelineLayout;
+
+    // Attachment formats the pipeline was built for; size isn't baked in, since we use
+    // dynamic rendering, viewport and scissor
+    std::vector<vk::Format> pipelineColorFormats;
+    vk::Format pipelineDepthFormat = vk::Format::eUndefined;
+    uint64_t pipelineRebuilds = 0;
     std::map<uint32_t, VulkanBindingSet> mergedBindingSets;
 
     std::vector<vk::RayTracingShaderGroupCreateInfoKHR> rayGroupCreateInfos;
@@ -128,6 +134,10 @@ struct VulkanPassSwapFrameData
     vk::CommandPool commandPool;
     vk::Fence fence;
 
+    // Timestamps around the pass, read back once the fence has signalled
+    vk::QueryPool timestampQueries;
+    double gpuMilliseconds = 0.0;
+
     std::string debugName;
 };
 
@@ -143,12 +153,26 @@ struct VulkanPass
     Pass& pass;
 
     std::map<uint32_t, VulkanPassSwapFrameData> passFrameData;
+
+    // Update frequency state; see Pass::updateEvery
+    bool drawn = false;
+    bool skipped = false;
+    uint64_t lastDrawFrame = 0;
+    uint64_t skippedFrames = 0;
+    uint64_t drawnFrames = 0;
+    std::map<VulkanSurface*, uint64_t> inputGenerations;
+    bool missingGeometry = false; // Last drawn while some of its models were still loading
+
+    // Hash of everything the last draw read; see vulkan_pass_fingerprint
+    uint64_t fingerprint = 0;
 };
 
 std::shared_ptr<VulkanPass> vulkan_pass_create(VulkanScene& vulkanScene, Pass& pass);
 void vulkan_pass_destroy(VulkanContext& ctx, VulkanPass& vulkanPass);
 void vulkan_pass_wait(VulkanContext& ctx, VulkanPassSwapFrameData& passData);
 bool vulkan_pass_draw(VulkanContext& ctx, VulkanPass& vulkanPass);
+bool vulkan_pass_should_draw(VulkanContext& ctx, VulkanPass& vulkanPass);
+void vulkan_pass_skip(VulkanContext& ctx, VulkanPass& vulkanPass);
 
 VulkanPassSwapFrameData& vulkan_pass_frame_data(VulkanContext& ctx, VulkanPass& vulkanPass);
 VulkanPassTargets& vulkan_pass_targets(VulkanContext& ctx, VulkanPassSwapFrameData& passFrameData);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <vklive/vulkan/vulkan_buffer.h>
+
+namespace vulkan
+{
+
+struct VulkanContext;
+
+// One slot of the readback ring.  The GPU copies into a persistently mapped buffer;
+// once the fence passes the slot is handed to the consumer, which reads pData in place and releases it.
+struct VulkanReadbackFrame
+{
+    VulkanBuffer buffer;
+    const uint8_t* pData = nullptr;
+
+    vk::CommandBuffer commandBuffer;
+    vk::Fence fence;
+    vk::Semaphore complete; // Signalled when the copy is done; the present waits on it
+
+    glm::uvec2 size = glm::uvec2(0);
+    uint32_t rowPitch = 0;
+    uint64_t frame = 0;
+    uint64_t sequence = 0; // Capture order; frame numbers can repeat or go backwards
+    bool bgra = false;
+    vk::Format format = vk::Format::eUndefined;
+    std::string label; // Empty for the swap image; otherwise the target name
+
+    bool inFlight = false; // Submitted, fence not yet collected
+    std::atomic<bool> busy{ false }; // Owned by the consumer until readback_release
+};
+
+using fnReadbackReady = std::function<void(std::shared_ptr<VulkanReadbackFrame>)>;
+
+struct VulkanReadback
+{
+    vk::CommandPool commandPool;
+    std::vector<std::shared_ptr<VulkanReadbackFrame>> frames;
+    uint64_t nextSequence = 0;
+};
+
+// Enough to cover the frames between a capture and the fence being seen as complete.
+// More are added when several images are captured each frame, up to the limit
+const uint32_t ReadbackFrameCount = 4;
+const uint32_t ReadbackMaxFrameCount = 16;
+
+struct VulkanReadbackRequest
+{
+    vk::Image image;
+    vk::ImageLayout layout = vk::ImageLayout::ePresentSrcKHR; // Expected in, and returned to, this layout
+    vk::Format format = vk::Format::eUndefined;
+    uint32_t bytesPerPixel = 4;
+    glm::uvec2 origin = glm::uvec2(0);
+    glm::uvec2 size = glm::uvec2(0);
+    bool bgra = false;
+    uint64_t frame = 0;
+    std::string label;
+    vk::Semaphore waitSemaphore; // Rendering into the image, if it's on another submit's semaphore
+    bool signal = true; // Signal the slot's semaphore; only if something will wait on it
+};
+
+void readback_init(VulkanContext& ctx);
+void readback_destroy(VulkanContext& ctx);
+
+// Copy an image region into the next free slot; only blocks if every slot is still in use.
+// Returns the semaphore signalled when the copy has finished with the image, if one was asked for
+vk::Semaphore readback_capture(VulkanContext& ctx, const VulkanReadbackRequest& request, const fnReadbackReady& fnReady);
+
+// Hand completed slots to the consumer, oldest first.  If wait is set, everything in flight is waited for
+void readback_collect(VulkanContext& ctx, bool wait, const fnReadbackReady& fnReady);
+
+// Called by the consumer, from any thread, when it has finished reading the slot
+void readback_release(VulkanReadbackFrame& frame);
+
+} // namespace vulkan
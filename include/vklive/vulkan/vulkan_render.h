@@ -18,5 +18,11 @@ void render_destroy(VulkanContext& ctx);
 void render(VulkanContext& ctx, const glm::vec4& rect, Scene& scene);
 RenderOutput render_get_output(VulkanContext& ctx, Scene& scene);
 void render_write_output(VulkanContext& ctx, Scene& scene, const fs::path& path);
+void render_write_target(VulkanContext& ctx, Scene& scene, const fs::path& path);
+void render_flush_output(VulkanContext& ctx, Scene& scene, const fs::path& path);
+
+// Draw the output as a grid of tiles, stitching them into a PNG a row of tiles at a time.
+// Neither the targets nor the memory used grow with the output size.  Headless only
+bool render_tiled(VulkanContext& ctx, Scene& scene, const glm::uvec2& outputSize, const glm::uvec2& tileSize, const fs::path& fileName);
 
 } // namespace vulkan
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <map>
+#include <tuple>
+
 #include <gli/gli.hpp>
 #include <glm/glm.hpp>
 
@@ -42,7 +45,8 @@ namespace VulkanSurfaceFlags
 enum
 {
     Sampled = (1 << 0),
-    Uploadable = (1 << 1)
+    Uploadable = (1 << 1),
+    Storage = (1 << 2)
 };
 }
 
@@ -75,10 +79,20 @@ struct VulkanSurface : Allocation
 
     vk::Format format{ vk::Format::eUndefined };
 
+    // VulkanSurfaceFlags used to create the surface
+    uint32_t flags = 0;
+
     VulkanBuffer stagingBuffer;
 
     uint64_t generation = 0;
 
+    // Increased every time a pass draws to the surface
+    uint64_t drawCount = 0;
+
+    // Contents kept from an earlier frame, because the pass writing them skipped this one.
+    // The surface is already readable, and must not be transitioned from undefined
+    bool heldContents = false;
+
     SurfaceKey key;
 
     // For UI read of this surface
@@ -95,10 +109,43 @@ std::string to_string(const VulkanSurface& surf);
 
 using MipData = ::std::pair<vk::Extent3D, vk::DeviceSize>;
 
+// Target surfaces outlive their scene in a pool, so that a reloaded scene can pick up
+// identical targets (and their contents) instead of reallocating them
+struct VulkanSurfacePoolKey
+{
+    SurfaceKey key;
+    vk::Format format{ vk::Format::eUndefined };
+    glm::uvec2 size = glm::uvec2(0);
+    uint32_t flags = 0;
+
+    bool operator<(const VulkanSurfacePoolKey& rhs) const
+    {
+        return std::tie(key, format, size.x, size.y, flags) < std::tie(rhs.key, rhs.format, rhs.size.x, rhs.size.y, rhs.flags);
+    }
+};
+
+struct VulkanSurfacePoolEntry
+{
+    std::shared_ptr<VulkanSurface> spSurface;
+    uint32_t sceneGeneration = 0;
+};
+
+struct VulkanSurfacePool
+{
+    std::map<VulkanSurfacePoolKey, VulkanSurfacePoolEntry> entries;
+    uint64_t reused = 0;
+    uint64_t allocated = 0;
+};
+
 void vulkan_surface_create(VulkanContext& ctx, VulkanSurface& vulkanImage, const glm::uvec2& size, vk::Format colorFormat, uint32_t flags);
 void vulkan_surface_create_depth(VulkanContext& ctx, VulkanSurface& vulkanImage, const glm::uvec2& size, vk::Format depthFormat);
 void vulkan_surface_destroy(VulkanContext& ctx, VulkanSurface& img);
 
+void vulkan_surface_pool_release(VulkanContext& ctx, const std::shared_ptr<VulkanSurface>& spSurface, uint32_t sceneGeneration);
+bool vulkan_surface_pool_claim(VulkanContext& ctx, VulkanSurface& surface, const glm::uvec2& size, vk::Format format, uint32_t flags);
+void vulkan_surface_pool_trim(VulkanContext& ctx, uint32_t sceneGeneration);
+void vulkan_surface_pool_destroy(VulkanContext& ctx);
+
 enum class VulkanSurfaceLayoutFlags
 {
     Image,
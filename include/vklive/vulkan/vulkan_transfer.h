@@ -0,0 +1,95 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include <vklive/vulkan/vulkan_buffer.h>
+
+namespace vulkan
+{
+
+struct VulkanContext;
+struct VulkanSurface;
+
+// A batch of uploads submitted together to the transfer queue.
+// The batch owns a slice of the staging ring until the timeline semaphore passes 'value'
+struct VulkanTransferBatch
+{
+    uint64_t value = 0;
+    vk::CommandBuffer commandBuffer;
+    vk::DeviceSize ringEnd = 0;
+
+    // Uploads too big for the ring get their own staging buffer, released with the batch
+    std::vector<VulkanBuffer> oversized;
+};
+
+struct VulkanTransferImageCopy
+{
+    vk::Image image;
+    vk::ImageSubresourceRange range;
+    vk::ImageLayout finalLayout;
+    std::vector<vk::BufferImageCopy> regions;
+    vk::Buffer source;
+};
+
+struct VulkanTransferBufferCopy
+{
+    vk::Buffer source;
+    vk::Buffer target;
+    vk::BufferCopy region;
+};
+
+// Staging uploads are copied into a persistent host visible ring, recorded, and only
+// submitted when the graphics queue is about to need them.  Nothing blocks unless the ring is full.
+struct VulkanTransfer
+{
+    std::mutex mutex;
+
+    uint32_t queueFamily = (uint32_t)-1;
+    vk::Queue queue;
+    vk::CommandPool commandPool;
+
+    // Signalled by the transfer queue; waited on by graphics submits
+    vk::Semaphore timeline;
+    uint64_t submittedValue = 0;
+
+    // The staging ring
+    VulkanBuffer ring;
+    uint8_t* pRingData = nullptr;
+    vk::DeviceSize ringHead = 0;
+    vk::DeviceSize ringTail = 0;
+    vk::DeviceSize alignment = 16;
+
+    // Recorded but not yet submitted
+    std::vector<VulkanTransferBufferCopy> pendingBuffers;
+    std::vector<VulkanTransferImageCopy> pendingImages;
+    std::vector<VulkanBuffer> pendingOversized;
+    vk::DeviceSize pendingBytes = 0;
+
+    std::vector<VulkanTransferBatch> inFlight;
+    std::vector<vk::CommandBuffer> freeCommandBuffers;
+
+    // Concurrent sharing between graphics and transfer families, when they differ
+    std::vector<uint32_t> sharedFamilies;
+};
+
+const vk::DeviceSize TransferRingSize = 64 * 1024 * 1024;
+
+void transfer_init(VulkanContext& ctx);
+void transfer_destroy(VulkanContext& ctx);
+
+// Make resources which are written by the transfer queue and read by the graphics queue shareable
+void transfer_set_sharing(VulkanContext& ctx, vk::BufferCreateInfo& info);
+void transfer_set_sharing(VulkanContext& ctx, vk::ImageCreateInfo& info);
+
+// Queue uploads; the data is copied immediately, so the caller can free it on return
+void transfer_upload_buffer(VulkanContext& ctx, vk::Buffer target, vk::DeviceSize size, const void* pData);
+void transfer_upload_image(VulkanContext& ctx, vk::Image target, const vk::ImageSubresourceRange& range, const std::vector<vk::BufferImageCopy>& regions, vk::DeviceSize size, const void* pData, vk::ImageLayout finalLayout);
+
+// Submit everything pending as a single batch; returns the timeline value which marks its completion
+uint64_t transfer_flush(VulkanContext& ctx);
+
+// Submit to the graphics queue, waiting on any outstanding uploads first
+void transfer_graphics_submit(VulkanContext& ctx, const vk::SubmitInfo& submitInfo, vk::Fence fence);
+
+} // namespace vulkan
@@ -21,7 +21,7 @@
 namespace vulkan
 {
 // Utils
-vk::Device utils_create_device(vk::PhysicalDevice const& physicalDevice, uint32_t queueFamilyIndex, std::vector<std::string> const& extensions = {}, vk::PhysicalDeviceFeatures const* physicalDeviceFeatures = nullptr, void const* pNext = nullptr);
+vk::Device utils_create_device(vk::PhysicalDevice const& physicalDevice, std::vector<vk::DeviceQueueCreateInfo> const& queueCreateInfos, std::vector<std::string> const& extensions = {}, vk::PhysicalDeviceFeatures const* physicalDeviceFeatures = nullptr, void const* pNext = nullptr);
 std::vector<std::string> utils_get_device_extensions();
 
 uint32_t utils_find_queue(VulkanContext& ctx, const vk::QueueFlags& desiredFlags, const vk::SurfaceKHR& presentSurface = nullptr);
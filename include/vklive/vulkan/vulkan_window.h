@@ -60,6 +60,7 @@ struct VulkanWindow
     uint32_t semaphoreIndex = 0; // Current set of swapchain wait semaphores we're using (needs to be distinct from per frame data)
     VulkanSwapFrame* frames = nullptr;
     VulkanFrameSemaphores* frameSemaphores = nullptr;
+    vk::Semaphore presentWaitSemaphore; // If set, present waits on this instead of render complete (e.g. a readback of the swap image)
 
     VulkanWindow()
     {
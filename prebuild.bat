@@ -10,7 +10,7 @@ if not exist "vcpkg\vcpkg.exe" (
 
 cd vcpkg
 echo Installing Libraries
-vcpkg install minizip lodepng tsl-ordered-map ableton-link cppcodec concurrentqueue portaudio range-v3 stb gli reproc fmt nativefiledialog tinyfiledialogs clipp assimp glm tinydir vulkan-memory-allocator spirv-reflect sdl2[vulkan] --triplet x64-windows-static-md --recurse
+vcpkg install minizip lodepng zlib meshoptimizer tsl-ordered-map ableton-link cppcodec concurrentqueue portaudio range-v3 stb gli reproc fmt nativefiledialog tinyfiledialogs clipp assimp glm tinydir vulkan-memory-allocator spirv-reflect sdl2[vulkan] --triplet x64-windows-static-md --recurse
 cd %~dp0
 
 echo %Time%
@@ -13,7 +13,7 @@ if [ "$(uname)" == "Darwin" ]; then
 fi
 
 cd vcpkg
-./vcpkg install lodepng minizip tsl-ordered-map ableton-link cppcodec range-v3 portaudio stb gli reproc fmt nativefiledialog tinyfiledialogs clipp concurrentqueue assimp glm tinydir vulkan-memory-allocator spirv-reflect sdl2[vulkan] --triplet ${triplet[0]} --recurse
+./vcpkg install lodepng zlib meshoptimizer minizip tsl-ordered-map ableton-link cppcodec range-v3 portaudio stb gli reproc fmt nativefiledialog tinyfiledialogs clipp concurrentqueue assimp glm tinydir vulkan-memory-allocator spirv-reflect sdl2[vulkan] --triplet ${triplet[0]} --recurse
 if [ "$(uname)" != "Darwin" ]; then
 ./vcpkg install glib --triplet ${triplet[0]} --recurse
 fi
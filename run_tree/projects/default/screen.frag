@@ -162,7 +162,7 @@ void main()
 
     // ro: ray origin
     // rd: direction of the ray
-    vec3 rd = normalize(vec3((gl_FragCoord.xy - 0.5 * ubo.iResolution.xy) / ubo.iResolution.y, 1.));
+    vec3 rd = normalize(vec3((iFragCoord - 0.5 * ubo.iResolution.xy) / ubo.iResolution.y, 1.));
     vec3 ro = vec3(0., 0., -6. + key * 1.6);
 
 #ifdef MOUSE_CAMERA_CONTROL
@@ -178,7 +178,7 @@ void main()
 #endif
 
 #ifdef DITHERING
-    vec2 dpos = (gl_FragCoord.xy / ubo.iResolution.xy);
+    vec2 dpos = (iFragCoord / ubo.iResolution.xy);
     vec2 seed = dpos + fract(ubo.iTime);
 // randomizing the length
 // rd *= (1. + fract(sin(dot(vec3(7, 157, 113), rd.zyx))*43758.5453)*0.1-0.03);
@@ -25,7 +25,7 @@ layout(set = 0, binding = 0) uniform UBO
     vec4 iChannelTime; // Time for an input channel
 
     vec4 iChannelResolution[4];    // Resolution for an input channel
-    vec4 ifFragCoordOffsetUniform;
+    vec4 ifFragCoordOffsetUniform; // Offset of the target in the output, when it is drawn in tiles
     vec4 eye;                      // The eye in world space
     
     mat4 model;                    // Transforms for camera based rendering
@@ -41,3 +41,6 @@ layout(set = 0, binding = 0) uniform UBO
 
 } ubo; 
 
+// Fragment position in the whole output; the same as gl_FragCoord unless the output is drawn in tiles
+#define iFragCoord (gl_FragCoord.xy + ubo.ifFragCoordOffsetUniform.xy)
+
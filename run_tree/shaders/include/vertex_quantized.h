@@ -0,0 +1,39 @@
+// For geometry loaded with 'quantize: true'.  The vertex inputs are:
+// layout(location = 0) in vec4 inPos;    // Position, relative to the model's bounds
+// layout(location = 1) in vec2 inUV;     // UV, relative to the model's UV range
+// layout(location = 2) in vec4 inColor;
+// layout(location = 3) in vec2 inNormal; // Octahedral
+// Decode them with the functions below; the scales are pushed for each model drawn
+
+layout(push_constant) uniform VertexQuantization
+{
+    vec4 positionScale;
+    vec4 positionOffset;
+    vec4 uvScaleOffset; // xy scale, zw offset
+} quantization;
+
+vec3 dequantize_position(vec4 pos)
+{
+    return pos.xyz * quantization.positionScale.xyz + quantization.positionOffset.xyz;
+}
+
+vec2 dequantize_uv(vec2 uv)
+{
+    return uv * quantization.uvScaleOffset.xy + quantization.uvScaleOffset.zw;
+}
+
+// Unit vector from the octahedral encoding; (0, 0) was a zero vector
+vec3 oct_decode(vec2 e)
+{
+    if (e == vec2(0.0))
+    {
+        return vec3(0.0);
+    }
+
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0)
+    {
+        v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(v);
+}
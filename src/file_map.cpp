@@ -0,0 +1,106 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <zest/logger/logger.h>
+
+#include <vklive/file_map.h>
+
+namespace
+{
+
+void file_unmap(FileMap* pMap)
+{
+#ifdef _WIN32
+    if (pMap->pData)
+    {
+        UnmapViewOfFile(pMap->pData);
+    }
+    if (pMap->hMapping)
+    {
+        CloseHandle(pMap->hMapping);
+    }
+    if (pMap->hFile && pMap->hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(pMap->hFile);
+    }
+#else
+    if (pMap->pData)
+    {
+        munmap((void*)pMap->pData, pMap->size);
+    }
+    if (pMap->fd != -1)
+    {
+        close(pMap->fd);
+    }
+#endif
+    delete pMap;
+}
+
+} // namespace
+
+std::shared_ptr<FileMap> file_map(const fs::path& path)
+{
+    auto spMap = std::shared_ptr<FileMap>(new FileMap(), file_unmap);
+
+#ifdef _WIN32
+    spMap->hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (spMap->hFile == INVALID_HANDLE_VALUE)
+    {
+        return nullptr;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(spMap->hFile, &size) || size.QuadPart == 0)
+    {
+        return nullptr;
+    }
+    spMap->size = size_t(size.QuadPart);
+
+    spMap->hMapping = CreateFileMappingW(spMap->hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!spMap->hMapping)
+    {
+        return nullptr;
+    }
+
+    spMap->pData = (const uint8_t*)MapViewOfFile(spMap->hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!spMap->pData)
+    {
+        LOG(ERR, "Could not map: " << path.string());
+        return nullptr;
+    }
+#else
+    spMap->fd = open(path.c_str(), O_RDONLY);
+    if (spMap->fd == -1)
+    {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(spMap->fd, &st) != 0 || st.st_size == 0)
+    {
+        return nullptr;
+    }
+    spMap->size = size_t(st.st_size);
+
+    auto pData = mmap(nullptr, spMap->size, PROT_READ, MAP_PRIVATE, spMap->fd, 0);
+    if (pData == MAP_FAILED)
+    {
+        LOG(ERR, "Could not map: " << path.string());
+        return nullptr;
+    }
+    spMap->pData = (const uint8_t*)pData;
+
+    // Mostly read front to back, once
+    madvise(pData, spMap->size, MADV_SEQUENTIAL);
+#endif
+
+    return spMap;
+}
@@ -0,0 +1,118 @@
+#include <cstring>
+#include <string>
+
+#include <vklive/image_exr.h>
+
+namespace
+{
+
+// EXR is little endian throughout
+template <typename T>
+void exr_put(std::vector<uint8_t>& out, T value)
+{
+    auto pos = out.size();
+    out.resize(pos + sizeof(T));
+    memcpy(out.data() + pos, &value, sizeof(T));
+}
+
+void exr_put_string(std::vector<uint8_t>& out, const char* psz)
+{
+    out.insert(out.end(), psz, psz + strlen(psz) + 1);
+}
+
+void exr_put_attribute(std::vector<uint8_t>& out, const char* pszName, const char* pszType, int32_t size)
+{
+    exr_put_string(out, pszName);
+    exr_put_string(out, pszType);
+    exr_put(out, size);
+}
+
+void exr_put_box(std::vector<uint8_t>& out, const char* pszName, uint32_t width, uint32_t height)
+{
+    exr_put_attribute(out, pszName, "box2i", 16);
+    exr_put(out, int32_t(0));
+    exr_put(out, int32_t(0));
+    exr_put(out, int32_t(width - 1));
+    exr_put(out, int32_t(height - 1));
+}
+
+} // namespace
+
+void exr_encode_rgba(std::vector<uint8_t>& out, const void* pPixels, uint32_t width, uint32_t height, size_t rowPitch, bool halfFloat)
+{
+    // Channels must be stored in name order
+    const char* ChannelNames[] = { "A", "B", "G", "R" };
+    const uint32_t ChannelSource[] = { 3, 2, 1, 0 };
+
+    const size_t channelBytes = halfFloat ? 2 : 4;
+    const size_t lineBytes = width * channelBytes * 4;
+
+    out.clear();
+
+    exr_put(out, uint32_t(20000630)); // Magic
+    exr_put(out, uint32_t(2)); // Version 2, scanline
+
+    exr_put_attribute(out, "channels", "chlist", int32_t(4 * (2 + 16) + 1));
+    for (auto& pszChannel : ChannelNames)
+    {
+        exr_put_string(out, pszChannel);
+        exr_put(out, int32_t(halfFloat ? 1 : 2)); // HALF or FLOAT
+        exr_put(out, uint32_t(0)); // pLinear and reserved
+        exr_put(out, int32_t(1)); // x sampling
+        exr_put(out, int32_t(1)); // y sampling
+    }
+    out.push_back(0);
+
+    exr_put_attribute(out, "compression", "compression", 1);
+    out.push_back(0); // NO_COMPRESSION
+
+    exr_put_box(out, "dataWindow", width, height);
+    exr_put_box(out, "displayWindow", width, height);
+
+    exr_put_attribute(out, "lineOrder", "lineOrder", 1);
+    out.push_back(0); // INCREASING_Y
+
+    exr_put_attribute(out, "pixelAspectRatio", "float", 4);
+    exr_put(out, 1.0f);
+
+    exr_put_attribute(out, "screenWindowCenter", "v2f", 8);
+    exr_put(out, 0.0f);
+    exr_put(out, 0.0f);
+
+    exr_put_attribute(out, "screenWindowWidth", "float", 4);
+    exr_put(out, 1.0f);
+
+    out.push_back(0); // End of header
+
+    // Offset table, then one chunk per scanline
+    const size_t chunkBytes = 8 + lineBytes;
+    const size_t tableStart = out.size();
+    const size_t dataStart = tableStart + size_t(height) * 8;
+    out.resize(dataStart + chunkBytes * height);
+
+    auto pSrc = (const uint8_t*)pPixels;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint64_t offset = dataStart + chunkBytes * y;
+        memcpy(out.data() + tableStart + y * 8, &offset, 8);
+
+        auto pChunk = out.data() + offset;
+        int32_t line = int32_t(y);
+        int32_t size = int32_t(lineBytes);
+        memcpy(pChunk, &line, 4);
+        memcpy(pChunk + 4, &size, 4);
+        pChunk += 8;
+
+        // Interleaved to planar, one channel after another for the whole line
+        auto pRow = pSrc + rowPitch * y;
+        for (auto source : ChannelSource)
+        {
+            // The header leaves the data unaligned, so copy rather than cast
+            auto pIn = pRow + source * channelBytes;
+            for (uint32_t x = 0; x < width; x++, pIn += channelBytes * 4, pChunk += channelBytes)
+            {
+                memcpy(pChunk, pIn, channelBytes);
+            }
+        }
+    }
+}
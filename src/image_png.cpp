@@ -0,0 +1,181 @@
+#include <cstring>
+
+#include <zlib.h>
+
+#include <zest/logger/logger.h>
+
+#include <vklive/image_png.h>
+
+namespace
+{
+
+// Deflated data is written out in chunks of about this size
+const size_t PngChunkSize = 1 << 20;
+
+// PNG is big endian throughout
+void png_put_u32(std::vector<uint8_t>& out, uint32_t value)
+{
+    out.push_back(uint8_t(value >> 24));
+    out.push_back(uint8_t(value >> 16));
+    out.push_back(uint8_t(value >> 8));
+    out.push_back(uint8_t(value));
+}
+
+void png_write_chunk(PngStream& png, const char* pszType, const uint8_t* pData, size_t size)
+{
+    std::vector<uint8_t> header;
+    png_put_u32(header, uint32_t(size));
+    header.insert(header.end(), pszType, pszType + 4);
+
+    // The CRC covers the type and the data
+    auto crc = crc32(0, header.data() + 4, 4);
+    if (size != 0)
+    {
+        crc = crc32(crc, pData, uInt(size));
+    }
+
+    std::vector<uint8_t> footer;
+    png_put_u32(footer, uint32_t(crc));
+
+    png.file.write((const char*)header.data(), header.size());
+    if (size != 0)
+    {
+        png.file.write((const char*)pData, size);
+    }
+    png.file.write((const char*)footer.data(), footer.size());
+
+    if (!png.file)
+    {
+        png.failed = true;
+    }
+}
+
+// Run the deflater over whatever input it has, writing IDAT chunks as they fill
+bool png_deflate(PngStream& png, int flush)
+{
+    auto& zs = *png.spDeflate;
+    for (;;)
+    {
+        auto pos = png.chunk.size();
+        png.chunk.resize(PngChunkSize);
+        zs.next_out = png.chunk.data() + pos;
+        zs.avail_out = uInt(PngChunkSize - pos);
+
+        auto ret = deflate(&zs, flush);
+        png.chunk.resize(PngChunkSize - zs.avail_out);
+        if (ret == Z_STREAM_ERROR)
+        {
+            png.failed = true;
+            return false;
+        }
+
+        if (png.chunk.size() == PngChunkSize || (ret == Z_STREAM_END && !png.chunk.empty()))
+        {
+            png_write_chunk(png, "IDAT", png.chunk.data(), png.chunk.size());
+            png.chunk.clear();
+        }
+
+        // More output to come only if the buffer filled up
+        if (ret == Z_STREAM_END || (zs.avail_in == 0 && zs.avail_out != 0))
+        {
+            return !png.failed;
+        }
+    }
+}
+
+} // namespace
+
+bool png_stream_begin(PngStream& png, const fs::path& path, uint32_t width, uint32_t height)
+{
+    png.file.open(path, std::ios::binary | std::ios::trunc);
+    if (!png.file)
+    {
+        LOG(ERR, "Could not open PNG for writing: " << path.string());
+        return false;
+    }
+
+    png.width = width;
+    png.height = height;
+    png.rowsWritten = 0;
+    png.failed = false;
+    png.filtered.resize(size_t(width) * 3 + 1);
+    png.chunk.clear();
+    png.chunk.reserve(PngChunkSize);
+
+    png.spDeflate = std::shared_ptr<z_stream_s>(new z_stream_s(), [](z_stream_s* pStream) {
+        deflateEnd(pStream);
+        delete pStream;
+    });
+    if (deflateInit(png.spDeflate.get(), Z_DEFAULT_COMPRESSION) != Z_OK)
+    {
+        png.failed = true;
+        return false;
+    }
+
+    const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    png.file.write((const char*)signature, sizeof(signature));
+
+    // 8 bit RGB, not interlaced
+    std::vector<uint8_t> header;
+    png_put_u32(header, width);
+    png_put_u32(header, height);
+    header.push_back(8);
+    header.push_back(2);
+    header.push_back(0);
+    header.push_back(0);
+    header.push_back(0);
+    png_write_chunk(png, "IHDR", header.data(), header.size());
+
+    return !png.failed;
+}
+
+bool png_stream_write_rows(PngStream& png, const uint8_t* pRows, uint32_t rows, size_t rowPitch)
+{
+    if (png.failed)
+    {
+        return false;
+    }
+
+    const size_t rowBytes = size_t(png.width) * 3;
+    rows = std::min(rows, png.height - png.rowsWritten);
+    for (uint32_t row = 0; row < rows; row++)
+    {
+        // Sub filter: cheap, and much better than none for anything smooth
+        auto pSrc = pRows + rowPitch * row;
+        auto pDst = png.filtered.data();
+        pDst[0] = 1;
+        memcpy(pDst + 1, pSrc, std::min(rowBytes, size_t(3)));
+        for (size_t i = 3; i < rowBytes; i++)
+        {
+            pDst[i + 1] = uint8_t(pSrc[i] - pSrc[i - 3]);
+        }
+
+        auto& zs = *png.spDeflate;
+        zs.next_in = png.filtered.data();
+        zs.avail_in = uInt(png.filtered.size());
+        if (!png_deflate(png, Z_NO_FLUSH))
+        {
+            return false;
+        }
+    }
+    png.rowsWritten += rows;
+    return true;
+}
+
+bool png_stream_end(PngStream& png)
+{
+    if (!png.failed && png.rowsWritten == png.height)
+    {
+        png.spDeflate->avail_in = 0;
+        png_deflate(png, Z_FINISH);
+        png_write_chunk(png, "IEND", nullptr, 0);
+    }
+    else
+    {
+        png.failed = true;
+    }
+
+    png.spDeflate.reset();
+    png.file.close();
+    return !png.failed;
+}
@@ -1,7 +1,12 @@
 // Loads model; no device specific stuff, just reads it
+#include <chrono>
+#include <functional>
+
 #include <zest/file/file.h>
 #include <zest/string/string_utils.h>
 #include <zest/logger/logger.h>
+#include <zest/thread/threadpool.h>
+#include <zest/time/profiler.h>
 
 #include <assimp/Importer.hpp>
 #include <assimp/cimport.h>
@@ -9,7 +14,12 @@
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 
+#include <glm/gtc/packing.hpp>
+
+#include <meshoptimizer.h>
+
 #include <vklive/model.h>
+#include <vklive/model_cache.h>
 
 const int DefaultModelFlags = aiProcess_FlipWindingOrder | aiProcess_Triangulate | aiProcess_PreTransformVertices | aiProcess_CalcTangentSpace | aiProcess_GenSmoothNormals;
 
@@ -21,6 +31,44 @@ VertexLayout g_vertexLayout{ {
     Component::VERTEX_COMPONENT_NORMAL,
 } };
 
+VertexLayout g_quantizedVertexLayout{ {
+    Component::VERTEX_COMPONENT_POSITION_HALF,
+    Component::VERTEX_COMPONENT_UV_UNORM16,
+    Component::VERTEX_COMPONENT_COLOR_UNORM8,
+    Component::VERTEX_COMPONENT_NORMAL_OCT,
+} };
+
+namespace
+{
+
+// Run fn(0..count-1) across the cores, returning once they are all done.
+// The pool is only for this, so it can't be starved by work waiting on a model load
+void model_parallel_for(uint32_t count, const std::function<void(uint32_t)>& fn)
+{
+    if (count < 2)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            fn(i);
+        }
+        return;
+    }
+
+    static TPool pool;
+    std::vector<std::future<void>> futures;
+    futures.reserve(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        futures.push_back(pool.enqueue([&fn, i]() { fn(i); }));
+    }
+    for (auto& future : futures)
+    {
+        future.get();
+    }
+}
+
+} // namespace
+
 std::set<std::string> model_file_extensions()
 {
     Assimp::Importer importer;
@@ -45,6 +93,18 @@ void model_load(Model& model, const ModelCreateInfo& createInfo, int flags)
 
     model.createInfo = createInfo;
 
+    // A model seen before, with the same settings, is read back already packed
+    auto cacheKey = model_cache_key(createInfo, flags);
+    if (cacheKey != 0 && model_cache_read(model, cacheKey))
+    {
+        LOG(INFO, "Mapped " << model.vertexCount << " vertices, " << model.indexCount << " indices from the mesh cache: " << createInfo.filename);
+        model.errors.clear();
+        model.loaded = true;
+        model.lastWrite = fs::last_write_time(createInfo.filename);
+        model.cacheKey = cacheKey;
+        return;
+    }
+
     Assimp::Importer importer;
     const aiScene* pScene;
 
@@ -58,12 +118,11 @@ void model_load(Model& model, const ModelCreateInfo& createInfo, int flags)
         return;
     }
 
-    // Embedded textures
-    model.embeddedTextures.clear();
-    for (unsigned int i = 0; i < pScene->mNumTextures; i++)
-    {
+    // Embedded textures; copied out in parallel, since the uncompressed ones can be large
+    std::vector<ModelTexture> textures(pScene->mNumTextures);
+    model_parallel_for(pScene->mNumTextures, [&](uint32_t i) {
         auto pTex = pScene->mTextures[i];
-        ModelTexture tex;
+        auto& tex = textures[i];
         tex.pathName = pTex->mFilename.C_Str();
         if (tex.pathName.empty())
         {
@@ -79,8 +138,13 @@ void model_load(Model& model, const ModelCreateInfo& createInfo, int flags)
             tex.data.resize(tex.size.x);
         }
         memcpy(tex.data.data(), pTex->pcData, tex.data.size());
+    });
 
-        model.embeddedTextures[tex.pathName] = tex;
+    model.embeddedTextures.clear();
+    for (auto& tex : textures)
+    {
+        auto pathName = tex.pathName;
+        model.embeddedTextures[pathName] = std::move(tex);
     }
 
     model.materials.clear();
@@ -139,128 +203,696 @@ void model_load(Model& model, const ModelCreateInfo& createInfo, int flags)
         model.materials.push_back(mat);
     }
 
+    // Size everything up front, so the packing writes straight into place
     model.parts.clear();
     model.parts.resize(pScene->mNumMeshes);
+    model.vertexCount = 0;
+    model.indexCount = 0;
     for (unsigned int i = 0; i < pScene->mNumMeshes; i++)
     {
         const aiMesh* paiMesh = pScene->mMeshes[i];
-        model.parts[i] = {};
-        model.parts[i].name = paiMesh->mName.C_Str();
-        model.parts[i].vertexBase = model.vertexCount;
-        model.parts[i].vertexCount = paiMesh->mNumVertices;
-        model.vertexCount += paiMesh->mNumVertices;
+        auto& part = model.parts[i];
+        part = {};
+        part.name = paiMesh->mName.C_Str();
+        part.vertexBase = model.vertexCount;
+        part.vertexCount = paiMesh->mNumVertices;
+        part.indexBase = model.indexCount;
+        for (unsigned int j = 0; j < paiMesh->mNumFaces; j++)
+        {
+            if (paiMesh->mFaces[j].mNumIndices == 3)
+            {
+                part.indexCount += 3;
+            }
+        }
+        model.vertexCount += part.vertexCount;
+        model.indexCount += part.indexCount;
     }
 
-    model.vertexData.clear();
-    model.indexData.clear();
-
-    model.vertexCount = 0;
-    model.indexCount = 0;
-
-    // Load meshes
-    for (unsigned int meshIndex = 0; meshIndex < pScene->mNumMeshes; meshIndex++)
-    {
+    auto plan = model_vertex_plan(createInfo.vertexLayout);
+    model.quantization = plan.quantized ? model_quantization(model, pScene) : Model::Quantization();
+    model.spCacheMap.reset();
+    model.pCachedVertices = nullptr;
+    model.pCachedIndices = nullptr;
+    model.vertexStride = plan.stride;
+    model.vertexData.resize(size_t(model.vertexCount) * plan.stride);
+    model.indexData.resize(model.indexCount);
+    model.dim = Model::Dimension();
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    // Load meshes; each has its own range of the buffers from the offsets above, so they can all pack at once
+    std::vector<Model::Dimension> meshDims(pScene->mNumMeshes);
+    model_parallel_for(pScene->mNumMeshes, [&](uint32_t meshIndex) {
         auto& part = model.parts[meshIndex];
         const aiMesh* paiMesh = pScene->mMeshes[meshIndex];
-        const auto& numVertices = pScene->mMeshes[meshIndex]->mNumVertices;
-        for (unsigned int vertexIndex = 0; vertexIndex < numVertices; vertexIndex++)
-        {
-            model_append_vertex(model, model.vertexData, pScene, meshIndex, vertexIndex);
-        }
 
-        model.dim.size = model.dim.max - model.dim.min;
+        model_pack_mesh(model, plan, pScene, meshIndex, model.vertexData.data() + size_t(part.vertexBase) * plan.stride, meshDims[meshIndex]);
 
-        model.vertexCount += numVertices;
-        part.indexBase = static_cast<uint32_t>(model.indexData.size());
+        // Indices are into the whole vertex buffer
+        auto pIndex = model.indexData.data() + part.indexBase;
         for (unsigned int j = 0; j < paiMesh->mNumFaces; j++)
         {
             const aiFace& Face = paiMesh->mFaces[j];
             if (Face.mNumIndices != 3)
                 continue;
-            model.indexData.push_back(part.indexBase + Face.mIndices[0]);
-            model.indexData.push_back(part.indexBase + Face.mIndices[1]);
-            model.indexData.push_back(part.indexBase + Face.mIndices[2]);
-            part.indexCount += 3;
+            *pIndex++ = part.vertexBase + Face.mIndices[0];
+            *pIndex++ = part.vertexBase + Face.mIndices[1];
+            *pIndex++ = part.vertexBase + Face.mIndices[2];
         }
-        model.indexCount += part.indexCount;
+    });
+
+    for (auto& dim : meshDims)
+    {
+        model.dim.min = glm::min(model.dim.min, dim.min);
+        model.dim.max = glm::max(model.dim.max, dim.max);
+    }
+    model.dim.size = model.dim.max - model.dim.min;
+
+    if (createInfo.optimize)
+    {
+        model_optimize(model, plan);
+    }
+
+    model.lods.clear();
+    if (createInfo.lod)
+    {
+        model_generate_lods(model, plan);
     }
-    
+
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    LOG(INFO, "Packed " << model.vertexCount << " vertices, " << model.indexCount << " indices from " << model.parts.size() << " meshes in " << seconds * 1000.0 << "ms (" << (model.vertexCount / std::max(seconds, 1e-6)) / 1e6 << " MVerts/s): " << createInfo.filename);
+
+    model_cache_write(model, cacheKey);
+
+    model.errors.clear();
     model.loaded = true;
     model.lastWrite = fs::last_write_time(createInfo.filename);
+    model.cacheKey = cacheKey;
 }
 
-void model_append_vertex(Model& model, std::vector<uint8_t>& outputBuffer, const aiScene* pScene, uint32_t meshIndex, uint32_t vertexIndex)
+void model_optimize(Model& model, const VertexPackPlan& plan)
 {
-    static const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
-    const aiMesh* paiMesh = pScene->mMeshes[meshIndex];
-    const auto& j = vertexIndex;
-    aiColor3D pColor(0.f, 0.f, 0.f);
-    pScene->mMaterials[paiMesh->mMaterialIndex]->Get(AI_MATKEY_COLOR_DIFFUSE, pColor);
-    const aiVector3D* pPos = &(paiMesh->mVertices[j]);
-    const aiVector3D* pNormal = &(paiMesh->mNormals[j]);
-    const aiVector3D* pTexCoord = (paiMesh->HasTextureCoords(0)) ? &(paiMesh->mTextureCoords[0][j]) : &Zero3D;
-    const aiVector3D* pTangent = (paiMesh->HasTangentsAndBitangents()) ? &(paiMesh->mTangents[j]) : &Zero3D;
-    const aiVector3D* pBiTangent = (paiMesh->HasTangentsAndBitangents()) ? &(paiMesh->mBitangents[j]) : &Zero3D;
-    std::vector<float> vertexBuffer;
-    glm::vec3 scaledPos{ pPos->x, -pPos->y, pPos->z };
-    scaledPos *= model.createInfo.scale;
-    scaledPos += model.createInfo.center;
-
-    // preallocate float buffer with approximate size
-    vertexBuffer.reserve(model.createInfo.vertexLayout.components.size() * 4);
-    for (auto& component : model.createInfo.vertexLayout.components)
+    PROFILE_SCOPE(model_optimize);
+
+    const auto stride = plan.stride;
+    bool hasPosition = false;
+    for (auto& step : plan.steps)
+    {
+        hasPosition |= step.source == VertexSource::Position;
+    }
+
+    // Mesh statistics, before and after; weighted by triangle count when summed over the parts
+    struct MeshStats
+    {
+        double acmr = 0.0; // Vertices transformed per triangle, for a 16 entry cache
+        double overdraw = 0.0; // Pixels shaded per pixel covered, from a few views
+        double overfetch = 0.0; // Vertex bytes read per byte used
+    };
+    std::vector<MeshStats> before(model.parts.size());
+    std::vector<MeshStats> after(model.parts.size());
+
+    auto fnStats = [&](const uint32_t* pIndices, uint32_t indexCount, const uint8_t* pVertices, uint32_t vertexCount, MeshStats& stats) {
+        auto triangles = indexCount / 3;
+        stats.acmr = meshopt_analyzeVertexCache(pIndices, indexCount, vertexCount, 16, 0, 0).acmr * triangles;
+        stats.overfetch = meshopt_analyzeVertexFetch(pIndices, indexCount, vertexCount, stride).overfetch * triangles;
+        if (hasPosition)
+        {
+            // Positions may be quantized in the layout, so are decoded for the analysis
+            auto positions = model_decode_positions(model, pVertices, vertexCount);
+            stats.overdraw = meshopt_analyzeOverdraw(pIndices, indexCount, &positions[0].x, vertexCount, sizeof(glm::vec3)).overdraw * triangles;
+        }
+    };
+
+    // Each part is welded and reordered within its own range of the buffers; they only get shorter
+    model_parallel_for(uint32_t(model.parts.size()), [&](uint32_t partIndex) {
+        auto& part = model.parts[partIndex];
+        auto pVertices = model.vertexData.data() + size_t(part.vertexBase) * stride;
+        auto pIndices = model.indexData.data() + part.indexBase;
+
+        // Local to the part while it's worked on
+        for (uint32_t i = 0; i < part.indexCount; i++)
+        {
+            pIndices[i] -= part.vertexBase;
+        }
+
+        if (part.indexCount == 0 || part.vertexCount == 0)
+        {
+            return;
+        }
+
+        fnStats(pIndices, part.indexCount, pVertices, part.vertexCount, before[partIndex]);
+
+        // Vertices with identical packed data become one
+        std::vector<uint32_t> remap(part.vertexCount);
+        auto uniqueCount = uint32_t(meshopt_generateVertexRemap(remap.data(), pIndices, part.indexCount, pVertices, part.vertexCount, stride));
+        std::vector<uint8_t> unique(size_t(uniqueCount) * stride);
+        meshopt_remapVertexBuffer(unique.data(), pVertices, part.vertexCount, stride, remap.data());
+        meshopt_remapIndexBuffer(pIndices, pIndices, part.indexCount, remap.data());
+
+        // Triangles for the post transform cache, then for less overdraw where that doesn't cost much of it,
+        // then vertices in the order they are first used
+        meshopt_optimizeVertexCache(pIndices, pIndices, part.indexCount, uniqueCount);
+        if (hasPosition)
+        {
+            auto positions = model_decode_positions(model, unique.data(), uniqueCount);
+            meshopt_optimizeOverdraw(pIndices, pIndices, part.indexCount, &positions[0].x, uniqueCount, sizeof(glm::vec3), 1.05f);
+        }
+        part.vertexCount = uint32_t(meshopt_optimizeVertexFetch(pVertices, pIndices, part.indexCount, unique.data(), uniqueCount, stride));
+
+        fnStats(pIndices, part.indexCount, pVertices, part.vertexCount, after[partIndex]);
+    });
+
+    // Close up the gaps left by the welded vertices
+    auto originalCount = model.vertexCount;
+    uint32_t vertexBase = 0;
+    for (auto& part : model.parts)
+    {
+        if (part.vertexBase != vertexBase)
+        {
+            memmove(model.vertexData.data() + size_t(vertexBase) * stride, model.vertexData.data() + size_t(part.vertexBase) * stride, size_t(part.vertexCount) * stride);
+        }
+        part.vertexBase = vertexBase;
+
+        auto pIndices = model.indexData.data() + part.indexBase;
+        for (uint32_t i = 0; i < part.indexCount; i++)
+        {
+            pIndices[i] += vertexBase;
+        }
+        vertexBase += part.vertexCount;
+    }
+    model.vertexCount = vertexBase;
+    model.vertexData.resize(size_t(model.vertexCount) * stride);
+    model.vertexData.shrink_to_fit();
+
+    MeshStats totalBefore;
+    MeshStats totalAfter;
+    for (size_t i = 0; i < model.parts.size(); i++)
+    {
+        totalBefore.acmr += before[i].acmr;
+        totalBefore.overdraw += before[i].overdraw;
+        totalBefore.overfetch += before[i].overfetch;
+        totalAfter.acmr += after[i].acmr;
+        totalAfter.overdraw += after[i].overdraw;
+        totalAfter.overfetch += after[i].overfetch;
+    }
+    auto triangles = std::max(double(model.indexCount / 3), 1.0);
+    LOG(INFO, fmt::format("Optimized {}: vertices {} -> {}, ACMR {:.3f} -> {:.3f}, overdraw {:.3f} -> {:.3f}, overfetch {:.3f} -> {:.3f}",
+                  model.createInfo.filename,
+                  originalCount,
+                  model.vertexCount,
+                  totalBefore.acmr / triangles,
+                  totalAfter.acmr / triangles,
+                  totalBefore.overdraw / triangles,
+                  totalAfter.overdraw / triangles,
+                  totalBefore.overfetch / triangles,
+                  totalAfter.overfetch / triangles));
+}
+
+void model_generate_lods(Model& model, const VertexPackPlan& plan)
+{
+    PROFILE_SCOPE(model_generate_lods);
+
+    // Each level aims for half the triangles of the one before, until that costs too much of the shape
+    const uint32_t MaxLods = 5;
+    const float LodReduction = 0.5f;
+    const float MaxLodError = 0.05f; // Relative to the part's extent
+
+    struct PartLod
+    {
+        std::vector<uint32_t> indices;
+        float error = 0.0f;
+    };
+    std::vector<std::vector<PartLod>> partLods(model.parts.size());
+
+    model_parallel_for(uint32_t(model.parts.size()), [&](uint32_t partIndex) {
+        auto& part = model.parts[partIndex];
+        if (part.indexCount == 0 || part.vertexCount == 0)
+        {
+            return;
+        }
+
+        auto positions = model_decode_positions(model, model.vertexData.data() + size_t(part.vertexBase) * plan.stride, part.vertexCount);
+        auto errorScale = meshopt_simplifyScale(&positions[0].x, part.vertexCount, sizeof(glm::vec3));
+
+        std::vector<uint32_t> source(part.indexCount);
+        for (uint32_t i = 0; i < part.indexCount; i++)
+        {
+            source[i] = model.indexData[part.indexBase + i] - part.vertexBase;
+        }
+
+        // Always simplified from the full part, so the errors are against the original surface
+        auto lastCount = part.indexCount;
+        for (uint32_t level = 1; level < MaxLods; level++)
+        {
+            auto targetCount = (uint32_t(lastCount * LodReduction) / 3) * 3;
+            if (targetCount < 3)
+            {
+                break;
+            }
+
+            PartLod lod;
+            lod.indices.resize(part.indexCount);
+            float error = 0.0f;
+            auto count = uint32_t(meshopt_simplify(lod.indices.data(), source.data(), part.indexCount, &positions[0].x, part.vertexCount, sizeof(glm::vec3), targetCount, MaxLodError, 0, &error));
+
+            // Not worth a level if the error limit stopped it early
+            if (count == 0 || count > lastCount * 0.9f)
+            {
+                break;
+            }
+
+            lod.indices.resize(count);
+            meshopt_optimizeVertexCache(lod.indices.data(), lod.indices.data(), count, part.vertexCount);
+            for (auto& index : lod.indices)
+            {
+                index += part.vertexBase;
+            }
+            lod.error = error * errorScale;
+            partLods[partIndex].push_back(std::move(lod));
+            lastCount = count;
+        }
+    });
+
+    uint32_t levels = 0;
+    for (auto& lods : partLods)
+    {
+        levels = std::max(levels, uint32_t(lods.size()));
+    }
+    if (levels == 0)
+    {
+        return;
+    }
+
+    // LOD 0 is the parts as they are; a part that ran out of levels repeats its coarsest in the rest
+    model.lods.push_back(Model::ModelLod{ 0, model.indexCount, 0.0f });
+    for (uint32_t level = 1; level <= levels; level++)
+    {
+        Model::ModelLod lod;
+        lod.indexBase = uint32_t(model.indexData.size());
+        for (size_t partIndex = 0; partIndex < model.parts.size(); partIndex++)
+        {
+            auto& part = model.parts[partIndex];
+            auto& lods = partLods[partIndex];
+            if (lods.empty())
+            {
+                model.indexData.insert(model.indexData.end(), model.indexData.begin() + part.indexBase, model.indexData.begin() + part.indexBase + part.indexCount);
+                continue;
+            }
+
+            auto& partLod = lods[std::min(size_t(level), lods.size()) - 1];
+            model.indexData.insert(model.indexData.end(), partLod.indices.begin(), partLod.indices.end());
+            lod.error = std::max(lod.error, partLod.error);
+        }
+        lod.indexCount = uint32_t(model.indexData.size()) - lod.indexBase;
+        model.lods.push_back(lod);
+    }
+    model.indexCount = uint32_t(model.indexData.size());
+
+    std::string levelInfo;
+    for (auto& lod : model.lods)
+    {
+        levelInfo += fmt::format(" {}/{:.4f}", lod.indexCount / 3, lod.error);
+    }
+    LOG(INFO, fmt::format("LODs for {} (triangles/error):{}", model.createInfo.filename, levelInfo));
+}
+
+uint32_t model_select_lod(const Model& model, float pixelsPerUnit, float maxPixelError)
+{
+    uint32_t selected = 0;
+    for (uint32_t lod = 1; lod < uint32_t(model.lods.size()); lod++)
+    {
+        if (model.lods[lod].error * pixelsPerUnit > maxPixelError)
+        {
+            break;
+        }
+        selected = lod;
+    }
+    return selected;
+}
+
+Model::ModelLod model_lod_range(const Model& model, uint32_t lod)
+{
+    if (model.lods.empty())
+    {
+        return Model::ModelLod{ 0, model.indexCount, 0.0f };
+    }
+    return model.lods[std::min(lod, uint32_t(model.lods.size()) - 1)];
+}
+
+const uint8_t* model_vertex_data(const Model& model)
+{
+    return model.pCachedVertices ? model.pCachedVertices : model.vertexData.data();
+}
+
+size_t model_vertex_bytes(const Model& model)
+{
+    return model.pCachedVertices ? size_t(model.vertexCount) * model.vertexStride : model.vertexData.size();
+}
+
+const uint32_t* model_index_data(const Model& model)
+{
+    return model.pCachedIndices ? model.pCachedIndices : model.indexData.data();
+}
+
+void model_release_data(Model& model)
+{
+    std::vector<uint8_t>().swap(model.vertexData);
+    std::vector<uint32_t>().swap(model.indexData);
+    model.spCacheMap.reset();
+    model.pCachedVertices = nullptr;
+    model.pCachedIndices = nullptr;
+    model.dataReleased = true;
+}
+
+bool model_reload_data(Model& model)
+{
+    if (!model.dataReleased)
     {
+        return true;
+    }
+
+    // Usually still in the mesh cache; if not, it's imported again
+    if (model.cacheKey == 0 || !model_cache_read(model, model.cacheKey))
+    {
+        LOG(DBG, "Reimporting released model: " << model.createInfo.filename);
+        model.loaded = false;
+        model_load(model, model.createInfo);
+    }
+
+    model.dataReleased = model_vertex_bytes(model) == 0;
+    return !model.dataReleased;
+}
+
+VertexPackPlan model_vertex_plan(const VertexLayout& layout)
+{
+    VertexPackPlan plan;
+    for (auto& component : layout.components)
+    {
+        VertexPackStep step;
+        step.offset = plan.stride;
+        step.size = component_size(component);
         switch (component)
         {
         case VERTEX_COMPONENT_POSITION:
-            vertexBuffer.push_back(scaledPos.x);
-            vertexBuffer.push_back(scaledPos.y);
-            vertexBuffer.push_back(scaledPos.z);
+            step.source = VertexSource::Position;
             break;
         case VERTEX_COMPONENT_NORMAL:
-            vertexBuffer.push_back(pNormal->x);
-            vertexBuffer.push_back(-pNormal->y);
-            vertexBuffer.push_back(pNormal->z);
+            step.source = VertexSource::Normal;
             break;
         case VERTEX_COMPONENT_UV:
-            vertexBuffer.push_back(pTexCoord->x * model.createInfo.uvscale.s);
-            vertexBuffer.push_back(pTexCoord->y * model.createInfo.uvscale.t);
+            step.source = VertexSource::UV;
             break;
         case VERTEX_COMPONENT_COLOR:
-            vertexBuffer.push_back(pColor.r);
-            vertexBuffer.push_back(pColor.g);
-            vertexBuffer.push_back(pColor.b);
-            vertexBuffer.push_back(1.0f);
+            step.source = VertexSource::Color;
             break;
         case VERTEX_COMPONENT_TANGENT:
-            vertexBuffer.push_back(pTangent->x);
-            vertexBuffer.push_back(pTangent->y);
-            vertexBuffer.push_back(pTangent->z);
+            step.source = VertexSource::Tangent;
             break;
         case VERTEX_COMPONENT_BITANGENT:
-            vertexBuffer.push_back(pBiTangent->x);
-            vertexBuffer.push_back(pBiTangent->y);
-            vertexBuffer.push_back(pBiTangent->z);
+            step.source = VertexSource::Bitangent;
             break;
-        // Dummy components for padding
-        case VERTEX_COMPONENT_DUMMY_INT:
-        case VERTEX_COMPONENT_DUMMY_FLOAT:
-            vertexBuffer.push_back(0.0f);
+        case VERTEX_COMPONENT_POSITION_HALF:
+            step.source = VertexSource::Position;
+            step.encoding = VertexEncoding::Half;
+            plan.quantized = true;
+            break;
+        case VERTEX_COMPONENT_NORMAL_OCT:
+            step.source = VertexSource::Normal;
+            step.encoding = VertexEncoding::Octahedral;
+            break;
+        case VERTEX_COMPONENT_TANGENT_OCT:
+            step.source = VertexSource::Tangent;
+            step.encoding = VertexEncoding::Octahedral;
             break;
-        case VERTEX_COMPONENT_DUMMY_INT4:
-        case VERTEX_COMPONENT_DUMMY_UINT4:
-        case VERTEX_COMPONENT_DUMMY_VEC4:
-            vertexBuffer.push_back(0.0f);
-            vertexBuffer.push_back(0.0f);
-            vertexBuffer.push_back(0.0f);
-            vertexBuffer.push_back(0.0f);
+        case VERTEX_COMPONENT_BITANGENT_OCT:
+            step.source = VertexSource::Bitangent;
+            step.encoding = VertexEncoding::Octahedral;
+            break;
+        case VERTEX_COMPONENT_UV_UNORM16:
+            step.source = VertexSource::UV;
+            step.encoding = VertexEncoding::Unorm16;
+            plan.quantized = true;
+            break;
+        case VERTEX_COMPONENT_COLOR_UNORM8:
+            step.source = VertexSource::Color;
+            step.encoding = VertexEncoding::Unorm8;
+            break;
+        // Dummy components for padding
+        default:
+            step.source = VertexSource::Zero;
             break;
         };
+        plan.steps.push_back(step);
+        plan.stride += component_size(component);
+    }
+    return plan;
+}
+
+namespace
+{
+
+// Write fnVertex(j), of type T, into one component of every vertex
+template <typename T, typename F>
+void model_pack_each(uint8_t* pOutput, uint32_t stride, uint32_t count, const F& fnVertex)
+{
+    for (uint32_t j = 0; j < count; j++)
+    {
+        T value = fnVertex(j);
+        memcpy(pOutput + size_t(j) * stride, &value, sizeof(T));
+    }
+}
+
+// Unit vector onto the octahedron, folded into the square; 2 values in -1..1
+glm::vec2 model_oct_encode(const glm::vec3& v)
+{
+    auto sum = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+    if (sum == 0.0f)
+    {
+        return glm::vec2(0.0f);
+    }
+
+    auto p = glm::vec2(v.x, v.y) / sum;
+    if (v.z < 0.0f)
+    {
+        p = glm::vec2((1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+    }
+    return p;
+}
+
+// A direction stream, in the layout's encoding; zero if the mesh doesn't have it
+void model_pack_direction(uint8_t* pOutput, uint32_t stride, uint32_t count, const aiVector3D* pSource, bool flipY, VertexEncoding encoding)
+{
+    auto fnDirection = [&](uint32_t j) {
+        return pSource ? glm::vec3(pSource[j].x, flipY ? -pSource[j].y : pSource[j].y, pSource[j].z) : glm::vec3(0.0f);
+    };
+
+    if (encoding == VertexEncoding::Octahedral)
+    {
+        model_pack_each<uint32_t>(pOutput, stride, count, [&](uint32_t j) {
+            return glm::packSnorm2x16(model_oct_encode(fnDirection(j)));
+        });
+    }
+    else
+    {
+        model_pack_each<glm::vec3>(pOutput, stride, count, fnDirection);
+    }
+}
+
+glm::vec3 model_transform_position(const Model& model, const aiVector3D& v)
+{
+    return glm::vec3(v.x, -v.y, v.z) * model.createInfo.scale + model.createInfo.center;
+}
+
+} // namespace
+
+Model::Quantization model_quantization(const Model& model, const aiScene* pScene)
+{
+    PROFILE_SCOPE(model_quantization);
+
+    // Bounds of everything the quantized components cover
+    struct Bounds
+    {
+        glm::vec3 positionMin = glm::vec3(FLT_MAX);
+        glm::vec3 positionMax = glm::vec3(-FLT_MAX);
+        glm::vec2 uvMin = glm::vec2(FLT_MAX);
+        glm::vec2 uvMax = glm::vec2(-FLT_MAX);
+    };
+    std::vector<Bounds> meshBounds(pScene->mNumMeshes);
+    model_parallel_for(pScene->mNumMeshes, [&](uint32_t meshIndex) {
+        const aiMesh* paiMesh = pScene->mMeshes[meshIndex];
+        auto& bounds = meshBounds[meshIndex];
+        for (uint32_t j = 0; j < paiMesh->mNumVertices; j++)
+        {
+            auto p = model_transform_position(model, paiMesh->mVertices[j]);
+            bounds.positionMin = glm::min(bounds.positionMin, p);
+            bounds.positionMax = glm::max(bounds.positionMax, p);
+        }
+        if (paiMesh->HasTextureCoords(0))
+        {
+            for (uint32_t j = 0; j < paiMesh->mNumVertices; j++)
+            {
+                auto uv = glm::vec2(paiMesh->mTextureCoords[0][j].x, paiMesh->mTextureCoords[0][j].y) * model.createInfo.uvscale;
+                bounds.uvMin = glm::min(bounds.uvMin, uv);
+                bounds.uvMax = glm::max(bounds.uvMax, uv);
+            }
+        }
+        else
+        {
+            bounds.uvMin = glm::min(bounds.uvMin, glm::vec2(0.0f));
+            bounds.uvMax = glm::max(bounds.uvMax, glm::vec2(0.0f));
+        }
+    });
+
+    Bounds total;
+    for (auto& bounds : meshBounds)
+    {
+        total.positionMin = glm::min(total.positionMin, bounds.positionMin);
+        total.positionMax = glm::max(total.positionMax, bounds.positionMax);
+        total.uvMin = glm::min(total.uvMin, bounds.uvMin);
+        total.uvMax = glm::max(total.uvMax, bounds.uvMax);
+    }
+
+    Model::Quantization quantization;
+    if (total.positionMin.x <= total.positionMax.x)
+    {
+        // Centred, so positions use the -1..1 range of the half floats, where they are most precise
+        quantization.positionOffset = (total.positionMin + total.positionMax) * 0.5f;
+        quantization.positionScale = glm::max((total.positionMax - total.positionMin) * 0.5f, glm::vec3(FLT_MIN));
+    }
+    if (total.uvMin.x <= total.uvMax.x)
+    {
+        quantization.uvOffset = total.uvMin;
+        quantization.uvScale = glm::max(total.uvMax - total.uvMin, glm::vec2(FLT_MIN));
+    }
+    return quantization;
+}
+
+void model_pack_mesh(const Model& model, const VertexPackPlan& plan, const aiScene* pScene, uint32_t meshIndex, uint8_t* pOutput, Model::Dimension& dim)
+{
+    const aiMesh* paiMesh = pScene->mMeshes[meshIndex];
+    const auto count = paiMesh->mNumVertices;
+    const auto stride = plan.stride;
+    const auto& quantization = model.quantization;
+
+    // One colour for the whole mesh
+    aiColor3D color(0.f, 0.f, 0.f);
+    pScene->mMaterials[paiMesh->mMaterialIndex]->Get(AI_MATKEY_COLOR_DIFFUSE, color);
+
+    // A component at a time, so each loop is a straight run over the mesh's stream
+    for (auto& step : plan.steps)
+    {
+        auto pDest = pOutput + step.offset;
+        switch (step.source)
+        {
+        case VertexSource::Position:
+        {
+            auto fnPosition = [&](uint32_t j) {
+                auto scaledPos = model_transform_position(model, paiMesh->mVertices[j]);
+                dim.max = glm::max(scaledPos, dim.max);
+                dim.min = glm::min(scaledPos, dim.min);
+                return scaledPos;
+            };
+            if (step.encoding == VertexEncoding::Half)
+            {
+                model_pack_each<glm::u16vec4>(pDest, stride, count, [&](uint32_t j) {
+                    auto p = (fnPosition(j) - quantization.positionOffset) / quantization.positionScale;
+                    return glm::u16vec4(glm::packHalf1x16(p.x), glm::packHalf1x16(p.y), glm::packHalf1x16(p.z), glm::packHalf1x16(1.0f));
+                });
+            }
+            else
+            {
+                model_pack_each<glm::vec3>(pDest, stride, count, fnPosition);
+            }
+            break;
+        }
+        case VertexSource::Normal:
+            model_pack_direction(pDest, stride, count, paiMesh->HasNormals() ? paiMesh->mNormals : nullptr, true, step.encoding);
+            break;
+        case VertexSource::UV:
+        {
+            auto pTexCoord = paiMesh->HasTextureCoords(0) ? paiMesh->mTextureCoords[0] : nullptr;
+            auto fnUV = [&](uint32_t j) {
+                return pTexCoord ? glm::vec2(pTexCoord[j].x, pTexCoord[j].y) * model.createInfo.uvscale : glm::vec2(0.0f);
+            };
+            if (step.encoding == VertexEncoding::Unorm16)
+            {
+                model_pack_each<uint32_t>(pDest, stride, count, [&](uint32_t j) {
+                    return glm::packUnorm2x16((fnUV(j) - quantization.uvOffset) / quantization.uvScale);
+                });
+            }
+            else
+            {
+                model_pack_each<glm::vec2>(pDest, stride, count, fnUV);
+            }
+            break;
+        }
+        case VertexSource::Color:
+        {
+            auto rgb = glm::vec3(color.r, color.g, color.b);
+            if (step.encoding == VertexEncoding::Unorm8)
+            {
+                auto packed = glm::packUnorm4x8(glm::vec4(rgb, 1.0f));
+                model_pack_each<uint32_t>(pDest, stride, count, [&](uint32_t) { return packed; });
+            }
+            else
+            {
+                model_pack_each<glm::vec3>(pDest, stride, count, [&](uint32_t) { return rgb; });
+            }
+            break;
+        }
+        case VertexSource::Tangent:
+        case VertexSource::Bitangent:
+        {
+            // Stored unflipped
+            const aiVector3D* pSource = nullptr;
+            if (paiMesh->HasTangentsAndBitangents())
+            {
+                pSource = step.source == VertexSource::Tangent ? paiMesh->mTangents : paiMesh->mBitangents;
+            }
+            model_pack_direction(pDest, stride, count, pSource, false, step.encoding);
+            break;
+        }
+        case VertexSource::Zero:
+            for (uint32_t j = 0; j < count; j++)
+            {
+                memset(pDest + size_t(j) * stride, 0, step.size);
+            }
+            break;
+        }
     }
-    vector_bytes_append(outputBuffer, vertexBuffer);
+}
+
+std::vector<glm::vec3> model_decode_positions(const Model& model, const uint8_t* pVertices, uint32_t count)
+{
+    std::vector<glm::vec3> positions;
 
-    model.dim.max = glm::max(scaledPos, model.dim.max);
-    model.dim.min = glm::min(scaledPos, model.dim.min);
+    auto plan = model_vertex_plan(model.createInfo.vertexLayout);
+    for (auto& step : plan.steps)
+    {
+        if (step.source != VertexSource::Position)
+        {
+            continue;
+        }
+
+        positions.resize(count);
+        for (uint32_t j = 0; j < count; j++)
+        {
+            auto pSource = pVertices + size_t(j) * plan.stride + step.offset;
+            if (step.encoding == VertexEncoding::Half)
+            {
+                glm::u16vec4 packed;
+                memcpy(&packed, pSource, sizeof(packed));
+                auto p = glm::vec3(glm::unpackHalf1x16(packed.x), glm::unpackHalf1x16(packed.y), glm::unpackHalf1x16(packed.z));
+                positions[j] = p * model.quantization.positionScale + model.quantization.positionOffset;
+            }
+            else
+            {
+                memcpy(&positions[j], pSource, sizeof(glm::vec3));
+            }
+        }
+        break;
+    }
+    return positions;
 }
 
 uint32_t component_index(const VertexLayout& layout, Component component)
@@ -293,6 +925,15 @@ uint32_t component_size(Component component)
         return 4 * sizeof(int32_t);
     case VERTEX_COMPONENT_DUMMY_UINT4:
         return 4 * sizeof(uint32_t);
+    case VERTEX_COMPONENT_POSITION_HALF:
+        return 4 * sizeof(uint16_t);
+    case VERTEX_COMPONENT_NORMAL_OCT:
+    case VERTEX_COMPONENT_TANGENT_OCT:
+    case VERTEX_COMPONENT_BITANGENT_OCT:
+    case VERTEX_COMPONENT_UV_UNORM16:
+        return 2 * sizeof(uint16_t);
+    case VERTEX_COMPONENT_COLOR_UNORM8:
+        return 4 * sizeof(uint8_t);
     default:
         // All components except the ones listed above are made up of 3 floats
         return 3 * sizeof(float);
@@ -0,0 +1,553 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <random>
+
+#include <fmt/format.h>
+
+#include <zest/logger/logger.h>
+#include <zest/time/profiler.h>
+
+#include <vklive/file_map.h>
+#include <vklive/model.h>
+#include <vklive/model_cache.h>
+
+namespace
+{
+
+// Bump when the packing or this format changes; old entries are then never matched
+const uint32_t ModelCacheVersion = 3;
+const uint32_t ModelCacheMagic = 0x434d4b56; // VKMC
+
+struct ModelCacheHeader
+{
+    uint32_t magic = ModelCacheMagic;
+    uint32_t version = ModelCacheVersion;
+    uint64_t key = 0;
+    uint32_t vertexStride = 0;
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+    uint32_t partCount = 0;
+    uint64_t vertexOffset = 0;
+    uint64_t indexOffset = 0;
+    uint64_t metaOffset = 0;
+    uint64_t metaSize = 0;
+    glm::vec3 dimMin;
+    glm::vec3 dimMax;
+    Model::Quantization quantization;
+};
+
+// The vertex data is aligned for the copy into staging
+const size_t ModelCacheAlignment = 16;
+
+// 64 bit FNV-1a, a word at a time; good enough to tell versions of a file apart, and quick on big ones
+uint64_t model_cache_hash(uint64_t hash, const void* pData, size_t size)
+{
+    const uint64_t Prime = 0x100000001b3ull;
+    auto pBytes = (const uint8_t*)pData;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, pBytes + i, 8);
+        hash = (hash ^ word) * Prime;
+    }
+    for (; i < size; i++)
+    {
+        hash = (hash ^ pBytes[i]) * Prime;
+    }
+    return hash;
+}
+
+template <typename T>
+uint64_t model_cache_hash(uint64_t hash, const T& value)
+{
+    return model_cache_hash(hash, &value, sizeof(T));
+}
+
+uint64_t model_cache_hash(uint64_t hash, const std::string& str)
+{
+    hash = model_cache_hash(hash, uint64_t(str.size()));
+    return model_cache_hash(hash, str.data(), str.size());
+}
+
+// Variable length parts of the entry: part names, LODs, materials and embedded textures
+template <typename T>
+void cache_put(std::vector<uint8_t>& out, const T& value)
+{
+    auto offset = out.size();
+    out.resize(offset + sizeof(T));
+    memcpy(out.data() + offset, &value, sizeof(T));
+}
+
+void cache_put(std::vector<uint8_t>& out, const std::string& str)
+{
+    cache_put(out, uint32_t(str.size()));
+    out.insert(out.end(), str.begin(), str.end());
+}
+
+struct CacheReader
+{
+    const uint8_t* pCurrent = nullptr;
+    const uint8_t* pEnd = nullptr;
+    bool failed = false;
+};
+
+template <typename T>
+T cache_get(CacheReader& reader)
+{
+    T value{};
+    if (size_t(reader.pEnd - reader.pCurrent) < sizeof(T))
+    {
+        reader.failed = true;
+        return value;
+    }
+    memcpy(&value, reader.pCurrent, sizeof(T));
+    reader.pCurrent += sizeof(T);
+    return value;
+}
+
+std::string cache_get_string(CacheReader& reader)
+{
+    auto size = cache_get<uint32_t>(reader);
+    if (reader.failed || size_t(reader.pEnd - reader.pCurrent) < size)
+    {
+        reader.failed = true;
+        return std::string();
+    }
+    std::string str((const char*)reader.pCurrent, size);
+    reader.pCurrent += size;
+    return str;
+}
+
+size_t cache_align(size_t offset)
+{
+    return (offset + ModelCacheAlignment - 1) & ~(ModelCacheAlignment - 1);
+}
+
+// Least recently used entries are removed when the cache grows past this
+const uint64_t ModelCacheMaxBytes = uint64_t(2) << 30;
+
+std::string cache_to_lower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+    return str;
+}
+
+// Whitespace separated tokens of each line of the file
+template <typename F>
+void cache_scan_lines(const FileMap& file, const F& fnLine)
+{
+    auto pCurrent = (const char*)file.pData;
+    auto pEnd = pCurrent + file.size;
+    while (pCurrent < pEnd)
+    {
+        auto pLineEnd = std::find(pCurrent, pEnd, '\n');
+        std::vector<std::string> tokens;
+        auto pToken = pCurrent;
+        while (pToken < pLineEnd)
+        {
+            while (pToken < pLineEnd && std::isspace((unsigned char)*pToken))
+            {
+                pToken++;
+            }
+            auto pTokenEnd = pToken;
+            while (pTokenEnd < pLineEnd && !std::isspace((unsigned char)*pTokenEnd))
+            {
+                pTokenEnd++;
+            }
+            if (pTokenEnd != pToken)
+            {
+                tokens.emplace_back(pToken, pTokenEnd);
+            }
+            pToken = pTokenEnd;
+        }
+        if (!tokens.empty())
+        {
+            fnLine(tokens);
+        }
+        pCurrent = pLineEnd + 1;
+    }
+}
+
+// The other files the importer reads for a model: an OBJ's material libraries and their textures, or a glTF's
+// buffers and images.  Other formats are taken to be self contained
+std::vector<fs::path> model_cache_dependencies(const fs::path& sourcePath, const FileMap& source)
+{
+    std::vector<fs::path> dependencies;
+    auto folder = sourcePath.parent_path();
+    auto extension = cache_to_lower(sourcePath.extension().string());
+    if (extension == ".obj")
+    {
+        std::vector<fs::path> libraries;
+        cache_scan_lines(source, [&](const std::vector<std::string>& tokens) {
+            if (tokens[0] == "mtllib")
+            {
+                for (size_t i = 1; i < tokens.size(); i++)
+                {
+                    libraries.push_back(folder / tokens[i]);
+                }
+            }
+        });
+
+        for (auto& library : libraries)
+        {
+            dependencies.push_back(library);
+            auto spLibrary = file_map(library);
+            if (!spLibrary)
+            {
+                continue;
+            }
+
+            // map_Kd, bump, disp, refl etc.; the file name comes last, after any options
+            cache_scan_lines(*spLibrary, [&](const std::vector<std::string>& tokens) {
+                auto statement = cache_to_lower(tokens[0]);
+                if (tokens.size() > 1 && (statement.compare(0, 4, "map_") == 0 || statement == "bump" || statement == "disp" || statement == "decal" || statement == "refl"))
+                {
+                    dependencies.push_back(library.parent_path() / tokens.back());
+                }
+            });
+        }
+    }
+    else if (extension == ".gltf")
+    {
+        // Every "uri" that isn't inline data
+        std::string text((const char*)source.pData, source.size);
+        const std::string UriKey = "\"uri\"";
+        for (auto pos = text.find(UriKey); pos != std::string::npos; pos = text.find(UriKey, pos + UriKey.size()))
+        {
+            auto start = text.find('"', text.find(':', pos + UriKey.size()));
+            auto end = start == std::string::npos ? std::string::npos : text.find('"', start + 1);
+            if (end == std::string::npos)
+            {
+                break;
+            }
+            auto uri = text.substr(start + 1, end - start - 1);
+            if (uri.compare(0, 5, "data:") != 0)
+            {
+                dependencies.push_back(folder / uri);
+            }
+        }
+    }
+    return dependencies;
+}
+
+// Removes the least recently used entries (reads refresh an entry's time) until the cache fits
+void model_cache_trim(const fs::path& folder)
+{
+    std::error_code ec;
+    std::vector<std::pair<fs::file_time_type, fs::path>> entries;
+    uint64_t totalBytes = 0;
+    for (auto& entry : fs::directory_iterator(folder, ec))
+    {
+        if (entry.is_regular_file(ec) && entry.path().extension() == ".vkmesh")
+        {
+            totalBytes += entry.file_size(ec);
+            entries.emplace_back(entry.last_write_time(ec), entry.path());
+        }
+    }
+
+    if (totalBytes <= ModelCacheMaxBytes)
+    {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end());
+    for (auto& [time, path] : entries)
+    {
+        if (totalBytes <= ModelCacheMaxBytes)
+        {
+            break;
+        }
+        auto size = fs::file_size(path, ec);
+        if (fs::remove(path, ec))
+        {
+            LOG(DBG, "Removed mesh cache entry: " << path.string());
+            totalBytes -= std::min(totalBytes, uint64_t(size));
+        }
+    }
+}
+
+} // namespace
+
+uint64_t model_cache_key(const ModelCreateInfo& createInfo, int flags)
+{
+    PROFILE_SCOPE(model_cache_key);
+
+    fs::path sourcePath(createInfo.filename);
+    auto spSource = file_map(sourcePath);
+    if (!spSource)
+    {
+        return 0;
+    }
+
+    uint64_t key = 0xcbf29ce484222325ull;
+    key = model_cache_hash(key, ModelCacheVersion);
+    key = model_cache_hash(key, spSource->pData, spSource->size);
+
+    // Files the model refers to, such as materials and a glTF's buffers; any change to them is seen by its size
+    // or time.  Nothing else in the folder counts, so editing a shader beside the model doesn't miss the cache
+    std::error_code ec;
+    for (auto& dependency : model_cache_dependencies(sourcePath, *spSource))
+    {
+        auto time = uint64_t(fs::last_write_time(dependency, ec).time_since_epoch().count());
+        auto size = uint64_t(fs::file_size(dependency, ec));
+        key = model_cache_hash(key, dependency.lexically_relative(sourcePath.parent_path()).generic_string());
+        key = model_cache_hash(key, ec ? uint64_t(0) : size ^ (time * 0x9e3779b97f4a7c15ull));
+    }
+
+    // Everything that changes the packed result
+    for (auto& component : createInfo.vertexLayout.components)
+    {
+        key = model_cache_hash(key, uint32_t(component));
+    }
+    key = model_cache_hash(key, createInfo.center);
+    key = model_cache_hash(key, createInfo.scale);
+    key = model_cache_hash(key, createInfo.uvscale);
+    key = model_cache_hash(key, flags);
+    key = model_cache_hash(key, createInfo.optimize);
+    key = model_cache_hash(key, createInfo.lod);
+
+    // 0 means no key
+    return key != 0 ? key : 1;
+}
+
+fs::path model_cache_path(uint64_t key)
+{
+    return fs::temp_directory_path() / "vklive" / "mesh_cache" / fmt::format("{:016x}.vkmesh", key);
+}
+
+bool model_cache_read(Model& model, uint64_t key)
+{
+    PROFILE_SCOPE(model_cache_read);
+
+    auto path = model_cache_path(key);
+    auto spMap = file_map(path);
+    if (!spMap || spMap->size < sizeof(ModelCacheHeader))
+    {
+        return false;
+    }
+
+    ModelCacheHeader header;
+    memcpy(&header, spMap->pData, sizeof(header));
+
+    auto fnInRange = [&](uint64_t offset, uint64_t size) {
+        return offset <= spMap->size && size <= spMap->size - offset;
+    };
+
+    if (header.magic != ModelCacheMagic || header.version != ModelCacheVersion || header.key != key || header.vertexStride != layout_size(model.createInfo.vertexLayout) || !fnInRange(header.vertexOffset, uint64_t(header.vertexCount) * header.vertexStride) || !fnInRange(header.indexOffset, uint64_t(header.indexCount) * sizeof(uint32_t)) || !fnInRange(header.metaOffset, header.metaSize) || (header.vertexOffset % ModelCacheAlignment) != 0 || (header.indexOffset % sizeof(uint32_t)) != 0)
+    {
+        LOG(DBG, "Ignoring stale or damaged mesh cache entry: " << path.string());
+        return false;
+    }
+
+    CacheReader reader;
+    reader.pCurrent = spMap->pData + header.metaOffset;
+    reader.pEnd = reader.pCurrent + header.metaSize;
+
+    std::vector<Model::ModelPart> parts(header.partCount);
+    for (auto& part : parts)
+    {
+        part.name = cache_get_string(reader);
+        part.vertexBase = cache_get<uint32_t>(reader);
+        part.vertexCount = cache_get<uint32_t>(reader);
+        part.indexBase = cache_get<uint32_t>(reader);
+        part.indexCount = cache_get<uint32_t>(reader);
+    }
+
+    std::vector<Model::ModelLod> lods;
+    auto lodCount = cache_get<uint32_t>(reader);
+    for (uint32_t i = 0; i < lodCount && !reader.failed; i++)
+    {
+        auto lod = cache_get<Model::ModelLod>(reader);
+        if (uint64_t(lod.indexBase) + lod.indexCount > header.indexCount)
+        {
+            reader.failed = true;
+        }
+        lods.push_back(lod);
+    }
+
+    std::map<std::string, ModelTexture> embeddedTextures;
+    auto textureCount = cache_get<uint32_t>(reader);
+    for (uint32_t i = 0; i < textureCount && !reader.failed; i++)
+    {
+        ModelTexture tex;
+        tex.pathName = cache_get_string(reader);
+        tex.size = cache_get<glm::uvec2>(reader);
+        auto bytes = cache_get<uint64_t>(reader);
+        if (reader.failed || uint64_t(reader.pEnd - reader.pCurrent) < bytes)
+        {
+            reader.failed = true;
+            break;
+        }
+        tex.data.assign(reader.pCurrent, reader.pCurrent + bytes);
+        reader.pCurrent += bytes;
+        auto pathName = tex.pathName;
+        embeddedTextures[pathName] = std::move(tex);
+    }
+
+    std::vector<ModelMaterial> materials;
+    auto materialCount = cache_get<uint32_t>(reader);
+    for (uint32_t i = 0; i < materialCount && !reader.failed; i++)
+    {
+        ModelMaterial mat;
+        mat.name = cache_get_string(reader);
+        mat.diffuse = cache_get<glm::vec4>(reader);
+        mat.ambient = cache_get<glm::vec4>(reader);
+        mat.specular = cache_get<glm::vec4>(reader);
+        mat.emissive = cache_get<glm::vec4>(reader);
+        mat.reflective = cache_get<glm::vec4>(reader);
+
+        auto mapCount = cache_get<uint32_t>(reader);
+        for (uint32_t map = 0; map < mapCount && !reader.failed; map++)
+        {
+            auto type = ModelTextureType(cache_get<uint32_t>(reader));
+            auto index = cache_get<int32_t>(reader);
+            auto itrTex = embeddedTextures.find(cache_get_string(reader));
+            if (itrTex != embeddedTextures.end())
+            {
+                mat.mapTextures[std::make_pair(type, index)] = &itrTex->second;
+            }
+        }
+        materials.push_back(mat);
+    }
+
+    if (reader.failed)
+    {
+        LOG(DBG, "Ignoring damaged mesh cache entry: " << path.string());
+        return false;
+    }
+
+    // The material texture pointers stay valid; map nodes don't move
+    model.parts = std::move(parts);
+    model.lods = std::move(lods);
+    model.embeddedTextures = std::move(embeddedTextures);
+    model.materials = std::move(materials);
+    model.vertexStride = header.vertexStride;
+    model.vertexCount = header.vertexCount;
+    model.indexCount = header.indexCount;
+    model.dim.min = header.dimMin;
+    model.dim.max = header.dimMax;
+    model.quantization = header.quantization;
+    model.dim.size = model.dim.max - model.dim.min;
+
+    model.vertexData.clear();
+    model.indexData.clear();
+    model.spCacheMap = spMap;
+    model.pCachedVertices = spMap->pData + header.vertexOffset;
+    model.pCachedIndices = (const uint32_t*)(spMap->pData + header.indexOffset);
+
+    // Marks the entry as recently used, for the trim
+    std::error_code ec;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+    return true;
+}
+
+void model_cache_write(const Model& model, uint64_t key)
+{
+    PROFILE_SCOPE(model_cache_write);
+
+    if (key == 0 || model_vertex_bytes(model) == 0)
+    {
+        return;
+    }
+
+    std::vector<uint8_t> meta;
+    for (auto& part : model.parts)
+    {
+        cache_put(meta, part.name);
+        cache_put(meta, part.vertexBase);
+        cache_put(meta, part.vertexCount);
+        cache_put(meta, part.indexBase);
+        cache_put(meta, part.indexCount);
+    }
+
+    cache_put(meta, uint32_t(model.lods.size()));
+    for (auto& lod : model.lods)
+    {
+        cache_put(meta, lod);
+    }
+
+    cache_put(meta, uint32_t(model.embeddedTextures.size()));
+    for (auto& [pathName, tex] : model.embeddedTextures)
+    {
+        cache_put(meta, pathName);
+        cache_put(meta, tex.size);
+        cache_put(meta, uint64_t(tex.data.size()));
+        meta.insert(meta.end(), tex.data.begin(), tex.data.end());
+    }
+
+    cache_put(meta, uint32_t(model.materials.size()));
+    for (auto& mat : model.materials)
+    {
+        cache_put(meta, mat.name);
+        cache_put(meta, mat.diffuse);
+        cache_put(meta, mat.ambient);
+        cache_put(meta, mat.specular);
+        cache_put(meta, mat.emissive);
+        cache_put(meta, mat.reflective);
+        cache_put(meta, uint32_t(mat.mapTextures.size()));
+        for (auto& [typeIndex, pTex] : mat.mapTextures)
+        {
+            cache_put(meta, uint32_t(typeIndex.first));
+            cache_put(meta, int32_t(typeIndex.second));
+            cache_put(meta, pTex->pathName);
+        }
+    }
+
+    ModelCacheHeader header;
+    header.key = key;
+    header.vertexStride = model.vertexStride;
+    header.vertexCount = model.vertexCount;
+    header.indexCount = model.indexCount;
+    header.partCount = uint32_t(model.parts.size());
+    header.vertexOffset = cache_align(sizeof(header));
+    header.indexOffset = cache_align(header.vertexOffset + model_vertex_bytes(model));
+    header.metaOffset = header.indexOffset + uint64_t(model.indexCount) * sizeof(uint32_t);
+    header.metaSize = meta.size();
+    header.dimMin = model.dim.min;
+    header.dimMax = model.dim.max;
+    header.quantization = model.quantization;
+
+    auto path = model_cache_path(key);
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+
+    // Written to the side and renamed into place, so a reader (perhaps another process) never sees half an entry
+    auto tempPath = path;
+    tempPath += fmt::format(".{:08x}.tmp", std::random_device()());
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            LOG(DBG, "Could not write mesh cache entry: " << tempPath.string());
+            return;
+        }
+
+        const char zeros[ModelCacheAlignment] = {};
+        file.write((const char*)&header, sizeof(header));
+        file.write(zeros, header.vertexOffset - sizeof(header));
+        file.write((const char*)model_vertex_data(model), model_vertex_bytes(model));
+        file.write(zeros, header.indexOffset - (header.vertexOffset + model_vertex_bytes(model)));
+        file.write((const char*)model_index_data(model), size_t(model.indexCount) * sizeof(uint32_t));
+        file.write((const char*)meta.data(), meta.size());
+        if (!file)
+        {
+            file.close();
+            fs::remove(tempPath, ec);
+            return;
+        }
+    }
+
+    fs::rename(tempPath, path, ec);
+    if (ec)
+    {
+        fs::remove(tempPath, ec);
+        return;
+    }
+    LOG(DBG, "Mesh cache entry: " << path.string() << ", " << fs::file_size(path, ec) << " bytes");
+
+    model_cache_trim(path.parent_path());
+}
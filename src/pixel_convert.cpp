@@ -0,0 +1,416 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <vklive/pixel_convert.h>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define PIXEL_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PIXEL_TARGET(x)
+#else
+// Kernels are compiled for their instruction set individually, and only called if the CPU has it
+#define PIXEL_TARGET(x) __attribute__((target(x)))
+#endif
+#endif
+
+namespace
+{
+
+// Stops inf/(1+inf) becoming NaN; anything this bright maps to white anyway
+const float TonemapMax = 1e30f;
+
+// Half to float conversions are done in chunks this size before tone mapping
+const size_t HalfChunkPixels = 64;
+
+struct PixelKernels
+{
+    const char* name = "scalar";
+    void (*swapRedBlue)(const uint8_t*, uint8_t*, size_t) = nullptr;
+    void (*dropAlpha)(const uint8_t*, uint8_t*, size_t, bool) = nullptr;
+    void (*tonemapFloat)(const float*, uint8_t*, size_t, float) = nullptr;
+    void (*halfToFloat)(const uint16_t*, float*, size_t) = nullptr;
+};
+
+// Scalar
+
+void swap_red_blue_scalar(const uint8_t* pSrc, uint8_t* pDst, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++, pSrc += 4, pDst += 4)
+    {
+        uint8_t r = pSrc[2];
+        uint8_t b = pSrc[0];
+        pDst[0] = r;
+        pDst[1] = pSrc[1];
+        pDst[2] = b;
+        pDst[3] = pSrc[3];
+    }
+}
+
+void drop_alpha_scalar(const uint8_t* pSrc, uint8_t* pDst, size_t pixels, bool swapRedBlue)
+{
+    const int r = swapRedBlue ? 2 : 0;
+    const int b = swapRedBlue ? 0 : 2;
+    for (size_t i = 0; i < pixels; i++, pSrc += 4, pDst += 3)
+    {
+        pDst[0] = pSrc[r];
+        pDst[1] = pSrc[1];
+        pDst[2] = pSrc[b];
+    }
+}
+
+inline float tonemap_clamp(float v)
+{
+    // Written so NaN goes to 0, as the SIMD max does
+    v = (v > 0.0f) ? v : 0.0f;
+    return std::min(v, TonemapMax);
+}
+
+void tonemap_float_scalar(const float* pSrc, uint8_t* pDst, size_t pixels, float exposure)
+{
+    for (size_t i = 0; i < pixels; i++, pSrc += 4, pDst += 4)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            float v = tonemap_clamp(pSrc[c] * exposure);
+            pDst[c] = uint8_t(std::sqrt(v / (v + 1.0f)) * 255.0f + 0.5f);
+        }
+        pDst[3] = uint8_t(std::min(tonemap_clamp(pSrc[3]), 1.0f) * 255.0f + 0.5f);
+    }
+}
+
+float half_to_float(uint16_t h)
+{
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+
+    uint32_t bits;
+    if (exponent == 0)
+    {
+        if (mantissa == 0)
+        {
+            bits = sign;
+        }
+        else
+        {
+            // Denormal; normalize it
+            exponent = 113;
+            while ((mantissa & 0x400) == 0)
+            {
+                mantissa <<= 1;
+                exponent--;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    }
+    else if (exponent == 31)
+    {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else
+    {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+void half_to_float_scalar(const uint16_t* pSrc, float* pDst, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        pDst[i] = half_to_float(pSrc[i]);
+    }
+}
+
+#if PIXEL_X86
+
+// SSE4.1: 4 pixels at a time
+
+PIXEL_TARGET("sse4.1")
+void swap_red_blue_sse(const uint8_t* pSrc, uint8_t* pDst, size_t pixels)
+{
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    size_t i = 0;
+    for (; i + 4 <= pixels; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(pSrc + i * 4));
+        _mm_storeu_si128((__m128i*)(pDst + i * 4), _mm_shuffle_epi8(v, mask));
+    }
+    swap_red_blue_scalar(pSrc + i * 4, pDst + i * 4, pixels - i);
+}
+
+PIXEL_TARGET("sse4.1")
+void drop_alpha_sse(const uint8_t* pSrc, uint8_t* pDst, size_t pixels, bool swapRedBlue)
+{
+    const __m128i mask = swapRedBlue ? _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+                                     : _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    size_t i = 0;
+    for (; i + 4 <= pixels; i += 4)
+    {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pSrc + i * 4)), mask);
+
+        // 12 bytes out; store exactly that so the end of the destination isn't overrun
+        _mm_storel_epi64((__m128i*)(pDst + i * 3), v);
+        int32_t tail = _mm_extract_epi32(v, 2);
+        memcpy(pDst + i * 3 + 8, &tail, sizeof(tail));
+    }
+    drop_alpha_scalar(pSrc + i * 4, pDst + i * 3, pixels - i, swapRedBlue);
+}
+
+PIXEL_TARGET("sse4.1")
+inline __m128i tonemap_pixel_sse(__m128 v, __m128 scale)
+{
+    v = _mm_mul_ps(v, scale);
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(TonemapMax));
+    __m128 mapped = _mm_sqrt_ps(_mm_div_ps(v, _mm_add_ps(v, _mm_set1_ps(1.0f))));
+    __m128 alpha = _mm_min_ps(v, _mm_set1_ps(1.0f));
+    v = _mm_blend_ps(mapped, alpha, 0x8);
+    return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+}
+
+PIXEL_TARGET("sse4.1")
+void tonemap_float_sse(const float* pSrc, uint8_t* pDst, size_t pixels, float exposure)
+{
+    const __m128 scale = _mm_setr_ps(exposure, exposure, exposure, 1.0f);
+    size_t i = 0;
+    for (; i + 4 <= pixels; i += 4)
+    {
+        const float* p = pSrc + i * 4;
+        __m128i p0 = tonemap_pixel_sse(_mm_loadu_ps(p), scale);
+        __m128i p1 = tonemap_pixel_sse(_mm_loadu_ps(p + 4), scale);
+        __m128i p2 = tonemap_pixel_sse(_mm_loadu_ps(p + 8), scale);
+        __m128i p3 = tonemap_pixel_sse(_mm_loadu_ps(p + 12), scale);
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+        _mm_storeu_si128((__m128i*)(pDst + i * 4), packed);
+    }
+    tonemap_float_scalar(pSrc + i * 4, pDst + i * 4, pixels - i, exposure);
+}
+
+// AVX2: 8 pixels at a time
+
+PIXEL_TARGET("avx2")
+void swap_red_blue_avx2(const uint8_t* pSrc, uint8_t* pDst, size_t pixels)
+{
+    const __m256i mask = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(pSrc + i * 4));
+        _mm256_storeu_si256((__m256i*)(pDst + i * 4), _mm256_shuffle_epi8(v, mask));
+    }
+    swap_red_blue_scalar(pSrc + i * 4, pDst + i * 4, pixels - i);
+}
+
+PIXEL_TARGET("avx2")
+void drop_alpha_avx2(const uint8_t* pSrc, uint8_t* pDst, size_t pixels, bool swapRedBlue)
+{
+    const __m256i mask = swapRedBlue ? _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+                                     : _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    // Each lane has 12 packed bytes; close the gap between them
+    const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8)
+    {
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(pSrc + i * 4)), mask);
+        v = _mm256_permutevar8x32_epi32(v, pack);
+        _mm_storeu_si128((__m128i*)(pDst + i * 3), _mm256_castsi256_si128(v));
+        _mm_storel_epi64((__m128i*)(pDst + i * 3 + 16), _mm256_extracti128_si256(v, 1));
+    }
+    drop_alpha_scalar(pSrc + i * 4, pDst + i * 3, pixels - i, swapRedBlue);
+}
+
+PIXEL_TARGET("avx2")
+inline __m256i tonemap_pixels_avx2(__m256 v, __m256 scale)
+{
+    v = _mm256_mul_ps(v, scale);
+    v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(TonemapMax));
+    __m256 mapped = _mm256_sqrt_ps(_mm256_div_ps(v, _mm256_add_ps(v, _mm256_set1_ps(1.0f))));
+    __m256 alpha = _mm256_min_ps(v, _mm256_set1_ps(1.0f));
+    v = _mm256_blend_ps(mapped, alpha, 0x88);
+    return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(v, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f)));
+}
+
+PIXEL_TARGET("avx2")
+void tonemap_float_avx2(const float* pSrc, uint8_t* pDst, size_t pixels, float exposure)
+{
+    const __m256 scale = _mm256_setr_ps(exposure, exposure, exposure, 1.0f, exposure, exposure, exposure, 1.0f);
+
+    // The packs work within 128 bit lanes, leaving the pixels in the order 0 2 4 6 1 3 5 7
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8)
+    {
+        const float* p = pSrc + i * 4;
+        __m256i p0 = tonemap_pixels_avx2(_mm256_loadu_ps(p), scale);
+        __m256i p1 = tonemap_pixels_avx2(_mm256_loadu_ps(p + 8), scale);
+        __m256i p2 = tonemap_pixels_avx2(_mm256_loadu_ps(p + 16), scale);
+        __m256i p3 = tonemap_pixels_avx2(_mm256_loadu_ps(p + 24), scale);
+        __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(p0, p1), _mm256_packs_epi32(p2, p3));
+        _mm256_storeu_si256((__m256i*)(pDst + i * 4), _mm256_permutevar8x32_epi32(packed, order));
+    }
+    tonemap_float_scalar(pSrc + i * 4, pDst + i * 4, pixels - i, exposure);
+}
+
+PIXEL_TARGET("avx2,f16c")
+void half_to_float_f16c(const uint16_t* pSrc, float* pDst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        _mm256_storeu_ps(pDst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(pSrc + i))));
+    }
+    half_to_float_scalar(pSrc + i, pDst + i, count - i);
+}
+
+struct CpuFeatures
+{
+    bool sse41 = false;
+    bool avx2 = false;
+    bool f16c = false;
+};
+
+CpuFeatures cpu_features()
+{
+    CpuFeatures features;
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    features.sse41 = (info[2] & (1 << 19)) != 0;
+    bool osAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+    features.f16c = osAvx && (info[2] & (1 << 29)) != 0;
+    if (osAvx && maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        features.avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    features.sse41 = __builtin_cpu_supports("sse4.1");
+    features.avx2 = __builtin_cpu_supports("avx2");
+    features.f16c = features.avx2 && __builtin_cpu_supports("f16c");
+#endif
+    return features;
+}
+
+#endif // PIXEL_X86
+
+PixelKernels pixel_scalar_kernels()
+{
+    PixelKernels kernels;
+    kernels.swapRedBlue = swap_red_blue_scalar;
+    kernels.dropAlpha = drop_alpha_scalar;
+    kernels.tonemapFloat = tonemap_float_scalar;
+    kernels.halfToFloat = half_to_float_scalar;
+    return kernels;
+}
+
+// Every kernel set the CPU can run, best first
+std::vector<PixelKernels> pixel_available_kernels()
+{
+    std::vector<PixelKernels> available;
+
+#if PIXEL_X86
+    auto features = cpu_features();
+    auto simd = pixel_scalar_kernels();
+    if (features.f16c)
+    {
+        simd.halfToFloat = half_to_float_f16c;
+    }
+    if (features.avx2)
+    {
+        auto& kernels = available.emplace_back(simd);
+        kernels.name = "avx2";
+        kernels.swapRedBlue = swap_red_blue_avx2;
+        kernels.dropAlpha = drop_alpha_avx2;
+        kernels.tonemapFloat = tonemap_float_avx2;
+    }
+    if (features.sse41)
+    {
+        auto& kernels = available.emplace_back(simd);
+        kernels.name = "sse4.1";
+        kernels.swapRedBlue = swap_red_blue_sse;
+        kernels.dropAlpha = drop_alpha_sse;
+        kernels.tonemapFloat = tonemap_float_sse;
+    }
+#endif
+    available.push_back(pixel_scalar_kernels());
+    return available;
+}
+
+PixelKernels& pixel_kernels()
+{
+    static PixelKernels kernels = pixel_available_kernels().front();
+    return kernels;
+}
+
+} // namespace
+
+void pixel_swap_red_blue(const uint8_t* pSrc, uint8_t* pDst, size_t pixels)
+{
+    pixel_kernels().swapRedBlue(pSrc, pDst, pixels);
+}
+
+void pixel_drop_alpha(const uint8_t* pSrc, uint8_t* pDst, size_t pixels, bool swapRedBlue)
+{
+    pixel_kernels().dropAlpha(pSrc, pDst, pixels, swapRedBlue);
+}
+
+void pixel_tonemap_float(const float* pSrc, uint8_t* pDst, size_t pixels, float exposure)
+{
+    pixel_kernels().tonemapFloat(pSrc, pDst, pixels, exposure);
+}
+
+void pixel_tonemap_half(const uint16_t* pSrc, uint8_t* pDst, size_t pixels, float exposure)
+{
+    auto& kernels = pixel_kernels();
+
+    // Widen a chunk at a time on the stack, then tone map as floats
+    float chunk[HalfChunkPixels * 4];
+    for (size_t i = 0; i < pixels; i += HalfChunkPixels)
+    {
+        auto count = std::min(HalfChunkPixels, pixels - i);
+        kernels.halfToFloat(pSrc + i * 4, chunk, count * 4);
+        kernels.tonemapFloat(chunk, pDst + i * 4, count, exposure);
+    }
+}
+
+const char* pixel_convert_backend()
+{
+    return pixel_kernels().name;
+}
+
+std::vector<std::string> pixel_convert_backends()
+{
+    std::vector<std::string> names;
+    for (auto& kernels : pixel_available_kernels())
+    {
+        names.push_back(kernels.name);
+    }
+    return names;
+}
+
+bool pixel_convert_set_backend(const std::string& name)
+{
+    for (auto& kernels : pixel_available_kernels())
+    {
+        if (name == kernels.name)
+        {
+            pixel_kernels() = kernels;
+            return true;
+        }
+    }
+    return false;
+}
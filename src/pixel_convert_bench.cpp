@@ -0,0 +1,185 @@
+// Checks every pixel conversion kernel set the CPU can run against the scalar one, byte for byte,
+// and times them at 1080p and 4K.  Returns non-zero if any kernel disagrees with scalar.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <vklive/pixel_convert.h>
+
+namespace
+{
+
+const int TimingRuns = 10;
+
+struct Resolution
+{
+    const char* name;
+    size_t width;
+    size_t height;
+};
+
+const Resolution Resolutions[] = {
+    { "1080p", 1920, 1080 },
+    { "4K", 3840, 2160 },
+};
+
+struct Source
+{
+    std::vector<uint8_t> bytes;
+    std::vector<float> floats;
+    std::vector<uint16_t> halves;
+};
+
+// Random data, with the awkward floats (negative, huge, inf, NaN) sprinkled in
+Source make_source(size_t pixels)
+{
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<int> byteDist(0, 255);
+    std::uniform_real_distribution<float> floatDist(-0.5f, 8.0f);
+    std::uniform_int_distribution<int> halfDist(0, 0xffff);
+
+    Source source;
+    source.bytes.resize(pixels * 4);
+    source.floats.resize(pixels * 4);
+    source.halves.resize(pixels * 4);
+    for (size_t i = 0; i < pixels * 4; i++)
+    {
+        source.bytes[i] = uint8_t(byteDist(rng));
+        source.floats[i] = floatDist(rng);
+        source.halves[i] = uint16_t(halfDist(rng));
+    }
+
+    const float special[] = { 1e20f, -1e20f, std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN(), 0.0f, -0.0f };
+    for (size_t i = 0; i < pixels * 4; i += 97)
+    {
+        source.floats[i] = special[(i / 97) % std::size(special)];
+    }
+    return source;
+}
+
+struct Outputs
+{
+    std::vector<uint8_t> swapped;
+    std::vector<uint8_t> dropped;
+    std::vector<uint8_t> droppedSwapped;
+    std::vector<uint8_t> tonemapFloat;
+    std::vector<uint8_t> tonemapHalf;
+};
+
+struct Timings
+{
+    double swap = 0.0;
+    double drop = 0.0;
+    double tonemapFloat = 0.0;
+    double tonemapHalf = 0.0;
+};
+
+// Best of a few runs, in milliseconds
+template <typename F>
+double time_best(F&& fn)
+{
+    double best = std::numeric_limits<double>::max();
+    for (int run = 0; run < TimingRuns; run++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        fn();
+        auto end = std::chrono::high_resolution_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+Outputs run_kernels(const Source& source, size_t pixels, Timings& timings)
+{
+    Outputs out;
+    out.swapped.resize(pixels * 4);
+    out.dropped.resize(pixels * 3);
+    out.droppedSwapped.resize(pixels * 3);
+    out.tonemapFloat.resize(pixels * 4);
+    out.tonemapHalf.resize(pixels * 4);
+
+    timings.swap = time_best([&]() { pixel_swap_red_blue(source.bytes.data(), out.swapped.data(), pixels); });
+    timings.drop = time_best([&]() { pixel_drop_alpha(source.bytes.data(), out.droppedSwapped.data(), pixels, true); });
+    pixel_drop_alpha(source.bytes.data(), out.dropped.data(), pixels, false);
+    timings.tonemapFloat = time_best([&]() { pixel_tonemap_float(source.floats.data(), out.tonemapFloat.data(), pixels, 1.5f); });
+    timings.tonemapHalf = time_best([&]() { pixel_tonemap_half(source.halves.data(), out.tonemapHalf.data(), pixels, 1.5f); });
+    return out;
+}
+
+bool check(const char* backend, const char* kernel, const std::vector<uint8_t>& expected, const std::vector<uint8_t>& actual)
+{
+    auto mismatch = std::mismatch(expected.begin(), expected.end(), actual.begin());
+    if (mismatch.first == expected.end())
+    {
+        return true;
+    }
+    auto offset = size_t(mismatch.first - expected.begin());
+    printf("MISMATCH: %s %s at byte %zu: scalar %d, got %d\n", backend, kernel, offset, int(*mismatch.first), int(*mismatch.second));
+    return false;
+}
+
+} // namespace
+
+int main()
+{
+    auto backends = pixel_convert_backends();
+    bool ok = true;
+
+    for (auto& res : Resolutions)
+    {
+        auto pixels = res.width * res.height;
+        auto source = make_source(pixels);
+
+        // A few pixels too, so the scalar tails after the vector loops are checked
+        for (size_t tail : { size_t(1), size_t(7), size_t(13) })
+        {
+            Timings unused;
+            pixel_convert_set_backend("scalar");
+            auto expected = run_kernels(source, tail, unused);
+            for (auto& backend : backends)
+            {
+                pixel_convert_set_backend(backend);
+                auto actual = run_kernels(source, tail, unused);
+                ok &= check(backend.c_str(), "swap red blue tail", expected.swapped, actual.swapped);
+                ok &= check(backend.c_str(), "drop alpha tail", expected.dropped, actual.dropped);
+                ok &= check(backend.c_str(), "drop alpha swapped tail", expected.droppedSwapped, actual.droppedSwapped);
+                ok &= check(backend.c_str(), "tonemap float tail", expected.tonemapFloat, actual.tonemapFloat);
+                ok &= check(backend.c_str(), "tonemap half tail", expected.tonemapHalf, actual.tonemapHalf);
+            }
+        }
+
+        printf("%s (%zux%zu), best of %d, ms\n", res.name, res.width, res.height, TimingRuns);
+        printf("  %-8s %12s %12s %14s %13s\n", "backend", "bgra<->rgba", "bgra->rgb", "tonemap float", "tonemap half");
+
+        pixel_convert_set_backend("scalar");
+        Timings scalarTimings;
+        auto expected = run_kernels(source, pixels, scalarTimings);
+
+        for (auto& backend : backends)
+        {
+            pixel_convert_set_backend(backend);
+            Timings timings;
+            auto actual = backend == "scalar" ? expected : run_kernels(source, pixels, timings);
+            if (backend == "scalar")
+            {
+                timings = scalarTimings;
+            }
+
+            auto name = backend.c_str();
+            ok &= check(name, "swap red blue", expected.swapped, actual.swapped);
+            ok &= check(name, "drop alpha", expected.dropped, actual.dropped);
+            ok &= check(name, "drop alpha swapped", expected.droppedSwapped, actual.droppedSwapped);
+            ok &= check(name, "tonemap float", expected.tonemapFloat, actual.tonemapFloat);
+            ok &= check(name, "tonemap half", expected.tonemapHalf, actual.tonemapHalf);
+
+            printf("  %-8s %12.2f %12.2f %14.2f %13.2f\n", name, timings.swap, timings.drop, timings.tonemapFloat, timings.tonemapHalf);
+        }
+    }
+
+    printf(ok ? "All kernels match scalar\n" : "Kernels differ from scalar\n");
+    return ok ? 0 : 1;
+}
@@ -67,3 +67,62 @@ std::error_code run_process(const std::vector<std::string>& args, std::string* p
     }
     return ec;
 }
+
+std::shared_ptr<ProcessPipe> process_pipe_start(const std::vector<std::string>& args, std::error_code& ec, bool forwardOutput)
+{
+    assert(!args.empty());
+
+    reproc::options options;
+    options.redirect.out.type = forwardOutput ? reproc::redirect::parent : reproc::redirect::discard;
+    options.redirect.err.type = reproc::redirect::parent;
+
+    auto spPipe = std::make_shared<ProcessPipe>();
+    spPipe->spProcess = std::make_shared<reproc::process>();
+    spPipe->name = args[0];
+
+    ec = spPipe->spProcess->start(args, options);
+    if (ec == std::errc::no_such_file_or_directory)
+    {
+        LOG(DBG, "ProcessPipe - Program Not Found : " << args[0]);
+        return nullptr;
+    }
+    else if (ec)
+    {
+        LOG(ERR, "ProcessPipe - " << ec.message());
+        return nullptr;
+    }
+    return spPipe;
+}
+
+std::error_code process_pipe_write(ProcessPipe& pipe, const uint8_t* pData, size_t size)
+{
+    // The pipe may take less than we give it
+    while (size > 0)
+    {
+        auto [written, ec] = pipe.spProcess->write(pData, size);
+        if (ec)
+        {
+            LOG(ERR, "ProcessPipe Write - " << pipe.name << " : " << ec.message());
+            return ec;
+        }
+        pData += written;
+        size -= written;
+    }
+    return std::error_code();
+}
+
+int process_pipe_finish(ProcessPipe& pipe)
+{
+    pipe.spProcess->close(reproc::stream::in);
+
+    auto [status, ec] = pipe.spProcess->wait(reproc::infinite);
+    if (ec)
+    {
+        LOG(ERR, "ProcessPipe - " << pipe.name << " : " << ec.message());
+    }
+    else if (status)
+    {
+        LOG(ERR, "ProcessPipe - " << pipe.name << " exited with " << status);
+    }
+    return status;
+}
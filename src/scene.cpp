@@ -37,6 +37,9 @@ extern "C" {
 #define T_PATH "path"
 #define T_PATH_NAME "path_name"
 #define T_BUILD_AS "build_as"
+#define T_OPTIMIZE "optimize"
+#define T_QUANTIZE "quantize"
+#define T_LOD "lod"
 #define T_SAMPLERS "samplers"
 #define T_SCALE "scale"
 #define T_SCENEGRAPH "scenegraph"
@@ -54,6 +57,8 @@ extern "C" {
 #define T_VS "vs"
 #define T_SCRIPT "script"
 #define T_ENTRY "entry"
+#define T_EVERY "every"
+#define T_ON_CHANGE "on_change"
 #define T_RAY_GROUP_GENERAL "ray_group_general"
 #define T_RAY_GROUP_TRIANGLES "ray_group_triangles"
 #define T_RAY_GROUP_PROCEDURAL "ray_group_procedural"
@@ -163,6 +168,8 @@ void scene_init_parser()
     ADD_PARSER(vs, T_VS);
     ADD_PARSER(script, T_SCRIPT);
     ADD_PARSER(entry, T_ENTRY);
+    ADD_PARSER(every, T_EVERY);
+    ADD_PARSER(on_change, T_ON_CHANGE);
     ADD_PARSER(geometry, T_GEOMETRY);
     ADD_PARSER(post_2d, T_POST_2D);
 
@@ -179,6 +186,9 @@ void scene_init_parser()
 
     ADD_PARSER(path_id, T_PATH);
     ADD_PARSER(build_as, T_BUILD_AS);
+    ADD_PARSER(optimize, T_OPTIMIZE);
+    ADD_PARSER(quantize, T_QUANTIZE);
+    ADD_PARSER(lod, T_LOD);
     ADD_PARSER(path_name, T_PATH_NAME);
     ADD_PARSER(scale, T_SCALE);
     ADD_PARSER(size, T_SIZE);
@@ -208,6 +218,9 @@ bool             : "true" | "false" ;
 vector           : ('(' <float> (','? <float>)? (','? <float>)? (','? <float>)? ')') | <float> ;
 ident_array      : ('(' <ident> (','? <ident>)? (','? <ident>)? (','? <ident>)? (','? <ident>)? ')') | <ident> ;
 build_as         : "build_as" ":" <bool> ;
+optimize         : "optimize" ":" <bool> ;
+quantize         : "quantize" ":" <bool> ;
+lod              : "lod" ":" <bool> ;
 scale            : "scale" ':' <vector> ;
 size             : "size" ':' <vector> ;
 clear            : "clear" ':' <vector> ;
@@ -224,6 +237,8 @@ gs               : "gs" ':' <path_name> ;
 fs               : "fs" ':' <path_name> ;
 script           : "script" ':' <path_name> (',' <ident>)?;
 entry            : "entry" ':' <path_name> ;
+every            : "every" ':' <float> ;
+on_change        : "on_change" ;
 ray_gen          : "ray_gen" ':' <path_name> ;
 miss             : "miss" ':' <path_name> ;
 callable         : "callable" ':' <path_name> ;
@@ -236,13 +251,13 @@ camera           : "camera" ':' <ident> '{' (<comment> | <position> | <look_at>
 ray_group_general : "ray_group_general" ':' <ident> '{' (<ray_gen> | <miss> | <callable>) '}';
 ray_group_triangles : "ray_group_triangles" ':' <ident> '{' (<closest_hit> | <any_hit>)* '}';
 ray_group_procedural : "ray_group_procedural" ':' <ident> '{' <intersection> (<closest_hit> | <any_hit>)* '}';
-geometry         : "geometry" ':' <ident> '{' (<path> | <scale> | <build_as> | <ray_group_general> | <ray_group_triangles> | <ray_group_procedural> | <vs> | <fs> | <gs> | <comment>)* '}';
+geometry         : "geometry" ':' <ident> '{' (<path> | <scale> | <build_as> | <optimize> | <quantize> | <lod> | <ray_group_general> | <ray_group_triangles> | <ray_group_procedural> | <vs> | <fs> | <gs> | <comment>)* '}';
 disable          : '!' ;
-pass             : <disable>? "pass" ':' <ident> '{' (<script> | <entry> | <geometry> | <targets> | <samplers> | <camera_id> | <comment> | <clear>)* '}'; 
+pass             : <disable>? "pass" ':' <ident> '{' (<script> | <entry> | <geometry> | <targets> | <samplers> | <camera_id> | <comment> | <clear> | <every> | <on_change>)* '}'; 
 scenegraph       : /^/ (<comment> | <surface> | <camera>)* (<comment> | <pass> )* <post_2d>? /$/ ;
     )",
-        path_name, path_id, comment, ident, bool_id, flt, vector, ident_array, build_as, scale, size, clear, format,
-        samplers, targets, vs, gs, fs, script, entry, surface, camera, camera_id, position, look_at, field_of_view, near_far, post_2d, geometry, disable, pass, ray_group_general, ray_group_triangles, ray_group_procedural, ray_gen, miss, any_hit, closest_hit, intersection, callable, parser.pSceneGraph, nullptr);
+        path_name, path_id, comment, ident, bool_id, flt, vector, ident_array, build_as, optimize, quantize, lod, scale, size, clear, format,
+        samplers, targets, vs, gs, fs, script, entry, every, on_change, surface, camera, camera_id, position, look_at, field_of_view, near_far, post_2d, geometry, disable, pass, ray_group_general, ray_group_triangles, ray_group_procedural, ray_gen, miss, any_hit, closest_hit, intersection, callable, parser.pSceneGraph, nullptr);
 }
 
 void scene_destroy_parser()
@@ -398,6 +413,55 @@ void validate_samplers(Scene& scene)
     }
 }
 
+// Optional per project settings
+void scene_read_settings(Scene& scene)
+{
+    auto projectFile = fs::path(scene.root / "project.toml");
+    if (!fs::exists(projectFile))
+    {
+        return;
+    }
+
+    try
+    {
+        toml::table tbl = toml::parse_file(projectFile.string());
+
+        auto& dynamic = scene.dynamicResolution;
+        dynamic.enabled = tbl["settings"]["dynamic_resolution"].value_or(false);
+        dynamic.targetFps = std::max(tbl["settings"]["target_fps"].value_or(60.0f), 1.0f);
+        dynamic.minScale = std::clamp(tbl["settings"]["min_render_scale"].value_or(0.5f), 0.1f, 1.0f);
+        dynamic.maxScale = std::clamp(tbl["settings"]["max_render_scale"].value_or(1.0f), dynamic.minScale, 1.0f);
+        dynamic.scale = dynamic.maxScale;
+
+        scene.modelCacheMB = tbl["settings"]["model_cache_mb"].value_or(scene.modelCacheMB);
+
+        auto& record = scene.recordSettings;
+        record.encodeThreads = std::min(tbl["settings"]["record_threads"].value_or(0u), 64u);
+        record.maxPendingFrames = std::max(tbl["settings"]["record_queue"].value_or(8u), 1u);
+        record.video = tbl["settings"]["record_format"].value_or(std::string("png")) == "video";
+        record.encoder = tbl["settings"]["record_encoder"].value_or(record.encoder);
+        record.codec = tbl["settings"]["record_codec"].value_or(record.codec);
+        record.crf = tbl["settings"]["record_crf"].value_or(record.crf);
+        record.pixelFormat = tbl["settings"]["record_pixel_format"].value_or(record.pixelFormat);
+        record.container = tbl["settings"]["record_container"].value_or(record.container);
+        record.fps = std::max(tbl["settings"]["record_fps"].value_or(record.fps), 1u);
+        if (auto pTargets = tbl["settings"]["record_targets"].as_array())
+        {
+            for (auto& target : *pTargets)
+            {
+                if (auto name = target.value<std::string>())
+                {
+                    record.exportTargets.push_back(*name);
+                }
+            }
+        }
+    }
+    catch (std::exception& ex)
+    {
+        LOG(DBG, "No valid project settings: " << ex.what());
+    }
+}
+
 std::shared_ptr<Scene> scene_build(const fs::path& root)
 {
     LOG(DBG, "scene_build: " << root.string());
@@ -407,6 +471,7 @@ std::shared_ptr<Scene> scene_build(const fs::path& root)
     auto files = Zest::file_gather_files(root);
 
     spScene->sceneGraphPath = scene_get_scenegraph(root, files);
+    scene_read_settings(*spScene);
     spScene->headers = scene_get_headers(files);
     spScene->valid = true;
 
@@ -704,11 +769,28 @@ std::shared_ptr<Scene> scene_build(const fs::path& root)
                         spGeom = std::make_shared<Geometry>(foundPath);
                     }
 
+                    spGeom->line = pGeometryNode->state.row;
+
                     if (hasChild(pGeometryNode, T_BUILD_AS))
                     {
                         spGeom->buildAS = getBool(getChild(pGeometryNode, T_BUILD_AS));
                     }
 
+                    if (hasChild(pGeometryNode, T_OPTIMIZE))
+                    {
+                        spGeom->optimize = getBool(getChild(pGeometryNode, T_OPTIMIZE));
+                    }
+
+                    if (hasChild(pGeometryNode, T_QUANTIZE))
+                    {
+                        spGeom->quantize = getBool(getChild(pGeometryNode, T_QUANTIZE));
+                    }
+
+                    if (hasChild(pGeometryNode, T_LOD))
+                    {
+                        spGeom->lod = getBool(getChild(pGeometryNode, T_LOD));
+                    }
+
                     auto addShader = [&](auto pEntry) -> std::shared_ptr<Shader> {
                         auto pPathNode = getChild(pEntry, T_PATH);
                         auto shaderPath = root / pPathNode->contents;
@@ -770,6 +852,13 @@ std::shared_ptr<Scene> scene_build(const fs::path& root)
                         getVector(pScaleNode, spGeom->loadScale, 1, 3);
                     }
 
+                    // The pass has one pipeline, so one vertex layout
+                    if (!spPass->models.empty() && spScene->models[spPass->models[0]]->quantize != spGeom->quantize)
+                    {
+                        AddMessage(*spScene, fmt::format("Geometries in a pass must all be quantized, or all not: {}", pGeomNameNode->contents), MessageSeverity::Error, pGeomNameNode->state.row);
+                        continue;
+                    }
+
                     spScene->models[spGeom->path] = spGeom;
                     spPass->models.push_back(spGeom->path);
                 }
@@ -866,6 +955,25 @@ std::shared_ptr<Scene> scene_build(const fs::path& root)
                     spPass->hasClear = true;
                 }
 
+                // Update frequency; an on_change pass without a period only redraws when its inputs do
+                if (hasChild(pPassNode, T_ON_CHANGE))
+                {
+                    spPass->updateOnChange = true;
+                    spPass->updateEvery = 0;
+                }
+
+                if (hasChild(pPassNode, T_EVERY))
+                {
+                    auto pEveryNode = getChild(pPassNode, T_EVERY);
+                    float every = 1.0f;
+                    getScalar(pEveryNode, every);
+                    if (every < 1.0f)
+                    {
+                        AddMessage(*spScene, fmt::format("Pass {} must update at least every frame", spPass->name), MessageSeverity::Error, pEveryNode->state.row, pEveryNode->state.col);
+                    }
+                    spPass->updateEvery = uint32_t(std::max(every, 1.0f));
+                }
+
                 // Complete the pass
                 if (spPass->models.empty() && spPass->script.empty())
                 {
@@ -1053,6 +1161,46 @@ void scene_copy_state(Scene& destScene, Scene& sourceScene)
             }
         }
     }
+
+    // Keep the render scale the controller settled on, so a shader edit doesn't restart it at full size
+    auto& destDynamic = destScene.dynamicResolution;
+    auto& sourceDynamic = sourceScene.dynamicResolution;
+    if (destDynamic.enabled && sourceDynamic.enabled)
+    {
+        destDynamic.scale = std::clamp(sourceDynamic.scale, destDynamic.minScale, destDynamic.maxScale);
+        destDynamic.gpuMilliseconds = sourceDynamic.gpuMilliseconds;
+        destDynamic.lastChangeTime = sourceDynamic.lastChangeTime;
+    }
+}
+
+// Called each frame with the size of the output window.
+// While the size is changing, targets are over-allocated and rendered into a sub-rect.  Once it has been
+// stable for a while, we flag the resize (and restart the frame count) so targets are reallocated to fit.
+void scene_update_output_size(Scene& scene, const glm::vec2& outputSize)
+{
+    const auto ResizeDebounce = std::chrono::milliseconds(250);
+
+    auto now = std::chrono::steady_clock::now();
+    if (outputSize != scene.lastOutputSize)
+    {
+        scene.lastOutputSize = outputSize;
+        scene.outputSizeChangeTime = now;
+
+        // Nothing to debounce the first time
+        scene.outputResizing = scene.settledOutputSize != glm::vec2(0.0f);
+    }
+
+    if (scene.outputResizing && (now - scene.outputSizeChangeTime) >= ResizeDebounce)
+    {
+        scene.outputResizing = false;
+    }
+
+    if (!scene.outputResizing && scene.settledOutputSize != outputSize)
+    {
+        scene.settledOutputSize = outputSize;
+        scene.sceneFlags |= SceneFlags::DefaultTargetResize;
+        Scene::GlobalFrameCount = 0;
+    }
 }
 
 bool scene_is_raytracer(const fs::path& f)
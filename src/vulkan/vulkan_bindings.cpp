@@ -53,7 +53,19 @@ bool bindings_merge(VulkanPass& vulkanPass, const std::vector<BindingSets*>& mer
             for (auto& [index, value] : copy.bindingMeta)
             {
                 // Do we care if meta doesn't match? Should be taken care of above by binding type
-                bindingSets[set].bindingMeta[index] = value;
+                // Stages may read different parts of the same uniform block
+                auto itrMeta = bindingSets[set].bindingMeta.find(index);
+                if (itrMeta != bindingSets[set].bindingMeta.end())
+                {
+                    auto usedRanges = itrMeta->second.usedRanges;
+                    usedRanges.insert(usedRanges.end(), value.usedRanges.begin(), value.usedRanges.end());
+                    itrMeta->second = value;
+                    itrMeta->second.usedRanges = usedRanges;
+                }
+                else
+                {
+                    bindingSets[set].bindingMeta[index] = value;
+                }
             }
 
             if (bindingSets[set].bindingMeta.size() != bindingSets[set].bindings.size())
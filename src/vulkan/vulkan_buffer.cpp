@@ -3,6 +3,7 @@
 #include "vklive/vulkan/vulkan_buffer.h"
 #include "vklive/vulkan/vulkan_command.h"
 #include "vklive/vulkan/vulkan_debug.h"
+#include "vklive/vulkan/vulkan_transfer.h"
 #include "vklive/vulkan/vulkan_utils.h"
 
 namespace vulkan
@@ -63,14 +64,11 @@ void buffer_create_or_resize(VulkanContext& ctx, vk::Buffer& buffer, vk::DeviceM
 
 VulkanBuffer buffer_stage_to_device(VulkanContext& ctx, const vk::BufferUsageFlags& usage, size_t size, const void* data)
 {
-    LOG(DBG, "Buffer Stage: ");
-    VulkanBuffer staging = buffer_create_staging(ctx, size, data);
+    LOG(DBG, "Buffer Stage: " << size);
+
+    // The copy is batched on the transfer queue; graphics submits wait for it
     VulkanBuffer result = buffer_create_on_device(ctx, usage | vk::BufferUsageFlagBits::eTransferDst, size);
-    utils_with_command_buffer(ctx, [&](vk::CommandBuffer copyCmd) {
-        debug_set_commandbuffer_name(ctx.device, copyCmd, "Buffer::StageToDevice");
-        copyCmd.copyBuffer(staging.buffer, result.buffer, vk::BufferCopy(0, 0, size));
-    });
-    vulkan_buffer_destroy(ctx, staging);
+    transfer_upload_buffer(ctx, result.buffer, size, data);
     return result;
 }
 
@@ -84,6 +82,10 @@ VulkanBuffer buffer_create(VulkanContext& ctx, const vk::BufferUsageFlags& usage
     vk::BufferCreateInfo bufferCreateInfo;
     bufferCreateInfo.usage = usageFlags;
     bufferCreateInfo.size = size;
+    if (usageFlags & vk::BufferUsageFlagBits::eTransferDst)
+    {
+        transfer_set_sharing(ctx, bufferCreateInfo);
+    }
 
     result.descriptor.buffer = result.buffer = ctx.device.createBuffer(bufferCreateInfo);
 
@@ -13,7 +13,10 @@ void command_submit_wait(VulkanContext& ctx, vk::Queue const& queue, vk::Command
     LOG(DBG, "Submit Wait");
     vk::Fence fence = ctx.device.createFence(vk::FenceCreateInfo());
     debug_set_fence_name(ctx.device, fence, "CommandSubmitWait::Fence");
-    queue.submit(vk::SubmitInfo(0, nullptr, nullptr, 1, &commandBuffer), fence);
+    {
+        std::lock_guard<std::mutex> queueLock(ctx.queueMutex);
+        queue.submit(vk::SubmitInfo(0, nullptr, nullptr, 1, &commandBuffer), fence);
+    }
     while (vk::Result::eTimeout == ctx.device.waitForFences(fence, VK_TRUE, FenceTimeout))
         ;
     ctx.device.destroyFence(fence);
@@ -26,6 +29,7 @@ void utils_flush_command_buffer(VulkanContext& ctx, vk::CommandBuffer& commandBu
         return;
     }
     LOG(DBG, "Flush Command Buffer");
+    std::lock_guard<std::mutex> queueLock(ctx.queueMutex);
     context_get_queue(ctx).submit(vk::SubmitInfo{ 0, nullptr, nullptr, 1, &commandBuffer }, vk::Fence());
     context_get_queue(ctx).waitIdle();
     ctx.device.waitIdle();
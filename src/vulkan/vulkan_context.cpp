@@ -4,6 +4,10 @@
 
 #include "imgui_impl_sdl2.h"
 #include "vklive/vulkan/vulkan_context.h"
+#include "vklive/vulkan/vulkan_model.h"
+#include "vklive/vulkan/vulkan_readback.h"
+#include "vklive/vulkan/vulkan_surface.h"
+#include "vklive/vulkan/vulkan_transfer.h"
 #include "vklive/vulkan/vulkan_utils.h"
 
 #include "SDL2/SDL_vulkan.h"
@@ -27,11 +31,15 @@ bool context_init(VulkanContext& ctx)
     ctx.layerNames.clear();
     ctx.instanceExtensionNames.clear();
 
-    // Setup Vulkan
-    uint32_t extensions_count = 0;
-    SDL_Vulkan_GetInstanceExtensions(ctx.window, &extensions_count, NULL);
-    ctx.requestedInstanceExtensions.resize(extensions_count);
-    SDL_Vulkan_GetInstanceExtensions(ctx.window, &extensions_count, ctx.requestedInstanceExtensions.data());
+    // Setup Vulkan; a headless context has no surface, so needs none of the window extensions
+    ctx.requestedInstanceExtensions.clear();
+    if (ctx.window)
+    {
+        uint32_t extensions_count = 0;
+        SDL_Vulkan_GetInstanceExtensions(ctx.window, &extensions_count, NULL);
+        ctx.requestedInstanceExtensions.resize(extensions_count);
+        SDL_Vulkan_GetInstanceExtensions(ctx.window, &extensions_count, ctx.requestedInstanceExtensions.data());
+    }
 
     static std::string AppName = "Demo";
     static std::string EngineName = "VkLive";
@@ -69,7 +77,18 @@ bool context_init(VulkanContext& ctx)
 #endif
 
 #ifdef IMGUI_VULKAN_DEBUG_REPORT
-    ctx.layerNames.push_back("VK_LAYER_KHRONOS_validation");
+    // Render boxes and CI may not have the SDK installed, so only ask for validation if it is there
+    auto itrValidation = std::find_if(ctx.supportedInstancelayerProperties.begin(), ctx.supportedInstancelayerProperties.end(), [&](auto& val) {
+        return (strcmp(val.layerName, "VK_LAYER_KHRONOS_validation") == 0);
+    });
+    if (itrValidation != ctx.supportedInstancelayerProperties.end())
+    {
+        ctx.layerNames.push_back("VK_LAYER_KHRONOS_validation");
+    }
+    else
+    {
+        LOG(DBG, "Validation layer not available");
+    }
     ctx.requestedInstanceExtensions.push_back("VK_EXT_debug_utils");
 #endif
 
@@ -108,6 +127,23 @@ bool context_init(VulkanContext& ctx)
         }
     }
 
+    // Offline workers are spread across the GPUs; only those of the chosen device's type, so workers don't land
+    // on a software rasterizer or an integrated GPU beside the discrete ones
+    if (ctx.physicalDeviceIndex >= 0)
+    {
+        auto deviceType = ctx.physicalDevice.getProperties().deviceType;
+        std::vector<vk::PhysicalDevice> devices;
+        for (auto& device : ctx.instance.enumeratePhysicalDevices())
+        {
+            if (device.getProperties().deviceType == deviceType)
+            {
+                devices.push_back(device);
+            }
+        }
+        ctx.physicalDevice = devices[ctx.physicalDeviceIndex % devices.size()];
+    }
+    LOG(INFO, "Device: " << ctx.physicalDevice.getProperties().deviceName);
+
     ctx.supportedDeviceExtensions = ctx.physicalDevice.enumerateDeviceExtensionProperties();
     LOG(DBG, "Device Extensions:");
     for (auto const& ep : ctx.supportedDeviceExtensions)
@@ -136,9 +172,29 @@ bool context_init(VulkanContext& ctx)
     ctx.physicalDevice.getMemoryProperties(&ctx.memoryProperties);
     ctx.graphicsQueue = utils_find_queue(ctx, vk::QueueFlagBits::eGraphics);
 
+    // Uploads go on a dedicated transfer family if there is one, so they can overlap rendering.
+    // Otherwise try for a second queue on the graphics family.
+    ctx.transferQueue = utils_find_queue(ctx, vk::QueueFlagBits::eTransfer);
+    if (ctx.transferQueue == VK_QUEUE_FAMILY_IGNORED)
+    {
+        ctx.transferQueue = ctx.graphicsQueue;
+    }
+
     // create a Device
-    float queuePriority = 0.0f;
-    vk::DeviceQueueCreateInfo deviceQueueCreateInfo(vk::DeviceQueueCreateFlags(), static_cast<uint32_t>(ctx.graphicsQueue), 1, &queuePriority);
+    std::vector<float> queuePriorities = { 0.0f, 0.0f };
+    std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
+    if (ctx.transferQueue == ctx.graphicsQueue)
+    {
+        auto queueFamilyProperties = ctx.physicalDevice.getQueueFamilyProperties();
+        ctx.transferQueueIndex = queueFamilyProperties[ctx.graphicsQueue].queueCount > 1 ? 1 : 0;
+        queueCreateInfos.push_back(vk::DeviceQueueCreateInfo(vk::DeviceQueueCreateFlags(), ctx.graphicsQueue, ctx.transferQueueIndex + 1, queuePriorities.data()));
+    }
+    else
+    {
+        ctx.transferQueueIndex = 0;
+        queueCreateInfos.push_back(vk::DeviceQueueCreateInfo(vk::DeviceQueueCreateFlags(), ctx.graphicsQueue, 1, queuePriorities.data()));
+        queueCreateInfos.push_back(vk::DeviceQueueCreateInfo(vk::DeviceQueueCreateFlags(), ctx.transferQueue, 1, queuePriorities.data()));
+    }
 
     // Determine support for Buffer Device Address, the Vulkan 1.2 way
     vk::PhysicalDeviceFeatures2 physicalDeviceFeatures2;
@@ -151,6 +207,11 @@ bool context_init(VulkanContext& ctx)
     vk::PhysicalDeviceDynamicRenderingFeatures dynamicRender;
     dynamicRender.setDynamicRendering(true);
 
+    // Transfer queue completion is tracked with a timeline semaphore
+    vk::PhysicalDeviceTimelineSemaphoreFeatures timelineSemaphore;
+    timelineSemaphore.setTimelineSemaphore(true);
+
+    dynamicRender.pNext = &timelineSemaphore;
     rayTracingAccel.pNext = &dynamicRender;
     rayTracing.pNext = &rayTracingAccel;
     bufferDeviceAddressFeatures.pNext = &rayTracing;
@@ -183,7 +244,7 @@ bool context_init(VulkanContext& ctx)
     }
 
     // std::cerr << "Creating Device...";
-    ctx.device = utils_create_device(ctx.physicalDevice, ctx.graphicsQueue, ctx.deviceExtensionNames, nullptr, &physicalDeviceFeatures2);
+    ctx.device = utils_create_device(ctx.physicalDevice, queueCreateInfos, ctx.deviceExtensionNames, nullptr, &physicalDeviceFeatures2);
 
     debug_set_device_name(ctx.device, ctx.device, "Context::Device");
     debug_set_physicaldevice_name(ctx.device, ctx.physicalDevice, "Context::PhysicalDevice");
@@ -213,13 +274,21 @@ bool context_init(VulkanContext& ctx)
         debug_set_descriptorpool_name(ctx.device, ctx.descriptorPool, "Context::DescriptorPool(ImGui)");
     }
 
-    // Get ray tracing pipeline properties, which will be used later on
+    // Get ray tracing pipeline and acceleration structure properties, which will be used later on
+    ctx.accelerationStructureProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
     ctx.rayTracingPipelineProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR;
+    ctx.rayTracingPipelineProperties.pNext = &ctx.accelerationStructureProperties;
     VkPhysicalDeviceProperties2 deviceProperties2{};
     deviceProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
     deviceProperties2.pNext = &ctx.rayTracingPipelineProperties;
     vkGetPhysicalDeviceProperties2(ctx.physicalDevice, &deviceProperties2);
 
+    // GPU timing of the passes
+    if (ctx.physicalDevice.getQueueFamilyProperties()[ctx.graphicsQueue].timestampValidBits != 0)
+    {
+        ctx.timestampPeriod = deviceProperties2.properties.limits.timestampPeriod;
+    }
+
     // Get acceleration structure properties, which will be used later on
     ctx.accelerationStructureFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
     VkPhysicalDeviceFeatures2 deviceFeatures2{};
@@ -239,11 +308,19 @@ bool context_init(VulkanContext& ctx)
     ctx.vkGetRayTracingShaderGroupHandlesKHR = reinterpret_cast<PFN_vkGetRayTracingShaderGroupHandlesKHR>(vkGetDeviceProcAddr(ctx.device, "vkGetRayTracingShaderGroupHandlesKHR"));
     ctx.vkCreateRayTracingPipelinesKHR = reinterpret_cast<PFN_vkCreateRayTracingPipelinesKHR>(vkGetDeviceProcAddr(ctx.device, "vkCreateRayTracingPipelinesKHR"));
 
+    transfer_init(ctx);
+    readback_init(ctx);
+
     return true;
 }
 
 void context_destroy(VulkanContext& ctx)
 {
+    vulkan_surface_pool_destroy(ctx);
+    vulkan_model_cache_destroy(ctx);
+    readback_destroy(ctx);
+    transfer_destroy(ctx);
+
     ctx.device.destroyDescriptorPool(ctx.descriptorPool);
     ctx.descriptorPool = nullptr;
 
@@ -15,15 +15,32 @@
 namespace vulkan
 {
 
-std::shared_ptr<IDevice> create_vulkan_device(SDL_Window* pWindow, const std::string& iniPath, bool viewports)
+// Frames a headless device keeps in flight, in place of swap chain images
+const uint32_t HeadlessFrameCount = 2;
+
+std::shared_ptr<IDevice> create_vulkan_device(SDL_Window* pWindow, const std::string& iniPath, bool viewports, int32_t deviceIndex)
 {
-    return std::static_pointer_cast<IDevice>(std::make_shared<VulkanDevice>(pWindow, iniPath, viewports));
+    return std::static_pointer_cast<IDevice>(std::make_shared<VulkanDevice>(pWindow, iniPath, viewports, deviceIndex));
 }
 
-VulkanDevice::VulkanDevice(SDL_Window* pWindow, const std::string& iniPath, bool viewports)
+VulkanDevice::VulkanDevice(SDL_Window* pWindow, const std::string& iniPath, bool viewports, int32_t deviceIndex)
     : IDevice()
 {
     ctx.window = pWindow;
+    ctx.physicalDeviceIndex = deviceIndex;
+
+    // No window: render offline, without the swap chain or UI
+    if (!pWindow)
+    {
+        ctx.headless = true;
+
+        vulkan::context_init(ctx);
+        context_get_queue(ctx);
+        ctx.mainWindowData.imageCount = HeadlessFrameCount;
+        vulkan::render_init(ctx);
+        vulkan::vulkan_nanovg_init(ctx);
+        return;
+    }
 
     float ddpi;
     auto dpi = SDL_GetDisplayDPI(SDL_GetWindowDisplayIndex(pWindow), &ddpi, &ctx.hdpi, &ctx.vdpi);
@@ -62,6 +79,13 @@ VulkanDevice::~VulkanDevice()
 
     ctx.descriptorCache.clear();
 
+    if (ctx.headless)
+    {
+        vulkan::render_destroy(ctx);
+        vulkan::context_destroy(ctx);
+        return;
+    }
+
     vulkan::imgui_shutdown(ctx);
     vulkan::window_destroy(ctx, &ctx.mainWindowData);
     vulkan::render_destroy(ctx);
@@ -95,6 +119,10 @@ void VulkanDevice::ImGui_Render(ImDrawData* pDrawData)
 
 void VulkanDevice::ValidateSwapChain()
 {
+    if (ctx.headless)
+    {
+        return;
+    }
     vulkan::main_window_validate_swapchain(ctx);
 }
 
@@ -108,14 +136,28 @@ void VulkanDevice::WriteToFile(Scene& scene, const fs::path& path)
 {
     if ((scene.GlobalFrameCount < scene.maxRecordFrame) && scene.recording)
     {
-        vulkan::render_write_output(ctx, scene, path);
+        if (ctx.headless)
+        {
+            vulkan::render_write_target(ctx, scene, path);
+        }
+        else
+        {
+            vulkan::render_write_output(ctx, scene, path);
+        }
     }
     else
     {
+        // Write out any frames still in flight; nothing to do if there are none
+        vulkan::render_flush_output(ctx, scene, path);
         scene.recording = false;
     }
 }
 
+bool VulkanDevice::Render_Tiled(Scene& scene, const glm::uvec2& outputSize, const glm::uvec2& tileSize, const fs::path& fileName)
+{
+    return vulkan::render_tiled(ctx, scene, outputSize, tileSize, fileName);
+}
+
 void VulkanDevice::WaitIdle()
 {
     if (ctx.device)
@@ -126,6 +168,12 @@ void VulkanDevice::WaitIdle()
 
 void VulkanDevice::Present()
 {
+    // Nothing to show; just move on to the next frame's pass data
+    if (ctx.headless)
+    {
+        ctx.mainWindowData.frameIndex = (ctx.mainWindowData.frameIndex + 1) % ctx.mainWindowData.imageCount;
+        return;
+    }
     vulkan::main_window_present(ctx);
 }
 
@@ -11,6 +11,7 @@
 #include "vklive/vulkan/vulkan_imgui.h"
 #include "vklive/vulkan/vulkan_render.h"
 #include "vklive/vulkan/vulkan_scene.h"
+#include "vklive/vulkan/vulkan_transfer.h"
 #include "vklive/vulkan/vulkan_utils.h"
 
 #include "imgui_impl_sdl2.h"
@@ -703,7 +704,7 @@ void imgui_render(VulkanContext& ctx, VulkanWindow* wd, ImDrawData* draw_data)
             fd->commandBuffer.end();
 
             LOG(DBG, "Submit ImGui");
-            context_get_queue(ctx).submit(info, fd->fence);
+            transfer_graphics_submit(ctx, info, fd->fence);
         }
     }
     catch (std::exception& ex)
@@ -754,12 +755,7 @@ void imgui_render_3d(VulkanContext& ctx, Scene& scene, bool background)
     bool drawn = false;
     if (scene.valid)
     {
-        if (outputSize != scene.lastOutputSize)
-        {
-            scene.lastOutputSize = outputSize;
-            scene.sceneFlags |= SceneFlags::DefaultTargetResize;
-            Scene::GlobalFrameCount = 0;
-        }
+        scene_update_output_size(scene, outputSize);
 
         vulkan::render(ctx, glm::vec4(canvas_pos.x, canvas_pos.y, outputSize.x, outputSize.y), scene);
 
@@ -782,9 +778,13 @@ void imgui_render_3d(VulkanContext& ctx, Scene& scene, bool background)
                         {
                             LOG(DBG, "Showing RT with DescriptorSet: " << pSurf->ImGuiDescriptorSet);
                             LOG(DBG, "Surface: " << pVulkanScene->defaultTarget);
+                            // The target may be over-allocated while resizing
+                            auto uvMax = glm::vec2(pSurf->pSurface->currentSize) / glm::vec2(std::max(pSurf->extent.width, 1u), std::max(pSurf->extent.height, 1u));
                             pDrawList->AddImage((ImTextureID)pSurf->ImGuiDescriptorSet,
                                 ImVec2(canvas_pos.x, canvas_pos.y),
-                                ImVec2(canvas_pos.x + outputSize.x, canvas_pos.y + outputSize.y));
+                                ImVec2(canvas_pos.x + outputSize.x, canvas_pos.y + outputSize.y),
+                                ImVec2(0.0f, 0.0f),
+                                ImVec2(uvMax.x, uvMax.y));
                         }
                         // pSurf->ImGuiDescriptorSet = nullptr;
                         drawn = true;
@@ -127,7 +127,10 @@ int VulkanImGuiTexture::UpdateTexture(int image, int x, int y, int updateWidth,
     end_info.pCommandBuffers = &textureInfo.commandBuffer;
     assert(err == VK_SUCCESS);
 
-    err = vkQueueSubmit(m_queue, 1, &end_info, VK_NULL_HANDLE);
+    {
+        std::lock_guard<std::mutex> queueLock(m_ctx.queueMutex);
+        err = vkQueueSubmit(m_queue, 1, &end_info, VK_NULL_HANDLE);
+    }
     assert(err == VK_SUCCESS);
 
     return image;
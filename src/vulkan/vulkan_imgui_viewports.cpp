@@ -162,6 +162,7 @@ void imgui_viewport_render(ImGuiViewport* viewport, void*)
 
     LOG(DBG, "Submit ImGui Viewport");
     vk::PipelineStageFlags wait_stage = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+    std::lock_guard<std::mutex> queueLock(ctx.queueMutex);
     context_get_queue(ctx).submit(vk::SubmitInfo(fsd->imageAcquiredSemaphore, wait_stage, fd->commandBuffer, fsd->renderCompleteSemaphore), fd->fence);
 }
 
@@ -174,7 +175,11 @@ void imgui_viewport_swap_buffers(ImGuiViewport* viewport, void*)
     uint32_t present_index = wd->frameIndex;
 
     VulkanFrameSemaphores* fsd = &wd->frameSemaphores[wd->semaphoreIndex];
-    auto result = context_get_queue(ctx).presentKHR(vk::PresentInfoKHR(fsd->renderCompleteSemaphore, wd->swapchain, present_index));
+    vk::Result result;
+    {
+        std::lock_guard<std::mutex> queueLock(ctx.queueMutex);
+        result = context_get_queue(ctx).presentKHR(vk::PresentInfoKHR(fsd->renderCompleteSemaphore, wd->swapchain, present_index));
+    }
 
     if (result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR)
     {
@@ -1,6 +1,8 @@
 #include <fmt/format.h>
 
 #include <zest/file/runtree.h>
+#include <zest/logger/logger.h>
+#include <zest/thread/threadpool.h>
 
 #include "vklive/vulkan/vulkan_buffer.h"
 #include "vklive/vulkan/vulkan_model.h"
@@ -9,30 +11,195 @@
 namespace vulkan
 {
 
-std::shared_ptr<VulkanModel> vulkan_model_load(VulkanContext& ctx, const ModelCreateInfo& createInfo)
+namespace
 {
-    // Call the model class
-    auto itr = VulkanModel::ModelCache.find(createInfo);
-    if (itr != VulkanModel::ModelCache.end())
+
+// Imports are mostly parsing, and pack across the cores themselves, so a couple of threads keep up
+const uint32_t ModelLoaderThreads = 2;
+
+TPool& model_loader_pool()
+{
+    static TPool pool(ModelLoaderThreads);
+    return pool;
+}
+
+VulkanModelCache& model_cache(VulkanContext& ctx)
+{
+    if (!ctx.spModelCache)
+    {
+        ctx.spModelCache = std::make_shared<VulkanModelCache>();
+    }
+    return *ctx.spModelCache;
+}
+
+uint64_t model_cpu_bytes(const VulkanModel& model)
+{
+    if (model.dataReleased)
+    {
+        return 0;
+    }
+    return model_vertex_bytes(model) + uint64_t(model.indexCount) * sizeof(uint32_t);
+}
+
+uint64_t model_gpu_bytes(const VulkanModel& model)
+{
+    uint64_t bytes = model.vertices.allocSize + model.indices.allocSize + model.topLevelAS.buffer.allocSize + model.asInstances.allocSize + model.asScratch.allocSize;
+    for (auto& as : model.accelerationStructures)
+    {
+        bytes += as.buffer.allocSize;
+    }
+    return bytes;
+}
+
+// Destroys the device objects; the imported data goes with the last reference
+void model_free(VulkanContext& ctx, VulkanModel& model)
+{
+    vulkan_buffer_destroy(ctx, model.vertices);
+    vulkan_buffer_destroy(ctx, model.indices);
+
+    // AS
+    for (auto& as : model.accelerationStructures)
+    {
+        vulkan_buffer_destroy(ctx, as.buffer);
+        if (as.handle)
+        {
+            ctx.device.destroyAccelerationStructureKHR(as.handle);
+        }
+    }
+    model.accelerationStructures.clear();
+
+    vulkan_buffer_destroy(ctx, model.topLevelAS.buffer);
+    if (model.topLevelAS.handle)
+    {
+        ctx.device.destroyAccelerationStructureKHR(model.topLevelAS.handle);
+        model.topLevelAS.handle = nullptr;
+    }
+    vulkan_buffer_destroy(ctx, model.asInstances);
+    vulkan_buffer_destroy(ctx, model.asScratch);
+    model.asInstanceCount = 0;
+    model.initAccel = false;
+}
+
+// Frees unused models, least recently released first, until the cache fits the budget.  Call with the lock held
+void model_cache_trim(VulkanContext& ctx, VulkanModelCache& cache)
+{
+    uint64_t residentBytes = 0;
+    for (auto& [info, spModel] : cache.models)
+    {
+        if (!spModel->loading)
+        {
+            residentBytes += model_cpu_bytes(*spModel) + model_gpu_bytes(*spModel);
+        }
+    }
+
+    while (residentBytes > cache.budgetBytes && !cache.unused.empty())
+    {
+        auto spModel = cache.unused.front();
+        cache.unused.pop_front();
+
+        // Picked up again by a scene since it was released
+        if (spModel->refCount > 0)
+        {
+            continue;
+        }
+
+        LOG(DBG, "Evicting model: " << spModel->createInfo.filename);
+        residentBytes -= std::min(residentBytes, model_cpu_bytes(*spModel) + model_gpu_bytes(*spModel));
+        cache.models.erase(spModel->createInfo);
+        cache.evictions++;
+        model_free(ctx, *spModel);
+    }
+}
+
+} // namespace
+
+std::shared_ptr<VulkanModel> vulkan_model_load(VulkanContext& ctx, const ModelCreateInfo& createInfo, bool async)
+{
+    std::shared_ptr<VulkanModel> spModel;
+    {
+        auto& cache = model_cache(ctx);
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        auto itr = cache.models.find(createInfo);
+        if (itr != cache.models.end())
+        {
+            // Still importing for an earlier scene, or up to date; either way, share it
+            auto spCached = itr->second;
+            std::error_code ec;
+            if (spCached->loading || (spCached->loaded && fs::last_write_time(createInfo.filename, ec) == spCached->lastWrite))
+            {
+                cache.unused.remove(spCached);
+                cache.hits++;
+                return spCached;
+            }
+
+            // Out of date; nothing draws it if it was waiting in the unused list
+            if (spCached->refCount <= 0)
+            {
+                cache.unused.remove(spCached);
+                model_free(ctx, *spCached);
+            }
+        }
+        cache.misses++;
+
+        // A changed model is loaded into a new one, so the one the current scene draws isn't touched
+        spModel = std::make_shared<VulkanModel>();
+        spModel->createInfo = createInfo;
+        spModel->loading = true;
+        cache.models[createInfo] = spModel;
+    }
+
+    auto fnLoad = [spModel, createInfo]() {
+        model_load(*spModel, createInfo);
+        spModel->loading = false;
+    };
+
+    if (async)
+    {
+        LOG(DBG, "Loading model in the background: " << createInfo.filename);
+        model_loader_pool().enqueue(fnLoad);
+    }
+    else
     {
-        model_load(*itr->second, createInfo);
-        return itr->second;
+        fnLoad();
     }
+    return spModel;
+}
 
-    auto pModel = std::make_shared<VulkanModel>();
-    model_load(*pModel, createInfo);
-    VulkanModel::ModelCache[createInfo] = pModel;
-    return pModel;
+bool vulkan_model_reload_data(const std::shared_ptr<VulkanModel>& spModel)
+{
+    if (spModel->loading)
+    {
+        return false;
+    }
+
+    if (!spModel->dataReleased)
+    {
+        return true;
+    }
+
+    // Read back on a loader thread, like the first import; nothing stages, draws or sizes the model until it's done
+    LOG(DBG, "Reloading released model in the background: " << spModel->createInfo.filename);
+    spModel->loading = true;
+    model_loader_pool().enqueue([spModel]() {
+        // Gone from the cache and the disk; reported as a failed load
+        if (!model_reload_data(*spModel))
+        {
+            spModel->vertexCount = 0;
+        }
+        spModel->loading = false;
+    });
+    return false;
 }
 
 void vulkan_model_stage(VulkanContext& ctx, VulkanModel& model)
 {
-    if (!model.vertexData.empty() && !model.indices.buffer)
+    if (!model.loading && !model.dataReleased && !model.indices.buffer && model_vertex_bytes(model) != 0)
     {
         // Vertex buffer
         // Index buffer
-        model.vertices = buffer_stage_to_device(ctx, vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer, model.vertexData);
-        model.indices = buffer_stage_to_device(ctx, vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eStorageBuffer, model.indexData);
+        // From the mesh cache, these are read from the mapped file straight into staging
+        model.vertices = buffer_stage_to_device(ctx, vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer, model_vertex_bytes(model), model_vertex_data(model));
+        model.indices = buffer_stage_to_device(ctx, vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eStorageBuffer, size_t(model.indexCount) * sizeof(uint32_t), model_index_data(model));
 
         debug_set_buffer_name(ctx.device, (VkBuffer)model.vertices.buffer, fmt::format("{}:Vertices", model.debugName));
         debug_set_buffer_name(ctx.device, (VkBuffer)model.indices.buffer, fmt::format("{}:Indices", model.debugName));
@@ -48,6 +215,29 @@ void vulkan_model_stage(VulkanContext& ctx, VulkanModel& model)
     }
 }
 
+void vulkan_model_release_data(VulkanContext& ctx, VulkanModel& model)
+{
+    if (model.dataReleased || !vulkan_model_ready(model) || (model.createInfo.buildAS && !model.initAccel))
+    {
+        return;
+    }
+
+    // Under the cache lock, since the cache's stats read the model's size from the update thread
+    auto& cache = model_cache(ctx);
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    LOG(DBG, "Releasing CPU copy of model: " << model.createInfo.filename << ", " << model_cpu_bytes(model) << " bytes");
+    model_release_data(model);
+}
+
+VulkanModelConstants vulkan_model_constants(const Model& model)
+{
+    VulkanModelConstants constants;
+    constants.positionScale = glm::vec4(model.quantization.positionScale, 1.0f);
+    constants.positionOffset = glm::vec4(model.quantization.positionOffset, 0.0f);
+    constants.uvScaleOffset = glm::vec4(model.quantization.uvScale, model.quantization.uvOffset);
+    return constants;
+}
+
 vk::Format component_format(Component component)
 {
     switch (component)
@@ -64,6 +254,16 @@ vk::Format component_format(Component component)
         return vk::Format::eR32G32B32A32Sint;
     case VERTEX_COMPONENT_DUMMY_UINT4:
         return vk::Format::eR32G32B32A32Uint;
+    case VERTEX_COMPONENT_POSITION_HALF:
+        return vk::Format::eR16G16B16A16Sfloat;
+    case VERTEX_COMPONENT_NORMAL_OCT:
+    case VERTEX_COMPONENT_TANGENT_OCT:
+    case VERTEX_COMPONENT_BITANGENT_OCT:
+        return vk::Format::eR16G16Snorm;
+    case VERTEX_COMPONENT_UV_UNORM16:
+        return vk::Format::eR16G16Unorm;
+    case VERTEX_COMPONENT_COLOR_UNORM8:
+        return vk::Format::eR8G8B8A8Unorm;
     default:
         return vk::Format::eR32G32B32Sfloat;
     }
@@ -71,24 +271,93 @@ vk::Format component_format(Component component)
 
 void vulkan_model_destroy(VulkanContext& ctx, VulkanModel& model)
 {
+    // References are taken on the update thread and released on the render thread; both under the cache lock,
+    // so a model can't be put in the unused list as a new scene picks it up
+    auto& cache = model_cache(ctx);
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
     model.refCount--;
-    if (model.refCount <= 0)
+    if (model.refCount > 0)
     {
-        vulkan_buffer_destroy(ctx, model.vertices);
-        vulkan_buffer_destroy(ctx, model.indices);
+        return;
+    }
 
-        // AS
-        for (auto& as : model.accelerationStructures)
+    // Kept for the next scene (one still loading likely wants it), unless the cache has moved on to a newer load
+    // of the same file, or it failed
+    auto itr = cache.models.find(model.createInfo);
+    if (itr != cache.models.end() && itr->second.get() == &model)
+    {
+        if (model.loading || model.vertexCount != 0)
         {
-            vulkan_buffer_destroy(ctx, as.buffer);
-            if (as.handle)
-            {
-                ctx.device.destroyAccelerationStructureKHR(as.handle);
-            }
+            cache.unused.push_back(itr->second);
+            model_cache_trim(ctx, cache);
+            return;
         }
+        cache.models.erase(itr);
+    }
+    model_free(ctx, model);
+}
 
-        VulkanModel::ModelCache.erase(model.createInfo);
+bool vulkan_model_ready(const VulkanModel& model)
+{
+    return !model.loading && model.indices.buffer;
+}
+
+void vulkan_model_report_error(VulkanScene& vulkanScene, const Geometry& geom, const VulkanModel& model)
+{
+    auto txt = fmt::format("Could not load model: {}", model.createInfo.filename);
+    if (!model.errors.empty())
+    {
+        txt += "\n" + model.errors;
     }
+    scene_report_error(*vulkanScene.pScene, MessageSeverity::Error, txt, fs::path(), geom.line);
+}
+
+void vulkan_model_cache_set_budget(VulkanContext& ctx, uint64_t budgetBytes)
+{
+    auto& cache = model_cache(ctx);
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.budgetBytes = budgetBytes;
+}
+
+VulkanModelCacheStats vulkan_model_cache_stats(VulkanContext& ctx)
+{
+    auto& cache = model_cache(ctx);
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    VulkanModelCacheStats stats;
+    stats.models = cache.models.size();
+    stats.unused = cache.unused.size();
+    stats.hits = cache.hits;
+    stats.misses = cache.misses;
+    stats.evictions = cache.evictions;
+    for (auto& [info, spModel] : cache.models)
+    {
+        if (!spModel->loading)
+        {
+            stats.cpuBytes += model_cpu_bytes(*spModel);
+            stats.gpuBytes += model_gpu_bytes(*spModel);
+        }
+    }
+    return stats;
+}
+
+void vulkan_model_cache_destroy(VulkanContext& ctx)
+{
+    if (!ctx.spModelCache)
+    {
+        return;
+    }
+
+    // Scenes have gone by now; anything still cached is unused, or still loading
+    auto& cache = *ctx.spModelCache;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    for (auto& spModel : cache.unused)
+    {
+        model_free(ctx, *spModel);
+    }
+    cache.unused.clear();
+    cache.models.clear();
 }
 
 std::shared_ptr<VulkanModel> vulkan_model_create(VulkanContext& ctx,
@@ -117,25 +386,32 @@ std::shared_ptr<VulkanModel> vulkan_model_create(VulkanContext& ctx,
     ModelCreateInfo createInfo
     {
         .filename = loadPath.string(),
+        .vertexLayout = geom.quantize ? g_quantizedVertexLayout : g_vertexLayout,
         .scale = geom.loadScale,
-        .buildAS = geom.buildAS
+        .buildAS = geom.buildAS,
+        .optimize = geom.optimize,
+        .lod = geom.lod
     };
-    spVulkanModel = vulkan_model_load(ctx, createInfo);
 
-    // Success?
-    if (spVulkanModel->vertexData.empty())
+    // Imports don't hold up the scene; passes draw without the model until it arrives.  Geometry for ray tracing
+    // is bound straight into the pass, so it's loaded up front, as is everything for a headless render
+    bool async = !ctx.headless && !geom.buildAS;
+    spVulkanModel = vulkan_model_load(ctx, createInfo, async);
+
+    // Success?  Background loads are checked as they finish, in vulkan_scene_render
+    if (!spVulkanModel->loading && spVulkanModel->vertexCount == 0)
     {
-        auto txt = fmt::format("Could not load model: {}", loadPath.string());
-        if (!spVulkanModel->errors.empty())
-        {
-            txt += "\n" + spVulkanModel->errors;
-        }
-        scene_report_error(*vulkanScene.pScene, MessageSeverity::Error, txt);
+        vulkan_model_report_error(vulkanScene, geom, *spVulkanModel);
     }
     else
     {
         // Store at original path, even though we may have subtituted geometry for preset paths
-        spVulkanModel->refCount++;
+        {
+            auto& cache = model_cache(ctx);
+            std::lock_guard<std::mutex> lock(cache.mutex);
+            spVulkanModel->refCount++;
+            cache.unused.remove(spVulkanModel);
+        }
         vulkanScene.models[geom.path] = spVulkanModel;
     }
 
@@ -1,215 +1,403 @@
 #include <fmt/format.h>
 
 #include <zest/file/runtree.h>
+#include <zest/logger/logger.h>
 
 #include "vklive/vulkan/vulkan_command.h"
-#include "vklive/vulkan/vulkan_model.h"
+#include "vklive/vulkan/vulkan_model_as.h"
 #include "vklive/vulkan/vulkan_utils.h"
 
 namespace vulkan
 {
 
-// Ray tracing acceleration structure
-// Create the bottom level acceleration structure contains the scene's actual geometry (vertices, triangles)
-void createBottomLevelAccelerationStructure(VulkanContext& ctx, VulkanModel& model)
+namespace
 {
-    // Setup identity transform matrix
-    VkTransformMatrixKHR transformMatrix = {
-        1.0f, 0.0f, 0.0f, 0.0f,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f
-    };
 
-    // Is this the right way?  Can I pack these more efficiently into a single set of buffers and refer to them?
-    for (const auto& part : model.parts)
+const vk::BuildAccelerationStructureFlagsKHR TopLevelFlags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
+
+// vkCmdUpdateBuffer writes at most this much at a time
+const vk::DeviceSize UpdateBufferMaxBytes = 65536;
+
+// One part's bottom level structure, and the inputs it reads until the batch has been built
+struct BottomLevelBuild
+{
+    VulkanModel* pModel = nullptr;
+    std::string name;
+    uint32_t vertexOffset = 0;
+    VulkanBuffer vertexBuffer;
+    VulkanBuffer indexBuffer;
+    vk::AccelerationStructureGeometryKHR geometry;
+    vk::AccelerationStructureBuildRangeInfoKHR range;
+    vk::AccelerationStructureBuildSizesInfoKHR sizes;
+    vk::DeviceSize scratchOffset = 0;
+    AccelerationStructure as;
+};
+
+vk::DeviceSize as_align(VulkanContext& ctx, vk::DeviceSize offset)
+{
+    vk::DeviceSize alignment = std::max(ctx.accelerationStructureProperties.minAccelerationStructureScratchOffsetAlignment, 1u);
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+AccelerationStructure as_create(VulkanContext& ctx, vk::AccelerationStructureTypeKHR type, vk::DeviceSize size, const std::string& name)
+{
+    AccelerationStructure as;
+    as.buffer = buffer_create(ctx, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+        vk::MemoryPropertyFlagBits::eDeviceLocal, size);
+
+    debug_set_buffer_name(ctx.device, as.buffer.buffer, name + "_Buffer");
+    debug_set_devicememory_name(ctx.device, as.buffer.memory, name + "_Memory");
+
+    vk::AccelerationStructureCreateInfoKHR accelerationStructureCreateInfo(vk::AccelerationStructureCreateFlagsKHR(), as.buffer.buffer, 0, size, type);
+    as.handle = ctx.device.createAccelerationStructureKHR(accelerationStructureCreateInfo);
+    debug_set_accelerationstructure_name(ctx.device, as.handle, name);
+    return as;
+}
+
+void as_destroy(VulkanContext& ctx, AccelerationStructure& as)
+{
+    if (as.handle)
     {
-        std::vector<uint32_t> indices;
-        std::vector<glm::vec3> vertices;
+        ctx.device.destroyAccelerationStructureKHR(as.handle);
+        as.handle = nullptr;
+    }
+    vulkan_buffer_destroy(ctx, as.buffer);
+}
 
-        for (uint32_t i = 0; i < part.indexCount; i++)
+// Builds (or refits) must finish before anything reads the structures they write
+void as_barrier(const vk::CommandBuffer& commandBuffer)
+{
+    vk::MemoryBarrier barrier(vk::AccessFlagBits::eAccelerationStructureWriteKHR, vk::AccessFlagBits::eAccelerationStructureReadKHR);
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR | vk::PipelineStageFlagBits::eRayTracingShaderKHR, vk::DependencyFlags(), barrier, nullptr, nullptr);
+}
+
+// Ray tracing acceleration structure
+// The bottom level acceleration structures contain the actual geometry (vertices, triangles); one per part.
+// Full float positions, whatever the layout stores
+void as_prepare_bottom_level(VulkanContext& ctx, VulkanModel& model, std::vector<BottomLevelBuild>& builds)
+{
+    for (const auto& part : model.parts)
+    {
+        if (part.indexCount == 0)
         {
-            indices.push_back(model.indexData[part.indexBase + i] - part.vertexBase);
+            continue;
         }
 
-        uint32_t vertexStride = layout_size(model.createInfo.vertexLayout);
-
-        for (uint32_t i = 0; i < part.vertexCount; i++)
+        std::vector<uint32_t> indices;
+        auto pIndices = model_index_data(model);
+        for (uint32_t i = 0; i < part.indexCount; i++)
         {
-            vertices.push_back(*(glm::vec3*)&model.vertexData[(part.vertexBase + i) * vertexStride]);
+            indices.push_back(pIndices[part.indexBase + i] - part.vertexBase);
         }
 
-        vertexStride = sizeof(glm::vec3);
+        auto vertexStride = layout_size(model.createInfo.vertexLayout);
+        auto vertices = model_decode_positions(model, model_vertex_data(model) + size_t(part.vertexBase) * vertexStride, part.vertexCount);
 
-        // Create buffers
-        // For the sake of simplicity we won't stage the vertex data to the GPU memory
-        auto vertexBuffer = buffer_create(ctx, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
-            vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible, vertices);
+        BottomLevelBuild build;
+        build.pModel = &model;
+        build.name = part.name;
+        build.vertexOffset = part.vertexBase;
 
-        auto indexBuffer = buffer_create(ctx, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+        // Read by the build, so only needed until the batch is done
+        build.vertexBuffer = buffer_create(ctx, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+            vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible, vertices);
+        build.indexBuffer = buffer_create(ctx, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
             vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible, indices);
 
-        auto transformBuffer = buffer_create(ctx, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
-            vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible, sizeof(VkTransformMatrixKHR), &transformMatrix);
-
-        debug_set_buffer_name(ctx.device, vertexBuffer.buffer, "AS Vertices");
-        debug_set_buffer_name(ctx.device, indexBuffer.buffer, "AS Indices");
-        debug_set_buffer_name(ctx.device, transformBuffer.buffer, "AS Transform");
+        debug_set_buffer_name(ctx.device, build.vertexBuffer.buffer, "AS Vertices");
+        debug_set_buffer_name(ctx.device, build.indexBuffer.buffer, "AS Indices");
 
+        // No transform data is an identity transform
         vk::AccelerationStructureGeometryTrianglesDataKHR triangleData(
             vk::Format::eR32G32B32Sfloat,
-            vertexBuffer.deviceAddress,
-            vertexStride,
-            vertices.size(),
+            build.vertexBuffer.deviceAddress,
+            sizeof(glm::vec3),
+            uint32_t(vertices.size()),
             vk::IndexType::eUint32,
-            indexBuffer.deviceAddress,
-            transformBuffer.deviceAddress);
+            build.indexBuffer.deviceAddress);
 
-        vk::AccelerationStructureGeometryKHR accelerationStructureGeometry(vk::GeometryTypeKHR::eTriangles, triangleData, vk::GeometryFlagBitsKHR::eOpaque);
+        build.geometry = vk::AccelerationStructureGeometryKHR(vk::GeometryTypeKHR::eTriangles, triangleData, vk::GeometryFlagBitsKHR::eOpaque);
+        build.range = vk::AccelerationStructureBuildRangeInfoKHR(part.indexCount / 3);
 
-        vk::AccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo(
+        vk::AccelerationStructureBuildGeometryInfoKHR buildGeometryInfo(
             vk::AccelerationStructureTypeKHR::eBottomLevel,
-            vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace);
-
-        accelerationStructureBuildGeometryInfo.setGeometries(accelerationStructureGeometry);
-
-        const auto numTriangles = indices.size() / 3;
-        auto buildSizes = ctx.device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice, accelerationStructureBuildGeometryInfo, numTriangles);
+            vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction);
+        buildGeometryInfo.setGeometries(build.geometry);
+        build.sizes = ctx.device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice, buildGeometryInfo, build.range.primitiveCount);
 
-        AccelerationStructure bottomLevelAS;
-        bottomLevelAS.buffer = buffer_create(ctx, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
-            vk::MemoryPropertyFlagBits::eDeviceLocal, buildSizes.accelerationStructureSize);
+        builds.push_back(std::move(build));
+    }
+}
 
-        debug_set_buffer_name(ctx.device, bottomLevelAS.buffer.buffer, part.name + "_Buffer_BLAS");
-        debug_set_devicememory_name(ctx.device, bottomLevelAS.buffer.memory, part.name + "_Memory_BLAS");
+// All the parts are built in one submission, sharing a scratch arena.  The compacted sizes are queried as they
+// finish, and each structure is then copied into a buffer of that size; typically around half
+void as_build_bottom_level(VulkanContext& ctx, std::vector<BottomLevelBuild>& builds)
+{
+    if (builds.empty())
+    {
+        return;
+    }
 
-        vk::AccelerationStructureCreateInfoKHR accelerationStructureCreateInfo(vk::AccelerationStructureCreateFlagsKHR(), bottomLevelAS.buffer.buffer, 0, buildSizes.accelerationStructureSize, vk::AccelerationStructureTypeKHR::eBottomLevel);
+    vk::DeviceSize scratchSize = 0;
+    vk::DeviceSize builtBytes = 0;
+    for (auto& build : builds)
+    {
+        build.scratchOffset = scratchSize;
+        scratchSize = as_align(ctx, scratchSize + build.sizes.buildScratchSize);
+        builtBytes += build.sizes.accelerationStructureSize;
 
-        bottomLevelAS.handle = ctx.device.createAccelerationStructureKHR(accelerationStructureCreateInfo);
-        debug_set_accelerationstructure_name(ctx.device, bottomLevelAS.handle, part.name + "_BLAS");
+        build.as = as_create(ctx, vk::AccelerationStructureTypeKHR::eBottomLevel, build.sizes.accelerationStructureSize, build.name + "_BLAS");
+        build.as.vertexOffset = build.vertexOffset;
+    }
 
-        // Create a small scratch buffer used during build of the bottom level acceleration structure
-        auto scratchBuffer = buffer_create(ctx, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal, buildSizes.buildScratchSize);
+    auto scratchBuffer = buffer_create(ctx, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal, scratchSize);
+    debug_set_buffer_name(ctx.device, scratchBuffer.buffer, "AS Scratch");
 
-        vk::AccelerationStructureBuildGeometryInfoKHR accelerationBuildGeometryInfo(
+    std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> buildInfos;
+    std::vector<const vk::AccelerationStructureBuildRangeInfoKHR*> buildRanges;
+    std::vector<vk::AccelerationStructureKHR> handles;
+    for (auto& build : builds)
+    {
+        vk::AccelerationStructureBuildGeometryInfoKHR buildInfo(
             vk::AccelerationStructureTypeKHR::eBottomLevel,
-            vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace);
-        accelerationBuildGeometryInfo.setDstAccelerationStructure(bottomLevelAS.handle);
-        accelerationBuildGeometryInfo.setGeometries(accelerationStructureGeometry);
-        accelerationBuildGeometryInfo.scratchData.deviceAddress = vk::DeviceAddress((void*)scratchBuffer.deviceAddress.deviceAddress);
+            vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction);
+        buildInfo.setDstAccelerationStructure(build.as.handle);
+        buildInfo.setGeometries(build.geometry);
+        buildInfo.scratchData.deviceAddress = scratchBuffer.deviceAddress.deviceAddress + build.scratchOffset;
+        buildInfos.push_back(buildInfo);
+        buildRanges.push_back(&build.range);
+        handles.push_back(build.as.handle);
+    }
+
+    auto queryPool = ctx.device.createQueryPool(vk::QueryPoolCreateInfo(vk::QueryPoolCreateFlags(), vk::QueryType::eAccelerationStructureCompactedSizeKHR, uint32_t(builds.size())));
 
-        vk::AccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo(numTriangles);
+    // Build the acceleration structures on the device via a one-time command buffer submission
+    // Some implementations may support acceleration structure building on the host (VkPhysicalDeviceAccelerationStructureFeaturesKHR->accelerationStructureHostCommands), but we prefer device builds
+    utils_with_command_buffer(ctx, [&](const vk::CommandBuffer& commandBuffer) {
+        commandBuffer.resetQueryPool(queryPool, 0, uint32_t(builds.size()));
+        commandBuffer.buildAccelerationStructuresKHR(buildInfos, buildRanges);
+        as_barrier(commandBuffer);
+        commandBuffer.writeAccelerationStructuresPropertiesKHR(handles, vk::QueryType::eAccelerationStructureCompactedSizeKHR, queryPool, 0);
+    });
 
-        std::vector<vk::AccelerationStructureBuildRangeInfoKHR*> accelerationBuildStructureRangeInfos = { &accelerationStructureBuildRangeInfo };
+    std::vector<vk::DeviceSize> compactSizes(builds.size(), 0);
+    auto result = ctx.device.getQueryPoolResults(queryPool, 0, uint32_t(builds.size()), compactSizes.size() * sizeof(vk::DeviceSize), compactSizes.data(), sizeof(vk::DeviceSize), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+    ctx.device.destroyQueryPool(queryPool);
+    vulkan_buffer_destroy(ctx, scratchBuffer);
 
-        // Build the acceleration structure on the device via a one-time command buffer submission
-        // Some implementations may support acceleration structure building on the host (VkPhysicalDeviceAccelerationStructureFeaturesKHR->accelerationStructureHostCommands), but we prefer device builds
-        utils_with_command_buffer(ctx, [&](const vk::CommandBuffer& commandBuffer) {
-            commandBuffer.buildAccelerationStructuresKHR(accelerationBuildGeometryInfo, accelerationBuildStructureRangeInfos);
-        });
+    // Copy each into its compacted size; any that couldn't be queried stay as they are
+    std::vector<AccelerationStructure> compacted(builds.size());
+    for (size_t i = 0; i < builds.size(); i++)
+    {
+        if (result == vk::Result::eSuccess && compactSizes[i] != 0 && compactSizes[i] < builds[i].sizes.accelerationStructureSize)
+        {
+            compacted[i] = as_create(ctx, vk::AccelerationStructureTypeKHR::eBottomLevel, compactSizes[i], builds[i].name + "_BLAS");
+            compacted[i].vertexOffset = builds[i].vertexOffset;
+        }
+    }
 
-        bottomLevelAS.asDeviceAddress = ctx.device.getAccelerationStructureAddressKHR(bottomLevelAS.handle);
+    utils_with_command_buffer(ctx, [&](const vk::CommandBuffer& commandBuffer) {
+        for (size_t i = 0; i < builds.size(); i++)
+        {
+            if (compacted[i].handle)
+            {
+                commandBuffer.copyAccelerationStructureKHR(vk::CopyAccelerationStructureInfoKHR(builds[i].as.handle, compacted[i].handle, vk::CopyAccelerationStructureModeKHR::eCompact));
+            }
+        }
+    });
 
-        bottomLevelAS.vertexOffset = part.vertexBase;
+    vk::DeviceSize compactedBytes = 0;
+    for (size_t i = 0; i < builds.size(); i++)
+    {
+        auto& build = builds[i];
+        if (compacted[i].handle)
+        {
+            as_destroy(ctx, build.as);
+            build.as = compacted[i];
+        }
+        compactedBytes += build.as.buffer.size;
 
-        model.accelerationStructures.push_back(bottomLevelAS);
+        build.as.asDeviceAddress = ctx.device.getAccelerationStructureAddressKHR(build.as.handle);
+        build.pModel->accelerationStructures.push_back(build.as);
 
-        vulkan_buffer_destroy(ctx, scratchBuffer);
-        vulkan_buffer_destroy(ctx, vertexBuffer);
-        vulkan_buffer_destroy(ctx, transformBuffer);
-        vulkan_buffer_destroy(ctx, indexBuffer);
+        vulkan_buffer_destroy(ctx, build.vertexBuffer);
+        vulkan_buffer_destroy(ctx, build.indexBuffer);
     }
+
+    LOG(INFO, fmt::format("Built {} BLASes: {:.2f}MB, {:.2f}MB compacted; {:.2f}MB scratch", builds.size(), builtBytes / (1024.0 * 1024.0), compactedBytes / (1024.0 * 1024.0), scratchSize / (1024.0 * 1024.0)));
 }
 
-void createTopLevelAccelerationStructure(VulkanContext& ctx, VulkanModel& model)
+// Rows of the 3x4 transform are the columns of the glm matrix
+vk::TransformMatrixKHR as_transform(const glm::mat4& transform)
 {
-    VkTransformMatrixKHR transformMatrix = {
-        1.0f, 0.0f, 0.0f, 0.0f,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f
-    };
+    vk::TransformMatrixKHR matrix;
+    for (int row = 0; row < 3; row++)
+    {
+        for (int col = 0; col < 4; col++)
+        {
+            matrix.matrix[row][col] = transform[col][row];
+        }
+    }
+    return matrix;
+}
 
+std::vector<vk::AccelerationStructureInstanceKHR> as_instances(const VulkanModel& model)
+{
+    auto transform = as_transform(model.asTransform);
     std::vector<vk::AccelerationStructureInstanceKHR> instances;
     for (auto& as : model.accelerationStructures)
     {
-        instances.push_back(vk::AccelerationStructureInstanceKHR(transformMatrix, as.vertexOffset, 0xFF, 0, vk::GeometryInstanceFlagBitsKHR::eTriangleFacingCullDisable, as.asDeviceAddress));
+        instances.push_back(vk::AccelerationStructureInstanceKHR(transform, as.vertexOffset, 0xFF, 0, vk::GeometryInstanceFlagBitsKHR::eTriangleFacingCullDisable, as.asDeviceAddress));
     }
+    return instances;
+}
+
+vk::AccelerationStructureGeometryKHR as_instance_geometry(const VulkanModel& model)
+{
+    vk::AccelerationStructureGeometryKHR accelerationStructureGeometry;
+    accelerationStructureGeometry.geometryType = vk::GeometryTypeKHR::eInstances;
+    accelerationStructureGeometry.flags = vk::GeometryFlagBitsKHR::eOpaque;
+    accelerationStructureGeometry.geometry.instances.sType = vk::StructureType::eAccelerationStructureGeometryInstancesDataKHR;
+    accelerationStructureGeometry.geometry.instances.arrayOfPointers = false;
+    accelerationStructureGeometry.geometry.instances.data = model.asInstances.deviceAddress;
+    return accelerationStructureGeometry;
+}
 
-    // Buffer for instance data
-    auto instancesBuffer = buffer_create(
+// The top level acceleration structure contains the model's instances, one for each part.  Built to allow
+// updates, so moving the instances is a refit instead of a rebuild
+void as_build_top_level(VulkanContext& ctx, VulkanModel& model)
+{
+    auto instances = as_instances(model);
+
+    // Kept, so that refits can write new transforms
+    model.asInstances = buffer_create(
         ctx,
-        vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
+        vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eTransferDst,
         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
         instances);
+    debug_set_buffer_name(ctx.device, model.asInstances.buffer, model.debugName + "_Instances");
 
-    vk::AccelerationStructureGeometryKHR accelerationStructureGeometry;
-    accelerationStructureGeometry.geometryType = vk::GeometryTypeKHR::eInstances; 
-    accelerationStructureGeometry.flags = vk::GeometryFlagBitsKHR::eOpaque; 
-    accelerationStructureGeometry.geometry.instances.sType = vk::StructureType::eAccelerationStructureGeometryInstancesDataKHR;
-    accelerationStructureGeometry.geometry.instances.arrayOfPointers = false;
-    accelerationStructureGeometry.geometry.instances.data = instancesBuffer.deviceAddress;
+    auto accelerationStructureGeometry = as_instance_geometry(model);
 
-    vk::AccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo(
-        vk::AccelerationStructureTypeKHR::eTopLevel,
-        vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace);
-    accelerationStructureBuildGeometryInfo.setGeometries(accelerationStructureGeometry);
+    vk::AccelerationStructureBuildGeometryInfoKHR accelerationBuildGeometryInfo(vk::AccelerationStructureTypeKHR::eTopLevel, TopLevelFlags);
+    accelerationBuildGeometryInfo.setGeometries(accelerationStructureGeometry);
 
-    auto buildSizes = ctx.device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice, accelerationStructureBuildGeometryInfo, model.accelerationStructures.size());
+    auto instanceCount = uint32_t(instances.size());
+    auto buildSizes = ctx.device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice, accelerationBuildGeometryInfo, instanceCount);
 
-    AccelerationStructure topLevelAS;
-    topLevelAS.buffer = buffer_create(ctx, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
-        vk::MemoryPropertyFlagBits::eDeviceLocal, buildSizes.accelerationStructureSize);
+    model.topLevelAS = as_create(ctx, vk::AccelerationStructureTypeKHR::eTopLevel, buildSizes.accelerationStructureSize, model.debugName + "_TLAS");
+    model.asInstanceCount = instanceCount;
 
-    debug_set_buffer_name(ctx.device, topLevelAS.buffer.buffer, model.debugName + "_Buffer_TLAS");
-    debug_set_devicememory_name(ctx.device, topLevelAS.buffer.memory, model.debugName + "_Memory_TLAS");
+    // Large enough for the build, and for any refits after it
+    model.asScratch = buffer_create(ctx, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal, std::max(buildSizes.buildScratchSize, buildSizes.updateScratchSize));
+    debug_set_buffer_name(ctx.device, model.asScratch.buffer, model.debugName + "_TLAS_Scratch");
 
-    vk::AccelerationStructureCreateInfoKHR accelerationStructureCreateInfo(vk::AccelerationStructureCreateFlagsKHR(), topLevelAS.buffer.buffer, 0, buildSizes.accelerationStructureSize, vk::AccelerationStructureTypeKHR::eTopLevel);
+    accelerationBuildGeometryInfo.setDstAccelerationStructure(model.topLevelAS.handle);
+    accelerationBuildGeometryInfo.scratchData.deviceAddress = model.asScratch.deviceAddress.deviceAddress;
 
-    topLevelAS.handle = ctx.device.createAccelerationStructureKHR(accelerationStructureCreateInfo);
-    debug_set_accelerationstructure_name(ctx.device, topLevelAS.handle, model.debugName + "_TLAS");
+    vk::AccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo(instanceCount);
+    std::vector<const vk::AccelerationStructureBuildRangeInfoKHR*> accelerationBuildStructureRangeInfos = { &accelerationStructureBuildRangeInfo };
 
-    // Create a small scratch buffer used during build of the bottom level acceleration structure
-    auto scratchBuffer = buffer_create(ctx, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal, buildSizes.buildScratchSize);
+    utils_with_command_buffer(ctx, [&](const vk::CommandBuffer& commandBuffer) {
+        commandBuffer.buildAccelerationStructuresKHR(accelerationBuildGeometryInfo, accelerationBuildStructureRangeInfos);
+    });
 
-    vk::AccelerationStructureBuildGeometryInfoKHR accelerationBuildGeometryInfo(
-        vk::AccelerationStructureTypeKHR::eTopLevel,
-        vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace);
-    accelerationBuildGeometryInfo.setDstAccelerationStructure(topLevelAS.handle);
-    accelerationBuildGeometryInfo.setGeometries(accelerationStructureGeometry);
-    accelerationBuildGeometryInfo.scratchData.deviceAddress = vk::DeviceAddress((void*)scratchBuffer.deviceAddress.deviceAddress);
+    model.topLevelAS.asDeviceAddress = ctx.device.getAccelerationStructureAddressKHR(model.topLevelAS.handle);
+    model.topLevelASDescriptor = vk::WriteDescriptorSetAccelerationStructureKHR(1, &model.topLevelAS.handle);
+}
 
-    vk::AccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo(model.accelerationStructures.size());
+void as_destroy_top_level(VulkanContext& ctx, VulkanModel& model)
+{
+    as_destroy(ctx, model.topLevelAS);
+    vulkan_buffer_destroy(ctx, model.asInstances);
+    vulkan_buffer_destroy(ctx, model.asScratch);
+    model.asInstanceCount = 0;
+}
 
-    std::vector<vk::AccelerationStructureBuildRangeInfoKHR*> accelerationBuildStructureRangeInfos = { &accelerationStructureBuildRangeInfo };
+// Rewrites the instances and updates the TLAS in place (src = dst)
+void as_refit_top_level(VulkanContext& ctx, VulkanModel& model)
+{
+    auto instances = as_instances(model);
+    auto accelerationStructureGeometry = as_instance_geometry(model);
+
+    vk::AccelerationStructureBuildGeometryInfoKHR accelerationBuildGeometryInfo(vk::AccelerationStructureTypeKHR::eTopLevel, TopLevelFlags, vk::BuildAccelerationStructureModeKHR::eUpdate);
+    accelerationBuildGeometryInfo.setSrcAccelerationStructure(model.topLevelAS.handle);
+    accelerationBuildGeometryInfo.setDstAccelerationStructure(model.topLevelAS.handle);
+    accelerationBuildGeometryInfo.setGeometries(accelerationStructureGeometry);
+    accelerationBuildGeometryInfo.scratchData.deviceAddress = model.asScratch.deviceAddress.deviceAddress;
+
+    vk::AccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo(model.asInstanceCount);
+    std::vector<const vk::AccelerationStructureBuildRangeInfoKHR*> accelerationBuildStructureRangeInfos = { &accelerationStructureBuildRangeInfo };
 
-    // Build the acceleration structure on the device via a one-time command buffer submission
-    // Some implementations may support acceleration structure building on the host (VkPhysicalDeviceAccelerationStructureFeaturesKHR->accelerationStructureHostCommands), but we prefer device builds
     utils_with_command_buffer(ctx, [&](const vk::CommandBuffer& commandBuffer) {
+        // The instances are written on the queue, after any trace still reading the TLAS
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr, nullptr, nullptr);
+
+        auto pInstances = (const uint8_t*)instances.data();
+        vk::DeviceSize instanceBytes = instances.size() * sizeof(vk::AccelerationStructureInstanceKHR);
+        for (vk::DeviceSize offset = 0; offset < instanceBytes; offset += UpdateBufferMaxBytes)
+        {
+            auto size = std::min(UpdateBufferMaxBytes, instanceBytes - offset);
+            commandBuffer.updateBuffer(model.asInstances.buffer, offset, size, pInstances + offset);
+        }
+
+        vk::MemoryBarrier barrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead);
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::DependencyFlags(), barrier, nullptr, nullptr);
+
         commandBuffer.buildAccelerationStructuresKHR(accelerationBuildGeometryInfo, accelerationBuildStructureRangeInfos);
+        as_barrier(commandBuffer);
     });
+}
 
-    topLevelAS.asDeviceAddress = ctx.device.getAccelerationStructureAddressKHR(topLevelAS.handle);
+} // namespace
 
-    model.topLevelAS = topLevelAS;
+void vulkan_model_build_acceleration_structures(VulkanContext& ctx, const std::vector<VulkanModel*>& models)
+{
+    std::vector<VulkanModel*> pending;
+    std::vector<BottomLevelBuild> builds;
+    for (auto pModel : models)
+    {
+        if (pModel->initAccel || std::find(pending.begin(), pending.end(), pModel) != pending.end() || pModel->dataReleased)
+        {
+            continue;
+        }
+        as_prepare_bottom_level(ctx, *pModel, builds);
+        pending.push_back(pModel);
+    }
 
-    model.topLevelASDescriptor = vk::WriteDescriptorSetAccelerationStructureKHR(1, &model.topLevelAS.handle);
+    as_build_bottom_level(ctx, builds);
 
-    vulkan_buffer_destroy(ctx, scratchBuffer);
+    for (auto pModel : pending)
+    {
+        if (!pModel->accelerationStructures.empty())
+        {
+            as_build_top_level(ctx, *pModel);
+        }
+        pModel->initAccel = true;
+    }
 }
 
-// The top level acceleration structure contains the scene's object instances
-void vulkan_model_build_acceleration_structure(VulkanContext& ctx, VulkanModel& model)
+void vulkan_model_update_acceleration_structure(VulkanContext& ctx, VulkanModel& model, const glm::mat4& transform)
 {
-    if (!model.initAccel)
+    if (!model.topLevelAS.handle || transform == model.asTransform)
+    {
+        return;
+    }
+    model.asTransform = transform;
+
+    // A refit can only move instances; if the parts have changed, start again
+    if (model.asInstanceCount != uint32_t(model.accelerationStructures.size()))
     {
-        createBottomLevelAccelerationStructure(ctx, model);
+        ctx.device.waitIdle();
+        as_destroy_top_level(ctx, model);
         if (!model.accelerationStructures.empty())
         {
-            createTopLevelAccelerationStructure(ctx, model);
+            as_build_top_level(ctx, model);
         }
-        model.initAccel = true;
+        return;
     }
+
+    as_refit_top_level(ctx, model);
 }
 
 } // namespace vulkan
-
-
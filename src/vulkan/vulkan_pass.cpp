@@ -13,10 +13,12 @@
 
 #include "vklive/validation.h"
 
+#include "vklive/vulkan/vulkan_model.h"
 #include "vklive/vulkan/vulkan_nanovg.h"
 #include "vklive/vulkan/vulkan_pass.h"
 #include "vklive/vulkan/vulkan_pipeline.h"
 #include "vklive/vulkan/vulkan_render.h"
+#include "vklive/vulkan/vulkan_transfer.h"
 #include "vklive/vulkan/vulkan_uniform.h"
 #include "vklive/vulkan/vulkan_utils.h"
 #include <vklive/python_scripting.h>
@@ -26,6 +28,12 @@ using namespace ranges;
 namespace vulkan
 {
 
+// Granularity of target allocations made during an interactive resize
+const uint32_t TargetResizeBucket = 256;
+
+// A LOD is drawn if its simplified surface strays from the full one by less than this on screen
+const float LodPixelError = 1.0f;
+
 VulkanPassSwapFrameData& vulkan_pass_frame_data(VulkanContext& ctx, VulkanPass& vulkanPass)
 {
     return vulkanPass.passFrameData[ctx.mainWindowData.frameIndex];
@@ -58,6 +66,12 @@ void vulkan_pass_destroy(VulkanContext& ctx, VulkanPass& vulkanPass)
         ctx.device.destroyCommandPool(passData.commandPool);
         passData.commandPool = nullptr;
 
+        if (passData.timestampQueries)
+        {
+            ctx.device.destroyQueryPool(passData.timestampQueries);
+            passData.timestampQueries = nullptr;
+        }
+
         vulkan_buffer_destroy(ctx, passData.vsUniform);
 
         vulkan_buffer_destroy(ctx, passData.rayGenBindingTable);
@@ -87,6 +101,17 @@ void vulkan_pass_wait(VulkanContext& ctx, VulkanPassSwapFrameData& passData)
         passData.inFlight = false;
         ctx.device.resetFences(passData.fence);
 
+        // The pass is complete, so its timestamps are available
+        if (passData.timestampQueries)
+        {
+            uint64_t timestamps[2] = { 0, 0 };
+            auto result = ctx.device.getQueryPoolResults(passData.timestampQueries, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+            if (result == vk::Result::eSuccess && timestamps[1] >= timestamps[0])
+            {
+                passData.gpuMilliseconds = double(timestamps[1] - timestamps[0]) * ctx.timestampPeriod / 1000000.0;
+            }
+        }
+
         // LOG(DBG, "Reset fence: " << &passData.fence);
     }
     else
@@ -123,9 +148,45 @@ void vulkan_pass_prepare_command_buffers(VulkanContext& ctx, VulkanPassSwapFrame
             "CommandBuffer:" + bufferData.debugName);
         debug_set_fence_name(ctx.device, bufferData.fence,
             "Fence:" + bufferData.debugName);
+
+        if (ctx.timestampPeriod != 0.0f)
+        {
+            bufferData.timestampQueries = ctx.device.createQueryPool(vk::QueryPoolCreateInfo(vk::QueryPoolCreateFlags(), vk::QueryType::eTimestamp, 2));
+        }
     }
 
     bufferData.commandBuffer.begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+
+    if (bufferData.timestampQueries)
+    {
+        bufferData.commandBuffer.resetQueryPool(bufferData.timestampQueries, 0, 2);
+        bufferData.commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, bufferData.timestampQueries, 0);
+    }
+}
+
+// The size a target should be rendered at this frame
+glm::uvec2 vulkan_pass_target_size(VulkanContext& ctx, VulkanScene& vulkanScene, const Surface& surface)
+{
+    // If it is 0 size, then it is frame buffer size
+    auto size = surface.size;
+    if (size == glm::uvec2(0, 0))
+    {
+        // By default we scale to the framebuffer size
+        auto fbSize = ctx.frameBufferSize;
+
+        // ... but if the user fixed the size of the default color output, scale relative to that
+        auto defaultColorSize = vulkanScene.pScene->surfaces["default_color"]->size;
+        if (defaultColorSize != glm::uvec2(0, 0))
+        {
+            // If the default color size has a fixed size, our scale is relative to that.
+            fbSize = defaultColorSize;
+        }
+
+        // Size is the frame buffer size, by any multiplier the user has provided, and the dynamic resolution scale
+        auto renderScale = vulkanScene.pScene->dynamicResolution.scale;
+        size = glm::uvec2(surface.scale.x * renderScale * fbSize.x, surface.scale.y * renderScale * fbSize.y);
+    }
+    return size;
 }
 
 // Get a vulkan target surface.
@@ -173,29 +234,37 @@ VulkanSurface* get_vulkan_surface(VulkanContext& ctx, VulkanPass& vulkanPass, co
         return pVulkanSurface;
     }
 
-    // If it is 0 size, then it is frame buffer size
-    auto size = pSurface->size;
-    if (size == glm::uvec2(0, 0))
-    {
-        // By default we scale to the framebuffer size
-        auto fbSize = ctx.frameBufferSize;
+    auto size = vulkan_pass_target_size(ctx, vulkanScene, *pSurface);
 
-        // ... but if the user fixed the size of the default color output, scale relative to that
-        auto defaultColorSize = vulkanPass.vulkanScene.pScene->surfaces["default_color"]->size;
-        if (defaultColorSize != glm::uvec2(0, 0))
-        {
-            // If the default color size has a fixed size, our scale is relative to that.
-            fbSize = defaultColorSize;
-        }
+    // Targets may be bigger than the area we render to.  While the output is being interactively resized,
+    // we only reallocate when the surface is too small, and then with headroom.  When things settle, we
+    // reallocate to the exact size, so that sampling the whole surface is correct again.
+    auto allocated = glm::uvec2(pVulkanSurface->extent.width, pVulkanSurface->extent.height);
+    bool fits = pVulkanSurface->image && allocated.x >= size.x && allocated.y >= size.y;
+    bool resizing = vulkanScene.pScene->outputResizing;
 
-        // Size is the frame buffer size, by any multiplier the user has provided
-        size = glm::uvec2(pSurface->scale.x * fbSize.x, pSurface->scale.y * fbSize.y);
+    bool reallocate = false;
+    if (size == glm::uvec2(0, 0))
+    {
+        reallocate = (pVulkanSurface->image ? true : false);
+    }
+    else if (!fits)
+    {
+        reallocate = true;
+    }
+    else if (!resizing)
+    {
+        reallocate = (allocated != size);
     }
 
-    // OK, so it has changed size
-    if (size != pVulkanSurface->pSurface->currentSize)
+    if (!reallocate)
     {
-        LOG(DBG, "Resize: " << *pVulkanSurface);
+        pVulkanSurface->pSurface->currentSize = size;
+    }
+    else
+    {
+        PROFILE_SCOPE(target_resize);
+        LOG(DBG, "Resize: " << *pVulkanSurface << " to: " << size.x << ", " << size.y << (resizing ? " (Resizing)" : ""));
 
         // Wait for this pass to complete, since we are destroying potentially active surfaces
         // NOTE: We wait idle because, the sampler is begin used in the IMGui pass, so we can't just
@@ -211,9 +280,20 @@ VulkanSurface* get_vulkan_surface(VulkanContext& ctx, VulkanPass& vulkanPass, co
         // If surface bigger than 0
         if (size != glm::uvec2(0, 0))
         {
+            // Round up while resizing, so that we don't reallocate on every pixel change
+            auto allocSize = size;
+            if (resizing)
+            {
+                allocSize = ((size + TargetResizeBucket - 1u) / TargetResizeBucket) * TargetResizeBucket;
+            }
+
+            auto format = utils_format_to_vulkan(pSurface->format);
             if (format_is_depth(pSurface->format))
             {
-                vulkan_surface_create_depth(ctx, *pVulkanSurface, size, utils_format_to_vulkan(pSurface->format));
+                if (!vulkan_surface_pool_claim(ctx, *pVulkanSurface, allocSize, format, 0))
+                {
+                    vulkan_surface_create_depth(ctx, *pVulkanSurface, allocSize, format);
+                }
             }
             else
             {
@@ -222,7 +302,16 @@ VulkanSurface* get_vulkan_surface(VulkanContext& ctx, VulkanPass& vulkanPass, co
                 {
                     flags |= VulkanSurfaceFlags::Uploadable;
                 }
-                vulkan_surface_create(ctx, *pVulkanSurface, size, utils_format_to_vulkan(pSurface->format), flags);
+                if (pSurface->isRayTarget)
+                {
+                    flags |= VulkanSurfaceFlags::Storage;
+                }
+
+                // A previous scene may have left us an identical surface
+                if (!vulkan_surface_pool_claim(ctx, *pVulkanSurface, allocSize, format, flags))
+                {
+                    vulkan_surface_create(ctx, *pVulkanSurface, allocSize, format, flags);
+                }
             }
         }
 
@@ -246,13 +335,15 @@ bool vulkan_pass_check_targets(VulkanContext& ctx, VulkanPassTargets& passTarget
             return true;
         }
 
+        // The area we render to; the surface itself may be bigger
+        auto renderSize = img->pSurface->currentSize;
         if (size.x == 0 && size.y == 0)
         {
-            size = glm::uvec2(img->extent.width, img->extent.height);
+            size = renderSize;
         }
         else
         {
-            if (size.x != img->extent.width || size.y != img->extent.height)
+            if (size != renderSize)
             {
                 auto& pass = passTargets.pFrameData->pVulkanPass->pass;
                 Message msg;
@@ -270,30 +361,6 @@ bool vulkan_pass_check_targets(VulkanContext& ctx, VulkanPassTargets& passTarget
         return true;
     };
 
-    auto checkForChanges = [&](auto pVulkanSurface) {
-        if (!pVulkanSurface)
-        {
-            return false;
-        }
-
-        bool changed = false;
-        auto itr = passTargets.mapSurfaceGenerations.find(pVulkanSurface);
-        if (itr != passTargets.mapSurfaceGenerations.end())
-        {
-            if (itr->second != pVulkanSurface->generation)
-            {
-                changed = true;
-            }
-        }
-        else
-        {
-            changed = true;
-        }
-        passTargets.mapSurfaceGenerations[pVulkanSurface] = pVulkanSurface->generation;
-        return changed;
-    };
-
-    bool diff = false;
     glm::uvec2 size = glm::uvec2(0);
 
     for (auto& pTargetData : passTargets.orderedTargets)
@@ -303,33 +370,24 @@ bool vulkan_pass_check_targets(VulkanContext& ctx, VulkanPassTargets& passTarget
             // If sizes don't match, we are effectively broken and can't render
             return false;
         }
-
-        if (checkForChanges(pTargetData->pVulkanSurface))
-        {
-            diff = true;
-        }
     }
 
-    // If our pass targets have changed size, then we need to clean up the framebuffer, renderpass and geom pipe
-    // TODO: This only handles resizes, not recreation?...
-    if (diff)
+    // A resized or reallocated target doesn't affect the pipeline; only the attachment formats
+    // (and their count) are baked into it.
+    auto pFrameData = passTargets.pFrameData;
+    if (pFrameData && pFrameData->pipeline && (passTargets.colorFormats != pFrameData->pipelineColorFormats || passTargets.depthFormat != pFrameData->pipelineDepthFormat))
     {
-        // LOG(DBG, "Targets different, cleaning up FB, RenderPass, Geom");
+        LOG(DBG, "Target formats changed, rebuilding pipeline: " << pFrameData->debugName);
 
         // I think we can just wait for the pass here, since these are all pass-specific objects
         // Note that a previous pass may have changed targets, even if this one didn't.  So we need
         // to update our state here
         vulkan_pass_wait(ctx, *passTargets.pFrameData);
 
-        // Geom pipe uses the render pass
-        if (passTargets.pFrameData && passTargets.pFrameData->pipeline)
-        {
-            // LOG(DBG, "Destroy Geometry Pipe: " << passTargets.pFrameData->pipeline);
-            ctx.device.destroyPipeline(passTargets.pFrameData->pipeline);
-            ctx.device.destroyPipelineLayout(passTargets.pFrameData->geometryPipelineLayout);
-            passTargets.pFrameData->pipeline = nullptr;
-            passTargets.pFrameData->geometryPipelineLayout = nullptr;
-        }
+        ctx.device.destroyPipeline(pFrameData->pipeline);
+        ctx.device.destroyPipelineLayout(pFrameData->geometryPipelineLayout);
+        pFrameData->pipeline = nullptr;
+        pFrameData->geometryPipelineLayout = nullptr;
     }
 
     passTargets.targetSize = size;
@@ -365,25 +423,9 @@ void vulkan_pass_check_samplers(VulkanContext& ctx, VulkanPassTargets& passTarge
     for (auto& passSampler : frameData.pVulkanPass->pass.samplers)
     {
         auto pVulkanSurface = get_vulkan_surface(ctx, *frameData.pVulkanPass, passSampler);
+        // Descriptors are written every frame, so a changed sampler surface doesn't need a new pipeline
         if (checkForChanges(pVulkanSurface))
         {
-            // LOG(DBG, "Sampler has changed, removing geometry pipe");
-
-            // I think we can just wait for the pass here, since these are all pass-specific objects
-            // Note that a previous pass may have changed targets, even if this one didn't.  So we need
-            // to update our state here
-            vulkan_pass_wait(ctx, *passTargets.pFrameData);
-
-            // Geom pipe uses the render pass
-            if (frameData.pipeline)
-            {
-                // LOG(DBG, "Destroy Geometry Pipe: " << frameData.pipeline);
-                ctx.device.destroyPipeline(frameData.pipeline);
-                ctx.device.destroyPipelineLayout(frameData.geometryPipelineLayout);
-                passTargets.pFrameData->pipeline = nullptr;
-                passTargets.pFrameData->geometryPipelineLayout = nullptr;
-            }
-
             // We are sampling this surface, so make sure it has a sampler:
             // they are not automatically created until the surface is actually sampled
             if (!pVulkanSurface->sampler)
@@ -464,6 +506,7 @@ void vulkan_pass_prepare_targets(VulkanContext& ctx, VulkanPassSwapFrameData& pa
     {
         auto& targetData = passTargets.mapNameToTargetData[surfaceName];
         targetData.pVulkanSurface = get_vulkan_surface(ctx, *passFrameData.pVulkanPass, surfaceName);
+        targetData.pVulkanSurface->heldContents = false;
 
         if (targetData.pVulkanSurface->pSurface->isRayTarget)
         {
@@ -540,35 +583,96 @@ void vulkan_pass_prepare_surfaces(VulkanContext& ctx, VulkanPassSwapFrameData& p
     vulkan_pass_dump_samplers(ctx, *passFrameData.pVulkanPass);
 }
 
-// Ensure we have setup the buffers for this pass
-void vulkan_pass_prepare_uniforms(VulkanContext& ctx, VulkanPass& vulkanPass)
+// Whether the pass draws to targets sized from the output, rather than ones of a fixed size
+bool vulkan_pass_follows_output(VulkanPass& vulkanPass)
 {
-    PROFILE_SCOPE(prepare_uniforms);
-    LOG_SCOPE(DBG, "Prepare Uniforms:");
+    auto& scene = *vulkanPass.vulkanScene.pScene;
+    for (auto& target : vulkanPass.pass.targets)
+    {
+        auto itrSurface = scene.surfaces.find(target);
+        if (itrSurface != scene.surfaces.end())
+        {
+            return itrSurface->second->size == glm::uvec2(0);
+        }
+    }
+    return false;
+}
 
-    auto& passFrameData = vulkan_pass_frame_data(ctx, vulkanPass);
-    auto& passTargets = vulkan_pass_targets(ctx, passFrameData);
+// A pass has one pipeline, so its geometries share a layout; the scene checks they agree
+const VertexLayout& vulkan_pass_vertex_layout(VulkanPass& vulkanPass)
+{
+    auto& scene = *vulkanPass.vulkanScene.pScene;
+    if (!vulkanPass.pass.models.empty())
+    {
+        auto itrGeom = scene.models.find(vulkanPass.pass.models[0]);
+        if (itrGeom != scene.models.end() && itrGeom->second->quantize)
+        {
+            return g_quantizedVertexLayout;
+        }
+    }
+    return g_vertexLayout;
+}
 
-    if (!passFrameData.vsUniform.buffer)
+// Pick the model's LOD from how large its units appear on the target, at the near side of its bounds
+uint32_t vulkan_pass_select_lod(const VulkanPassSwapFrameData::UBO& ubo, const Model& model, float targetHeight)
+{
+    if (model.lods.size() < 2)
     {
-        passFrameData.vsUniform = vulkan_uniform_create(ctx, passFrameData.vsUBO);
-        debug_set_buffer_name(ctx.device,
-            passFrameData.vsUniform.buffer,
-            fmt::format("{}:{}",
-                passFrameData.debugName, "Uniforms"));
+        return 0;
+    }
 
-        debug_set_devicememory_name(ctx.device,
-            passFrameData.vsUniform.memory,
-            fmt::format("{}:{}", passFrameData.debugName, "DeviceMemory"));
+    // Largest scale of the model transform, applied to the bounds and the error alike
+    auto modelScale = std::max({ glm::length(glm::vec3(ubo.model[0])), glm::length(glm::vec3(ubo.model[1])), glm::length(glm::vec3(ubo.model[2])) });
+    auto center = glm::vec3(ubo.view * ubo.model * glm::vec4((model.dim.min + model.dim.max) * 0.5f, 1.0f));
+    auto radius = glm::length(model.dim.size) * 0.5f * modelScale;
+
+    // Pixels per world unit; orthographic projections don't change with distance
+    auto pixelsPerUnit = std::abs(ubo.projection[1][1]) * 0.5f * targetHeight;
+    if (ubo.projection[3][3] == 0.0f)
+    {
+        auto distance = glm::length(center) - radius;
+        if (distance <= 0.0f)
+        {
+            return 0;
+        }
+        pixelsPerUnit /= distance;
     }
+    return model_select_lod(model, pixelsPerUnit * modelScale, LodPixelError);
+}
 
-    auto size = passTargets.targetSize;
-    auto& ubo = passFrameData.vsUBO;
+// Maps the whole output's clip space onto the tile's
+glm::mat4 vulkan_pass_tile_projection(const glm::vec2& outputSize, const glm::vec2& tileOffset, const glm::vec2& tileSize)
+{
+    auto scale = outputSize / tileSize;
+    auto translate = (outputSize - tileOffset * 2.0f) / tileSize - glm::vec2(1.0f);
+
+    glm::mat4 tile(1.0f);
+    tile[0][0] = scale.x;
+    tile[1][1] = scale.y;
+    tile[3][0] = translate.x;
+    tile[3][1] = translate.y;
+    return tile;
+}
 
+// Fill in the uniforms for this frame, at the given target size
+void vulkan_pass_fill_uniforms(VulkanPass& vulkanPass, VulkanPassSwapFrameData::UBO& ubo, const glm::uvec2& size)
+{
     auto& scene = *vulkanPass.vulkanScene.pScene;
 
     ubo.model = glm::mat4(1.0f);
 
+    // When tiling, the target only covers part of the output; the shaders are told about the whole of it
+    auto outputSize = glm::vec2(size);
+    auto tileOffset = glm::vec2(0.0f);
+    bool tiled = scene.renderTile.outputSize != glm::uvec2(0) && vulkan_pass_follows_output(vulkanPass);
+    if (tiled)
+    {
+        // Targets may be scaled relative to the output
+        auto tileScale = glm::vec2(size) / glm::vec2(scene.renderTile.size);
+        outputSize = glm::vec2(scene.renderTile.outputSize) * tileScale;
+        tileOffset = glm::vec2(scene.renderTile.offset) * tileScale;
+    }
+
     // Setup the camera for this pass
     // pVulkanPass->pPass->camera.orbitDelta = glm::vec2(4.0f, 0.0f);
     // Note that the camera might need different setup each time
@@ -578,13 +682,17 @@ void vulkan_pass_prepare_uniforms(VulkanContext& ctx, VulkanPass& vulkanPass)
         if (itrCamera != scene.cameras.end())
         {
             auto& camera = *itrCamera->second;
-            camera_set_film_size(camera, glm::ivec2(size));
+            camera_set_film_size(camera, glm::ivec2(outputSize));
             camera_pre_render(camera);
 
             // Set UBO variables
             // TODO: More than one camera; handle with reflection
             ubo.view = camera_get_lookat(camera);
             ubo.projection = camera_get_projection(camera);
+            if (tiled)
+            {
+                ubo.projection = vulkan_pass_tile_projection(outputSize, tileOffset, glm::vec2(size)) * ubo.projection;
+            }
             ubo.modelViewProjection = ubo.projection * ubo.view * ubo.model;
             ubo.viewInverse = glm::inverse(ubo.view);
             ubo.projectionInverse = glm::inverse(ubo.projection);
@@ -599,11 +707,11 @@ void vulkan_pass_prepare_uniforms(VulkanContext& ctx, VulkanPass& vulkanPass)
     ubo.iFrame = Scene::GlobalFrameCount;
     ubo.iFrameRate = elapsed != 0.0 ? (1.0f / elapsed) : 0.0;
     ubo.iGlobalTime = elapsed;
-    ubo.iResolution = glm::vec4(size.x, size.y, 1.0, 0.0);
+    ubo.iResolution = glm::vec4(outputSize.x, outputSize.y, 1.0, 0.0);
     ubo.iMouse = glm::vec4(0.0f); // TODO: Mouse
     ubo.iSceneFlags = scene.sceneFlags;
 
-    ubo.vertexSize = layout_size(g_vertexLayout);
+    ubo.vertexSize = layout_size(vulkan_pass_vertex_layout(vulkanPass));
 
     // Audio
     auto& audioCtx = Zing::GetAudioContext();
@@ -633,8 +741,34 @@ void vulkan_pass_prepare_uniforms(VulkanContext& ctx, VulkanPass& vulkanPass)
         ubo.iChannel[i].time = ubo.iChannelTime[i];
     }
 
-    // TODO: Used for offset into the sound buffer for the current frame, I think
-    ubo.ifFragCoordOffsetUniform = glm::vec4(0.0f);
+    // Where this target sits in the output; only non zero when tiling
+    ubo.ifFragCoordOffsetUniform = glm::vec4(tileOffset.x, tileOffset.y, 0.0f, 0.0f);
+}
+
+// Ensure we have setup the buffers for this pass
+void vulkan_pass_prepare_uniforms(VulkanContext& ctx, VulkanPass& vulkanPass)
+{
+    PROFILE_SCOPE(prepare_uniforms);
+    LOG_SCOPE(DBG, "Prepare Uniforms:");
+
+    auto& passFrameData = vulkan_pass_frame_data(ctx, vulkanPass);
+    auto& passTargets = vulkan_pass_targets(ctx, passFrameData);
+
+    if (!passFrameData.vsUniform.buffer)
+    {
+        passFrameData.vsUniform = vulkan_uniform_create(ctx, passFrameData.vsUBO);
+        debug_set_buffer_name(ctx.device,
+            passFrameData.vsUniform.buffer,
+            fmt::format("{}:{}",
+                passFrameData.debugName, "Uniforms"));
+
+        debug_set_devicememory_name(ctx.device,
+            passFrameData.vsUniform.memory,
+            fmt::format("{}:{}", passFrameData.debugName, "DeviceMemory"));
+    }
+
+    auto& ubo = passFrameData.vsUBO;
+    vulkan_pass_fill_uniforms(vulkanPass, ubo, passTargets.targetSize);
 
     // TODO: Should we stage using command buffer?  This is a direct write
     utils_copy_to_memory(ctx, passFrameData.vsUniform.memory, ubo);
@@ -974,14 +1108,25 @@ bool vulkan_pass_prepare_pipeline(VulkanContext& ctx, VulkanPassSwapFrameData& f
     {
         PROFILE_SCOPE(create_pipeline_layout);
         auto layouts = frameData.descriptorSetLayouts | views::transform([](auto& p) { return p.second; }) | to<std::vector>();
-        frameData.geometryPipelineLayout = ctx.device.createPipelineLayout({ {}, layouts });
+        // Quantized geometry is decoded with its model's scales, pushed per draw
+        std::vector<vk::PushConstantRange> pushConstantRanges;
+        if (frameData.pVulkanPass->pass.passType == PassType::Standard && &vulkan_pass_vertex_layout(*frameData.pVulkanPass) == &g_quantizedVertexLayout)
+        {
+            pushConstantRanges.push_back(vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex, 0, sizeof(VulkanModelConstants)));
+        }
+        frameData.geometryPipelineLayout = ctx.device.createPipelineLayout({ {}, layouts, pushConstantRanges });
         debug_set_pipelinelayout_name(ctx.device, frameData.geometryPipelineLayout, fmt::format("GeomPipeLayout: {}", frameData.debugName));
     }
 
+    frameData.pipelineColorFormats = vulkanPassTargets.colorFormats;
+    frameData.pipelineDepthFormat = vulkanPassTargets.depthFormat;
+    frameData.pipelineRebuilds++;
+    LOG(DBG, "Pipeline builds for " << frameData.debugName << ": " << frameData.pipelineRebuilds);
+
     if (frameData.pVulkanPass->pass.passType == PassType::Standard)
     {
         PROFILE_SCOPE(pipeline_create);
-        frameData.pipeline = vulkan_pipeline_create(ctx, g_vertexLayout, frameData.geometryPipelineLayout, vulkanPassTargets, shaderStages);
+        frameData.pipeline = vulkan_pipeline_create(ctx, vulkan_pass_vertex_layout(*frameData.pVulkanPass), frameData.geometryPipelineLayout, vulkanPassTargets, shaderStages);
         debug_set_pipeline_name(ctx.device, frameData.pipeline, fmt::format("GeomPipe: {}", frameData.debugName));
         LOG(DBG, "Create GeometryPipe: " << frameData.pipeline);
     }
@@ -1035,7 +1180,8 @@ void vulkan_pass_transition_samplers(VulkanContext& ctx, VulkanPassSwapFrameData
     {
         auto pVulkanSurface = get_vulkan_surface(ctx, vulkanPass, passSampler);
 
-        if (pVulkanSurface && pVulkanSurface->image)
+        // Held contents were left readable when they were drawn
+        if (pVulkanSurface && pVulkanSurface->image && !pVulkanSurface->heldContents)
         {
             surface_set_layout(ctx, passFrameData.commandBuffer, *pVulkanSurface, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eUndefined, vk::ImageLayout::eShaderReadOnlyOptimal);
         }
@@ -1108,15 +1254,29 @@ void vulkan_pass_submit(VulkanContext& ctx, VulkanPass& vulkanPass)
             // Graphics Pipe
             cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, passFrameData.pipeline);
 
+            vulkanPass.missingGeometry = false;
             for (auto& geom : vulkanPass.pass.models)
             {
                 auto itrGeom = vulkanPass.vulkanScene.models.find(geom);
                 if (itrGeom != vulkanPass.vulkanScene.models.end())
                 {
+                    // Models still loading are left out until they arrive
                     auto pVulkanGeom = itrGeom->second;
+                    if (!vulkan_model_ready(*pVulkanGeom))
+                    {
+                        vulkanPass.missingGeometry = true;
+                        continue;
+                    }
+
+                    if (pVulkanGeom->createInfo.vertexLayout == g_quantizedVertexLayout)
+                    {
+                        auto constants = vulkan_model_constants(*pVulkanGeom);
+                        cmd.pushConstants(passFrameData.geometryPipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(constants), &constants);
+                    }
+                    auto lod = model_lod_range(*pVulkanGeom, vulkan_pass_select_lod(passFrameData.vsUBO, *pVulkanGeom, float(passTargets.targetSize.y)));
                     cmd.bindVertexBuffers(0, pVulkanGeom->vertices.buffer, { 0 });
                     cmd.bindIndexBuffer(pVulkanGeom->indices.buffer, 0, vk::IndexType::eUint32);
-                    cmd.drawIndexed(pVulkanGeom->indexCount, 1, 0, 0, 0);
+                    cmd.drawIndexed(lod.indexCount, 1, lod.indexBase, 0, 0);
                 }
             }
         }
@@ -1210,6 +1370,7 @@ void vulkan_pass_submit(VulkanContext& ctx, VulkanPass& vulkanPass)
     for (auto& pTargetData : passTargets.orderedTargets)
     {
         pTargetData->pVulkanSurface->pSurface->rendered = true;
+        pTargetData->pVulkanSurface->drawCount++;
     }
 
     /* TODO: Why not?
@@ -1219,13 +1380,156 @@ void vulkan_pass_submit(VulkanContext& ctx, VulkanPass& vulkanPass)
     }
     */
 
+    if (passFrameData.timestampQueries)
+    {
+        cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, passFrameData.timestampQueries, 1);
+    }
+
     passFrameData.commandBuffer.end();
     passFrameData.inFlight = true;
 
     LOG(DBG, "Submit CommandBuffer: " << passFrameData.commandBuffer << ", Fence: " << &passFrameData.fence << ", TID: " << std::this_thread::get_id());
 
     LOG(DBG, "Submit Pass");
-    context_get_queue(ctx).submit(vk::SubmitInfo{ 0, nullptr, nullptr, 1, &passFrameData.commandBuffer }, passFrameData.fence);
+    transfer_graphics_submit(ctx, vk::SubmitInfo{ 0, nullptr, nullptr, 1, &passFrameData.commandBuffer }, passFrameData.fence);
+}
+
+// A hash of the inputs to a draw of this pass: the shaders, geometry, target sizes, the generations and
+// contents of the sampled surfaces, and those parts of the uniforms that the shaders actually read.
+// The pipeline itself is only rebuilt when the target formats change, which reallocates the targets.
+uint64_t vulkan_pass_fingerprint(VulkanContext& ctx, VulkanPass& vulkanPass, VulkanPassSwapFrameData& frameData, const VulkanPassSwapFrameData::UBO& ubo)
+{
+    auto& pass = vulkanPass.pass;
+    auto& vulkanScene = vulkanPass.vulkanScene;
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&](const void* pData, size_t size) {
+        auto pBytes = (const uint8_t*)pData;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ pBytes[i]) * 1099511628211ull;
+        }
+    };
+    auto addValue = [&](const auto& value) {
+        add(&value, sizeof(value));
+    };
+
+    for (auto& shaderPath : pass.shaders)
+    {
+        auto itrStage = vulkanScene.shaderStages.find(shaderPath);
+        if (itrStage != vulkanScene.shaderStages.end())
+        {
+            addValue((VkShaderModule)itrStage->second->shaderCreateInfo.module);
+        }
+    }
+
+    for (auto& geom : pass.models)
+    {
+        auto itrGeom = vulkanScene.models.find(geom);
+        if (itrGeom != vulkanScene.models.end() && vulkan_model_ready(*itrGeom->second))
+        {
+            addValue((VkBuffer)itrGeom->second->vertices.buffer);
+            addValue((VkBuffer)itrGeom->second->indices.buffer);
+            addValue(itrGeom->second->indexCount);
+            addValue((VkAccelerationStructureKHR)itrGeom->second->topLevelAS.handle);
+        }
+    }
+
+    for (auto& target : pass.targets)
+    {
+        auto pVulkanSurface = vulkan_scene_get_or_create_surface(vulkanScene, target);
+        if (pVulkanSurface)
+        {
+            addValue(pVulkanSurface);
+            addValue(pVulkanSurface->generation);
+            addValue(vulkan_pass_target_size(ctx, vulkanScene, *pVulkanSurface->pSurface));
+        }
+    }
+
+    for (auto& passSampler : pass.samplers)
+    {
+        auto pVulkanSurface = vulkan_scene_get_or_create_surface(vulkanScene, passSampler.sampler, Scene::GlobalFrameCount, passSampler.sampleAlternate);
+        if (pVulkanSurface)
+        {
+            addValue(pVulkanSurface);
+            addValue(pVulkanSurface->generation);
+            addValue(pVulkanSurface->drawCount);
+        }
+    }
+
+    for (auto& [set, bindingSet] : frameData.mergedBindingSets)
+    {
+        for (auto& [index, binding] : bindingSet.bindings)
+        {
+            if (binding.descriptorType != vk::DescriptorType::eUniformBuffer)
+            {
+                continue;
+            }
+
+            auto itrMeta = bindingSet.bindingMeta.find(index);
+            if (itrMeta == bindingSet.bindingMeta.end())
+            {
+                continue;
+            }
+
+            for (auto& [offset, size] : itrMeta->second.usedRanges)
+            {
+                if (offset < sizeof(ubo))
+                {
+                    add((const uint8_t*)&ubo + offset, std::min(size_t(size), sizeof(ubo) - offset));
+                }
+            }
+        }
+    }
+
+    return hash;
+}
+
+// Would drawing this pass now produce anything different from the last time?
+bool vulkan_pass_inputs_changed(VulkanContext& ctx, VulkanPass& vulkanPass)
+{
+    PROFILE_SCOPE(pass_fingerprint);
+
+    auto& pass = vulkanPass.pass;
+    auto& frameData = vulkan_pass_frame_data(ctx, vulkanPass);
+
+    // We can't see what a script does
+    if (pass.passType == PassType::Scripted)
+    {
+        return true;
+    }
+
+    // Feedback; the pass reads what it wrote last time
+    for (auto& passSampler : pass.samplers)
+    {
+        if (std::find(pass.targets.begin(), pass.targets.end(), passSampler.sampler) != pass.targets.end())
+        {
+            return true;
+        }
+    }
+
+    // This frame data hasn't been used yet
+    if (!frameData.builtDescriptors || !frameData.pipeline)
+    {
+        return true;
+    }
+
+    // The uniforms a draw would use, without writing them
+    glm::uvec2 size = glm::uvec2(0);
+    if (!pass.targets.empty())
+    {
+        auto pVulkanSurface = vulkan_scene_get_or_create_surface(vulkanPass.vulkanScene, pass.targets[0]);
+        if (pVulkanSurface)
+        {
+            size = vulkan_pass_target_size(ctx, vulkanPass.vulkanScene, *pVulkanSurface->pSurface);
+        }
+    }
+
+    auto ubo = frameData.vsUBO;
+    vulkan_pass_fill_uniforms(vulkanPass, ubo, size);
+
+    return vulkan_pass_fingerprint(ctx, vulkanPass, frameData, ubo) != vulkanPass.fingerprint;
 }
 
 bool vulkan_pass_draw(VulkanContext& ctx, VulkanPass& vulkanPass)
@@ -1240,6 +1544,11 @@ bool vulkan_pass_draw(VulkanContext& ctx, VulkanPass& vulkanPass)
     passFrameData.debugName = fmt::format("{}:I{}", vulkanPass.pass.name, ctx.mainWindowData.frameIndex);
     passTargets.pFrameData = &passFrameData;
 
+    vulkanPass.drawn = true;
+    vulkanPass.skipped = false;
+    vulkanPass.lastDrawFrame = Scene::GlobalFrameCount;
+    vulkanPass.drawnFrames++;
+
     LOG_SCOPE(DBG, "Pass Draw: " << passFrameData.debugName << " Global Frame: " << Scene::GlobalFrameCount);
 
     // Wait for the fence the last time we drew with this pass information
@@ -1271,6 +1580,9 @@ bool vulkan_pass_draw(VulkanContext& ctx, VulkanPass& vulkanPass)
         }
     }
 
+    // Remember what this draw read, so we can tell when drawing again would make no difference
+    vulkanPass.fingerprint = vulkan_pass_fingerprint(ctx, vulkanPass, passFrameData, passFrameData.vsUBO);
+
     // Validation layer may set an error, meaning this scene is not valid!
     // audio_destroy it, and reset the error trigger
     if (validation_get_error_state() || !scene.valid)
@@ -1301,4 +1613,115 @@ bool vulkan_pass_draw(VulkanContext& ctx, VulkanPass& vulkanPass)
     return true;
 }
 
+// Passes can ask to be updated less often than every frame; when they don't draw, their targets keep the
+// last output for anything that samples them.  Targets always live at ping-pong index 0 (see
+// vulkan_scene_get_or_create_surface), so the held output is the one the other passes read.
+bool vulkan_pass_should_draw(VulkanContext& ctx, VulkanPass& vulkanPass)
+{
+    auto& pass = vulkanPass.pass;
+    auto& vulkanScene = vulkanPass.vulkanScene;
+    auto& scene = *vulkanScene.pScene;
+
+    if (!vulkanPass.drawn || vulkanPass.missingGeometry)
+    {
+        return true;
+    }
+
+    // Targets are changing size, so there is nothing to hold
+    if (scene.outputResizing || (scene.sceneFlags & SceneFlags::DefaultTargetResize))
+    {
+        return true;
+    }
+
+    // Each tile is a different part of the output, so the last one is no use
+    if (scene.renderTile.outputSize != glm::uvec2(0) && vulkan_pass_follows_output(vulkanPass))
+    {
+        return true;
+    }
+
+    // The frame count restarts on a resize
+    if (Scene::GlobalFrameCount < vulkanPass.lastDrawFrame)
+    {
+        return true;
+    }
+
+    bool inputsRendered = false;
+    std::map<VulkanSurface*, uint64_t> generations;
+    auto addSurface = [&](const std::string& name, bool sampling) {
+        auto pVulkanSurface = vulkan_scene_get_or_create_surface(vulkanScene, name, Scene::GlobalFrameCount, sampling);
+        if (!pVulkanSurface || !pVulkanSurface->image)
+        {
+            return false;
+        }
+
+        // Targets that will be reallocated this frame
+        if (pVulkanSurface->pSurface->isTarget && !sampling && vulkan_pass_target_size(ctx, vulkanScene, *pVulkanSurface->pSurface) != pVulkanSurface->pSurface->currentSize)
+        {
+            return false;
+        }
+
+        inputsRendered |= pVulkanSurface->pSurface->rendered;
+        generations[pVulkanSurface] = pVulkanSurface->generation;
+        return true;
+    };
+
+    for (auto& target : pass.targets)
+    {
+        if (!addSurface(target, false))
+        {
+            return true;
+        }
+    }
+
+    for (auto& passSampler : pass.samplers)
+    {
+        // The audio surface changes every frame, and is updated by the pass which draws with it
+        if (passSampler.sampler == "AudioAnalysis" || !addSurface(passSampler.sampler, passSampler.sampleAlternate))
+        {
+            return true;
+        }
+    }
+
+    // Anything reallocated or reloaded since we last drew
+    bool inputsChanged = generations != vulkanPass.inputGenerations;
+    vulkanPass.inputGenerations = generations;
+    if (inputsChanged)
+    {
+        return true;
+    }
+
+    if (pass.updateOnChange && inputsRendered)
+    {
+        return true;
+    }
+
+    if (pass.updateEvery != 1 || pass.updateOnChange)
+    {
+        return pass.updateEvery != 0 && (Scene::GlobalFrameCount - vulkanPass.lastDrawFrame) >= pass.updateEvery;
+    }
+
+    // Passes that update every frame are still skipped when nothing they read has changed
+    return vulkan_pass_inputs_changed(ctx, vulkanPass);
+}
+
+void vulkan_pass_skip(VulkanContext& ctx, VulkanPass& vulkanPass)
+{
+    PROFILE_SCOPE(pass_skip);
+
+    vulkanPass.skipped = true;
+    vulkanPass.skippedFrames++;
+
+    for (auto& target : vulkanPass.pass.targets)
+    {
+        auto pVulkanSurface = vulkan_scene_get_or_create_surface(vulkanPass.vulkanScene, target);
+        if (pVulkanSurface)
+        {
+            pVulkanSurface->heldContents = true;
+        }
+    }
+
+    auto skipRate = (100.0 * vulkanPass.skippedFrames) / double(vulkanPass.skippedFrames + vulkanPass.drawnFrames);
+    LOG(DBG, "Pass Skip: " << vulkanPass.pass.name << " Last Drawn: " << vulkanPass.lastDrawFrame << " Skipped: " << vulkanPass.skippedFrames << " (" << skipRate << "%)");
+}
+
 } // namespace vulkan
@@ -0,0 +1,254 @@
+#include <thread>
+
+#include <fmt/format.h>
+
+#include <zest/logger/logger.h>
+#include <zest/time/profiler.h>
+
+#include "vklive/vulkan/vulkan_context.h"
+#include "vklive/vulkan/vulkan_debug.h"
+#include "vklive/vulkan/vulkan_readback.h"
+
+namespace vulkan
+{
+
+namespace
+{
+
+std::shared_ptr<VulkanReadbackFrame> readback_oldest_in_flight(VulkanReadback& readback)
+{
+    std::shared_ptr<VulkanReadbackFrame> spOldest;
+    for (auto& spFrame : readback.frames)
+    {
+        if (spFrame->inFlight && (!spOldest || spFrame->sequence < spOldest->sequence))
+        {
+            spOldest = spFrame;
+        }
+    }
+    return spOldest;
+}
+
+std::shared_ptr<VulkanReadbackFrame> readback_find_free(VulkanReadback& readback)
+{
+    for (auto& spFrame : readback.frames)
+    {
+        if (!spFrame->inFlight && !spFrame->busy)
+        {
+            return spFrame;
+        }
+    }
+    return nullptr;
+}
+
+void readback_image_barrier(vk::CommandBuffer cmd, vk::Image image, vk::ImageLayout oldLayout, vk::ImageLayout newLayout, vk::AccessFlags srcAccess, vk::AccessFlags dstAccess, vk::PipelineStageFlags srcStage, vk::PipelineStageFlags dstStage)
+{
+    vk::ImageMemoryBarrier barrier;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+    cmd.pipelineBarrier(srcStage, dstStage, {}, nullptr, nullptr, barrier);
+}
+
+std::shared_ptr<VulkanReadbackFrame> readback_add_frame(VulkanContext& ctx, VulkanReadback& readback)
+{
+    auto index = readback.frames.size();
+    auto spFrame = std::make_shared<VulkanReadbackFrame>();
+    spFrame->commandBuffer = ctx.device.allocateCommandBuffers(vk::CommandBufferAllocateInfo(readback.commandPool, vk::CommandBufferLevel::ePrimary, 1))[0];
+    spFrame->fence = ctx.device.createFence(vk::FenceCreateInfo());
+    spFrame->complete = ctx.device.createSemaphore(vk::SemaphoreCreateInfo());
+
+    debug_set_commandbuffer_name(ctx.device, spFrame->commandBuffer, fmt::format("Readback::CommandBuffer:{}", index));
+    debug_set_fence_name(ctx.device, spFrame->fence, fmt::format("Readback::Fence:{}", index));
+    debug_set_semaphore_name(ctx.device, spFrame->complete, fmt::format("Readback::Complete:{}", index));
+
+    readback.frames.push_back(spFrame);
+    return spFrame;
+}
+
+} // namespace
+
+void readback_init(VulkanContext& ctx)
+{
+    ctx.spReadback = std::make_shared<VulkanReadback>();
+    auto& readback = *ctx.spReadback;
+
+    readback.commandPool = ctx.device.createCommandPool(vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer, ctx.graphicsQueue));
+    debug_set_commandpool_name(ctx.device, readback.commandPool, "Readback::CommandPool");
+
+    for (uint32_t i = 0; i < ReadbackFrameCount; i++)
+    {
+        readback_add_frame(ctx, readback);
+    }
+}
+
+void readback_destroy(VulkanContext& ctx)
+{
+    if (!ctx.spReadback)
+    {
+        return;
+    }
+
+    auto& readback = *ctx.spReadback;
+    for (auto& spFrame : readback.frames)
+    {
+        if (spFrame->inFlight)
+        {
+            auto res = ctx.device.waitForFences(spFrame->fence, VK_TRUE, UINT64_MAX);
+            (void)res;
+            spFrame->inFlight = false;
+        }
+
+        // The consumer may still be reading the mapped memory
+        while (spFrame->busy)
+        {
+            std::this_thread::yield();
+        }
+
+        vulkan_buffer_destroy(ctx, spFrame->buffer);
+        ctx.device.destroyFence(spFrame->fence);
+        ctx.device.destroySemaphore(spFrame->complete);
+    }
+
+    ctx.device.destroyCommandPool(readback.commandPool);
+    ctx.spReadback.reset();
+}
+
+void readback_collect(VulkanContext& ctx, bool wait, const fnReadbackReady& fnReady)
+{
+    if (!ctx.spReadback)
+    {
+        return;
+    }
+
+    // Oldest first, so the consumer sees frames in the order they were captured
+    while (auto spFrame = readback_oldest_in_flight(*ctx.spReadback))
+    {
+        if (wait)
+        {
+            PROFILE_SCOPE(readback_wait);
+            auto res = ctx.device.waitForFences(spFrame->fence, VK_TRUE, UINT64_MAX);
+            (void)res;
+        }
+        else if (ctx.device.getFenceStatus(spFrame->fence) != vk::Result::eSuccess)
+        {
+            break;
+        }
+
+        spFrame->inFlight = false;
+        spFrame->busy = true;
+        fnReady(spFrame);
+    }
+}
+
+void readback_release(VulkanReadbackFrame& frame)
+{
+    frame.busy = false;
+}
+
+vk::Semaphore readback_capture(VulkanContext& ctx, const VulkanReadbackRequest& request, const fnReadbackReady& fnReady)
+{
+    PROFILE_SCOPE(readback_capture);
+
+    if (!ctx.spReadback || request.size.x == 0 || request.size.y == 0)
+    {
+        return nullptr;
+    }
+
+    auto& readback = *ctx.spReadback;
+
+    readback_collect(ctx, false, fnReady);
+
+    // Back pressure: if the consumer can't keep up, wait for the oldest slot to come back
+    auto spFrame = readback_find_free(readback);
+    if (!spFrame && readback.frames.size() < ReadbackMaxFrameCount)
+    {
+        spFrame = readback_add_frame(ctx, readback);
+    }
+    while (!spFrame)
+    {
+        PROFILE_SCOPE(readback_stall);
+        if (auto spOldest = readback_oldest_in_flight(readback))
+        {
+            auto res = ctx.device.waitForFences(spOldest->fence, VK_TRUE, UINT64_MAX);
+            (void)res;
+            readback_collect(ctx, false, fnReady);
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        spFrame = readback_find_free(readback);
+    }
+
+    auto& frame = *spFrame;
+    frame.size = request.size;
+    frame.rowPitch = request.size.x * request.bytesPerPixel;
+    frame.frame = request.frame;
+    frame.sequence = readback.nextSequence++;
+    frame.bgra = request.bgra;
+    frame.format = request.format;
+    frame.label = request.label;
+
+    // Slots only grow; the memory stays mapped for the life of the slot
+    vk::DeviceSize bytes = vk::DeviceSize(frame.rowPitch) * frame.size.y;
+    if (frame.buffer.size < bytes)
+    {
+        vulkan_buffer_destroy(ctx, frame.buffer);
+        frame.buffer = buffer_create(ctx, vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, bytes);
+        frame.pData = buffer_map<uint8_t>(ctx, frame.buffer);
+        debug_set_buffer_name(ctx.device, frame.buffer.buffer, "Readback::Buffer");
+        LOG(DBG, "Readback buffer: " << bytes);
+    }
+
+    auto cmd = frame.commandBuffer;
+    cmd.reset();
+    cmd.begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+    debug_begin_region(cmd, "Readback", glm::vec4(0.5f, 1.0f, 0.5f, 1.0f));
+
+    // Whatever wrote the image was earlier on this queue, or is covered by the wait semaphore
+    readback_image_barrier(cmd, request.image, request.layout, vk::ImageLayout::eTransferSrcOptimal, vk::AccessFlagBits::eMemoryWrite, vk::AccessFlagBits::eTransferRead, vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eTransfer);
+
+    vk::BufferImageCopy region(0, 0, 0,
+        vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
+        vk::Offset3D(request.origin.x, request.origin.y, 0),
+        vk::Extent3D(request.size.x, request.size.y, 1));
+    cmd.copyImageToBuffer(request.image, vk::ImageLayout::eTransferSrcOptimal, frame.buffer.buffer, region);
+
+    readback_image_barrier(cmd, request.image, vk::ImageLayout::eTransferSrcOptimal, request.layout, vk::AccessFlagBits::eTransferRead, vk::AccessFlagBits::eMemoryRead, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands);
+
+    // Make the copy visible to the host once the fence has been seen
+    vk::MemoryBarrier hostBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead);
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, {}, hostBarrier, nullptr, nullptr);
+
+    debug_end_region(cmd);
+    cmd.end();
+
+    vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eTransfer;
+    vk::SubmitInfo submitInfo;
+    if (request.waitSemaphore)
+    {
+        submitInfo.setWaitSemaphores(request.waitSemaphore);
+        submitInfo.setWaitDstStageMask(waitStage);
+    }
+    submitInfo.setCommandBuffers(cmd);
+    if (request.signal)
+    {
+        submitInfo.setSignalSemaphores(frame.complete);
+    }
+
+    ctx.device.resetFences(frame.fence);
+    {
+        std::lock_guard<std::mutex> queueLock(ctx.queueMutex);
+        context_get_queue(ctx).submit(submitInfo, frame.fence);
+    }
+    frame.inFlight = true;
+
+    return request.signal ? frame.complete : nullptr;
+}
+
+} // namespace vulkan
@@ -6,13 +6,23 @@
 // #define STB_IMAGE_WRITE_IMPLEMENTATION
 // #include <stb_image_write.h>
 
+#include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
 
 #include "config_app.h"
+#include "vklive/image_exr.h"
+#include "vklive/image_png.h"
+#include "vklive/pixel_convert.h"
+#include "vklive/process/process.h"
 #include "vklive/vulkan/vulkan_command.h"
 #include "vklive/vulkan/vulkan_framebuffer.h"
 #include "vklive/vulkan/vulkan_model.h"
 #include "vklive/vulkan/vulkan_pipeline.h"
+#include "vklive/vulkan/vulkan_readback.h"
 #include "vklive/vulkan/vulkan_render.h"
 #include "vklive/vulkan/vulkan_scene.h"
 #include "vklive/vulkan/vulkan_shader.h"
@@ -28,8 +38,6 @@ namespace vulkan
 namespace
 {
 
-TPool threadPool;
-
 // Vertex layout for this example
 VertexLayout g_vertexLayout{ {
     Component::VERTEX_COMPONENT_POSITION,
@@ -38,6 +46,380 @@ VertexLayout g_vertexLayout{ {
     Component::VERTEX_COMPONENT_NORMAL,
 } };
 
+// A frame that has been encoded, waiting for the ones before it to be written
+struct EncodedFrame
+{
+    fs::path fileName;
+    std::vector<unsigned char> data;
+
+    // Video frames aren't copied; the writer streams the readback slot and releases it
+    std::shared_ptr<VulkanReadbackFrame> spRaw;
+};
+
+// Recorded frames are converted and encoded in parallel, then written in the order they were captured.
+// Only a bounded number can be outstanding; past that the recording waits for the encoder to catch up
+struct FrameEncoder
+{
+    std::unique_ptr<TPool> spPool;
+    uint32_t threads = 0;
+
+    std::mutex mutex;
+    std::condition_variable written;
+    uint32_t pending = 0; // Enqueued and not yet written
+    uint64_t nextSequence = 0;
+    uint64_t nextWrite = 0;
+    bool writing = false; // One worker writes at a time, so the output stays in order
+    std::map<uint64_t, EncodedFrame> encoded;
+
+    // Video output; raw frames are piped in order to the encoder's stdin
+    std::shared_ptr<ProcessPipe> spPipe;
+    glm::uvec2 pipeSize = glm::uvec2(0);
+    fs::path videoPath;
+    bool pipeFailed = false;
+
+    // Throughput for the current recording
+    bool active = false;
+    uint64_t reportedSequence = 0;
+    uint64_t framesWritten = 0;
+    uint64_t targetsWritten = 0;
+    uint64_t bytesWritten = 0;
+    std::set<std::string> skippedTargets;
+    double encodeMilliseconds = 0.0;
+    double stallMilliseconds = 0.0;
+    std::chrono::steady_clock::time_point startTime;
+};
+FrameEncoder encoder;
+
+void encoder_report(const char* pszLabel)
+{
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - encoder.startTime).count();
+    auto frames = std::max(encoder.framesWritten, uint64_t(1));
+    LOG(INFO, fmt::format("{}: {} frames, {} targets, {:.1f} fps written, {:.1f}ms avg encode on {} threads, {:.1f}MB, {:.0f}ms stalled",
+        pszLabel,
+        encoder.framesWritten,
+        encoder.targetsWritten,
+        encoder.framesWritten / std::max(seconds, 0.001),
+        encoder.encodeMilliseconds / frames,
+        encoder.threads,
+        encoder.bytesWritten / (1024.0 * 1024.0),
+        encoder.stallMilliseconds));
+}
+
+// Launch the video encoder, reading raw frames of a fixed size from stdin
+void encoder_start_video(const RecordSettings& settings, const glm::uvec2& size, bool bgra, const fs::path& path)
+{
+    encoder.videoPath = path / fmt::format("Recording.{}", settings.container);
+
+    std::vector<std::string> args = {
+        settings.encoder,
+        "-y",
+        "-loglevel", "error",
+        "-f", "rawvideo",
+        "-pix_fmt", bgra ? "bgra" : "rgba",
+        "-s", fmt::format("{}x{}", size.x, size.y),
+        "-framerate", std::to_string(settings.fps),
+        "-i", "-",
+        "-vf", "pad=ceil(iw/2)*2:ceil(ih/2)*2", // Most pixel formats need even sizes
+        "-c:v", settings.codec,
+        "-crf", std::to_string(settings.crf),
+        "-pix_fmt", settings.pixelFormat,
+        encoder.videoPath.string()
+    };
+
+    std::error_code ec;
+    encoder.spPipe = process_pipe_start(args, ec);
+    if (!encoder.spPipe)
+    {
+        LOG(INFO, "Couldn't launch video encoder '" << settings.encoder << "' (" << ec.message() << "); recording PNGs instead");
+        return;
+    }
+
+    encoder.pipeSize = size;
+    encoder.pipeFailed = false;
+    LOG(INFO, "Recording video: " << encoder.videoPath.string());
+}
+
+// Begin a recording; the pool is only rebuilt here, when nothing is in flight
+void encoder_start(const RecordSettings& settings, const glm::uvec2& size, bool bgra, const fs::path& path)
+{
+    auto threads = settings.encodeThreads;
+    if (threads == 0)
+    {
+        threads = std::max(std::thread::hardware_concurrency(), 3u) - 1;
+    }
+
+    if (!encoder.spPool || encoder.threads != threads)
+    {
+        encoder.spPool.reset();
+        encoder.spPool = std::make_unique<TPool>(threads);
+        encoder.threads = threads;
+        LOG(DBG, "Frame encoder: " << threads << " threads, " << pixel_convert_backend() << " pixel conversion");
+    }
+
+    encoder.nextSequence = encoder.nextWrite = encoder.reportedSequence = 0;
+    encoder.framesWritten = 0;
+    encoder.targetsWritten = 0;
+    encoder.bytesWritten = 0;
+    encoder.skippedTargets.clear();
+    encoder.encodeMilliseconds = 0.0;
+    encoder.stallMilliseconds = 0.0;
+    encoder.startTime = std::chrono::steady_clock::now();
+    encoder.active = true;
+
+    if (settings.video)
+    {
+        encoder_start_video(settings, size, bgra, path);
+    }
+}
+
+// Write whatever is next in sequence; a worker already writing picks up frames finished meanwhile
+void encoder_write_ready()
+{
+    std::unique_lock<std::mutex> lock(encoder.mutex);
+    if (encoder.writing)
+    {
+        return;
+    }
+
+    encoder.writing = true;
+    while (!encoder.encoded.empty() && encoder.encoded.begin()->first == encoder.nextWrite)
+    {
+        auto frame = std::move(encoder.encoded.begin()->second);
+        encoder.encoded.erase(encoder.encoded.begin());
+
+        lock.unlock();
+        size_t bytes = frame.data.size();
+        if (frame.spRaw)
+        {
+            PROFILE_SCOPE(write_video_frame);
+            bytes = size_t(frame.spRaw->rowPitch) * frame.spRaw->size.y;
+            if (!encoder.pipeFailed && process_pipe_write(*encoder.spPipe, frame.spRaw->pData, bytes))
+            {
+                encoder.pipeFailed = true;
+            }
+            readback_release(*frame.spRaw);
+        }
+        else
+        {
+            PROFILE_SCOPE(write_frame);
+            lodepng::save_file(frame.data, frame.fileName.string());
+        }
+        lock.lock();
+
+        encoder.nextWrite++;
+        encoder.pending--;
+        encoder.framesWritten++;
+        encoder.bytesWritten += bytes;
+        encoder.written.notify_all();
+    }
+    encoder.writing = false;
+}
+
+// Back pressure: wait for the writer rather than queue without limit
+void encoder_reserve(std::unique_lock<std::mutex>& lock, const RecordSettings& settings)
+{
+    if (encoder.pending >= settings.maxPendingFrames)
+    {
+        PROFILE_SCOPE(record_stall);
+        auto stallStart = std::chrono::steady_clock::now();
+        encoder.written.wait(lock, [&]() { return encoder.pending < settings.maxPendingFrames; });
+        encoder.stallMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - stallStart).count();
+    }
+    encoder.pending++;
+}
+
+// Convert and encode on a worker, reading straight from the mapped readback slot
+void render_encode_frame(std::shared_ptr<VulkanReadbackFrame> spFrame, const RecordSettings& settings, const fs::path& path)
+{
+    // The video stream can't change size part way through
+    if (encoder.spPipe && spFrame->size != encoder.pipeSize)
+    {
+        LOG(DBG, "Dropped recorded frame " << spFrame->frame << ", size doesn't match the video");
+        readback_release(*spFrame);
+        return;
+    }
+
+    uint64_t sequence;
+    {
+        std::unique_lock<std::mutex> lock(encoder.mutex);
+        encoder_reserve(lock, settings);
+        sequence = encoder.nextSequence++;
+    }
+
+    if (encoder.spPipe)
+    {
+        encoder.spPool->enqueue([spFrame, sequence]() {
+            {
+                std::lock_guard<std::mutex> lock(encoder.mutex);
+                encoder.encoded[sequence].spRaw = spFrame;
+            }
+            encoder_write_ready();
+        });
+        return;
+    }
+
+    // The frame number was taken at capture, so it can't race with the scene moving on
+    auto fileName = path / fmt::format("Frame_{:05}.png", spFrame->frame);
+
+    encoder.spPool->enqueue([spFrame, sequence, fileName]() {
+        PROFILE_SCOPE(write_png_thread)
+        auto encodeStart = std::chrono::steady_clock::now();
+
+        // Reused across frames on each worker
+        thread_local std::vector<uint8_t> image;
+
+        auto sz = spFrame->size;
+        image.resize(sz.x * sz.y * 3);
+
+        {
+            PROFILE_SCOPE(convert_pixels);
+            if (spFrame->rowPitch == sz.x * 4)
+            {
+                pixel_drop_alpha(spFrame->pData, image.data(), size_t(sz.x) * sz.y, spFrame->bgra);
+            }
+            else
+            {
+                for (uint32_t y = 0; y < sz.y; y++)
+                {
+                    pixel_drop_alpha(spFrame->pData + spFrame->rowPitch * y, image.data() + sz.x * 3 * y, sz.x, spFrame->bgra);
+                }
+            }
+        }
+        readback_release(*spFrame);
+
+        EncodedFrame frame;
+        frame.fileName = fileName;
+        lodepng::encode(frame.data, image.data(), sz.x, sz.y, LCT_RGB);
+
+        {
+            std::lock_guard<std::mutex> lock(encoder.mutex);
+            encoder.encodeMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - encodeStart).count();
+            encoder.encoded[sequence] = std::move(frame);
+        }
+        encoder_write_ready();
+    });
+}
+
+// Float targets go out as EXR at full precision. Each is its own file, so they skip the ordered writer
+void render_export_target(std::shared_ptr<VulkanReadbackFrame> spFrame, const RecordSettings& settings, const fs::path& path)
+{
+    {
+        std::unique_lock<std::mutex> lock(encoder.mutex);
+        encoder_reserve(lock, settings);
+    }
+
+    auto fileName = path / fmt::format("{}_{:05}.exr", spFrame->label, spFrame->frame);
+
+    encoder.spPool->enqueue([spFrame, fileName]() {
+        PROFILE_SCOPE(write_exr_thread)
+
+        // Reused across frames on each worker
+        thread_local std::vector<uint8_t> data;
+        exr_encode_rgba(data, spFrame->pData, spFrame->size.x, spFrame->size.y, spFrame->rowPitch, spFrame->format == vk::Format::eR16G16B16A16Sfloat);
+        readback_release(*spFrame);
+
+        {
+            PROFILE_SCOPE(write_exr);
+            std::ofstream file(fileName, std::ios::binary);
+            file.write((const char*)data.data(), data.size());
+        }
+
+        std::lock_guard<std::mutex> lock(encoder.mutex);
+        encoder.pending--;
+        encoder.targetsWritten++;
+        encoder.bytesWritten += data.size();
+        encoder.written.notify_all();
+    });
+}
+
+void render_frame_ready(std::shared_ptr<VulkanReadbackFrame> spFrame, const RecordSettings& settings, const fs::path& path)
+{
+    if (spFrame->label.empty())
+    {
+        render_encode_frame(spFrame, settings, path);
+    }
+    else
+    {
+        render_export_target(spFrame, settings, path);
+    }
+}
+
+// Queue copies of the float targets the project asked for
+void render_capture_targets(VulkanContext& ctx, Scene& scene, const fs::path& path)
+{
+    auto pVulkanScene = vulkan_scene_get(ctx, scene);
+    if (!pVulkanScene)
+    {
+        return;
+    }
+
+    for (auto& name : scene.recordSettings.exportTargets)
+    {
+        auto itrSurface = pVulkanScene->surfaces.find(SurfaceKey(name, 0));
+        if (itrSurface == pVulkanScene->surfaces.end() || !itrSurface->second->image || itrSurface->second->drawCount == 0)
+        {
+            if (encoder.skippedTargets.insert(name).second)
+            {
+                LOG(INFO, "Record target not found, or not drawn: " << name);
+            }
+            continue;
+        }
+
+        auto& surface = *itrSurface->second;
+        uint32_t bytesPerPixel = 0;
+        switch (surface.format)
+        {
+        case vk::Format::eR16G16B16A16Sfloat:
+            bytesPerPixel = 8;
+            break;
+        case vk::Format::eR32G32B32A32Sfloat:
+            bytesPerPixel = 16;
+            break;
+        default:
+            if (encoder.skippedTargets.insert(name).second)
+            {
+                LOG(INFO, "Record target isn't rgba16f/rgba32f, skipping: " << name);
+            }
+            continue;
+        }
+
+        VulkanReadbackRequest request;
+        request.image = surface.image;
+        request.layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        request.format = surface.format;
+        request.bytesPerPixel = bytesPerPixel;
+        request.size = glm::uvec2(surface.pSurface->currentSize);
+        request.frame = scene.GlobalFrameCount;
+        request.label = name;
+        request.signal = false;
+
+        readback_capture(ctx, request, [&](std::shared_ptr<VulkanReadbackFrame> spFrame) {
+            render_frame_ready(spFrame, scene.recordSettings, path);
+        });
+    }
+}
+
+// Capture the output, and any targets asked for, starting the encoder on the first frame
+vk::Semaphore render_record_frame(VulkanContext& ctx, Scene& scene, const VulkanReadbackRequest& request, const fs::path& path)
+{
+    if (!encoder.active)
+    {
+        encoder_start(scene.recordSettings, request.size, request.bgra, path);
+    }
+    else if (encoder.nextSequence >= encoder.reportedSequence + 120)
+    {
+        std::lock_guard<std::mutex> lock(encoder.mutex);
+        encoder_report("Recording");
+        encoder.reportedSequence = encoder.nextSequence;
+    }
+
+    render_capture_targets(ctx, scene, path);
+
+    return readback_capture(ctx, request, [&](std::shared_ptr<VulkanReadbackFrame> spFrame) {
+        render_frame_ready(spFrame, scene.recordSettings, path);
+    });
+}
+
 } // namespace
 
 void render_init(VulkanContext& ctx)
@@ -102,6 +484,17 @@ RenderOutput render_get_output(VulkanContext& ctx, Scene& scene)
     if (pVulkanSurface)
     {
         out.pSurface = pVulkanSurface->pSurface;
+        if (pVulkanSurface->extent.width != 0 && pVulkanSurface->extent.height != 0)
+        {
+            out.uvMax = glm::vec2(out.pSurface->currentSize) / glm::vec2(pVulkanSurface->extent.width, pVulkanSurface->extent.height);
+        }
+
+        // Outputs that follow the window size are stretched back up to it when dynamic resolution has scaled them down
+        out.displaySize = glm::vec2(out.pSurface->currentSize);
+        if (out.pSurface->size == glm::uvec2(0))
+        {
+            out.displaySize /= scene.dynamicResolution.scale;
+        }
         if (pVulkanSurface->ImGuiDescriptorSet)
         {
             out.textureId = (ImTextureID)pVulkanSurface->ImGuiDescriptorSet;
@@ -116,105 +509,197 @@ void render_write_output(VulkanContext& ctx, Scene& scene, const fs::path& path)
     PROFILE_SCOPE(render_write_output);
 
     auto pSwapSurface = main_window_current_swap_image(ctx);
+    if (!pSwapSurface)
+    {
+        return;
+    }
+
+    auto& wnd = ctx.mainWindowData;
 
-    auto pDefaultTargetSurface = get_default_target(ctx, scene);
-    if (pSwapSurface && pDefaultTargetSurface && pDefaultTargetSurface->uploadMemory)
+    VulkanReadbackRequest request;
+    request.image = pSwapSurface->image;
+    request.origin = glm::uvec2(scene.targetViewport.x, scene.targetViewport.y);
+    request.size = glm::uvec2(scene.targetViewport.z - scene.targetViewport.x, scene.targetViewport.w - scene.targetViewport.y);
+    request.frame = scene.GlobalFrameCount;
+    request.waitSemaphore = wnd.frameSemaphores[wnd.semaphoreIndex].renderCompleteSemaphore;
+
+    // The copy is raw, so BGR swap chains need swizzling on the way out (destination is always RGB)
+    // Note: Not complete, only contains most common and basic BGR surface formats
+    std::vector<vk::Format> formatsBGR = { vk::Format::eB8G8R8A8Srgb, vk::Format::eB8G8R8A8Unorm, vk::Format::eB8G8R8A8Snorm };
+    request.bgra = std::find(formatsBGR.begin(), formatsBGR.end(), wnd.surfaceFormat.format) != formatsBGR.end();
+
+    // The present now waits on the copy instead of the render
+    auto copied = render_record_frame(ctx, scene, request, path);
+    if (copied)
     {
-        ctx.device.waitIdle();
+        wnd.presentWaitSemaphore = copied;
+    }
+}
 
-        glm::uvec2 origin = glm::uvec2(scene.targetViewport.x, scene.targetViewport.y);
-        auto sz = glm::uvec2(scene.targetViewport.z - scene.targetViewport.x, scene.targetViewport.w - scene.targetViewport.y);
-        // auto sz = pDefaultTargetSurface->pSurface->currentSize;
-        {
-            PROFILE_SCOPE(image_upload);
-            utils_with_command_buffer(ctx, [&](vk::CommandBuffer copyCmd) {
-                debug_set_commandbuffer_name(ctx.device, copyCmd, "Buffer::ImageUpload");
+void render_write_target(VulkanContext& ctx, Scene& scene, const fs::path& path)
+{
+    PROFILE_SCOPE(render_write_target);
 
-                surface_set_layout(ctx, copyCmd, *pSwapSurface, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferSrcOptimal);
-                surface_set_layout(ctx, copyCmd, *pDefaultTargetSurface, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, VulkanSurfaceLayoutFlags::UploadImage);
-                if (pDefaultTargetSurface->isBlitUpload)
-                {
-                    vk::ImageBlit blitRegion(
-                        vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
-                        { vk::Offset3D(scene.targetViewport.x, scene.targetViewport.y, 0), vk::Offset3D(sz.x, sz.y, 1) },
-                        vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
-                        { vk::Offset3D(0, 0, 0), vk::Offset3D(sz.x, sz.y, 1) });
+    auto pVulkanSurface = get_default_target(ctx, scene);
+    if (!pVulkanSurface || !pVulkanSurface->image)
+    {
+        return;
+    }
 
-                    copyCmd.blitImage(pSwapSurface->image, vk::ImageLayout::eTransferSrcOptimal, pDefaultTargetSurface->uploadImage, vk::ImageLayout::eTransferDstOptimal, blitRegion, vk::Filter::eNearest);
-                }
-                else
-                {
-                    vk::ImageCopy copyRegion(
-                        vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
-                        vk::Offset3D(scene.targetViewport.x, scene.targetViewport.y, 0),
-                        vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
-                        vk::Offset3D(0, 0, 0),
-                        { sz.x, sz.y, 1 });
-                    copyCmd.copyImage(pSwapSurface->image, vk::ImageLayout::eTransferSrcOptimal, pDefaultTargetSurface->uploadImage, vk::ImageLayout::eTransferDstOptimal, copyRegion);
-                }
-                surface_set_layout(ctx, copyCmd, *pSwapSurface, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eUndefined, vk::ImageLayout::ePresentSrcKHR);
-            });
+    // The encoder takes 8 bit RGBA
+    if (pVulkanSurface->format != vk::Format::eR8G8B8A8Unorm)
+    {
+        if (encoder.skippedTargets.insert(pVulkanSurface->pSurface->name).second)
+        {
+            LOG(ERR, "Default target isn't rgba8, can't record it: " << pVulkanSurface->pSurface->name);
         }
+        return;
+    }
 
-        ctx.device.waitIdle();
+    // Already in the queue after the passes that drew it, and left readable by them
+    VulkanReadbackRequest request;
+    request.image = pVulkanSurface->image;
+    request.layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    request.format = pVulkanSurface->format;
+    request.size = glm::uvec2(pVulkanSurface->pSurface->currentSize);
+    request.frame = scene.GlobalFrameCount;
+    request.signal = false;
 
-        VkImageSubresource subResource{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 0 };
-        VkSubresourceLayout subResourceLayout;
-        vkGetImageSubresourceLayout(ctx.device, pDefaultTargetSurface->uploadImage, &subResource, &subResourceLayout);
+    render_record_frame(ctx, scene, request, path);
+}
+
+void render_flush_output(VulkanContext& ctx, Scene& scene, const fs::path& path)
+{
+    if (!encoder.active)
+    {
+        return;
+    }
 
-        char* pMem = (char*)ctx.device.mapMemory(pDefaultTargetSurface->uploadMemory, 0, VK_WHOLE_SIZE);
-        pMem += subResourceLayout.offset;
+    PROFILE_SCOPE(render_flush_output);
+    readback_collect(ctx, true, [&](std::shared_ptr<VulkanReadbackFrame> spFrame) {
+        render_frame_ready(spFrame, scene.recordSettings, path);
+    });
 
-        // If source is BGR (destination is always RGB) and we can't use blit (which does automatic conversion), we'll have to manually swizzle color components
-        bool colorSwizzle = true;
+    std::unique_lock<std::mutex> lock(encoder.mutex);
+    encoder.written.wait(lock, [&]() { return encoder.pending == 0; });
+    encoder_report("Recorded");
+    encoder.active = false;
 
-        // Check if source is BGR
-        // Note: Not complete, only contains most common and basic BGR surface formats for demonstration purposes
-        if (!pDefaultTargetSurface->isBlitUpload)
+    if (encoder.spPipe)
+    {
+        PROFILE_SCOPE(finish_video);
+        if (process_pipe_finish(*encoder.spPipe) == 0 && !encoder.pipeFailed)
         {
-            std::vector<vk::Format> formatsBGR = { vk::Format::eB8G8R8A8Srgb, vk::Format::eB8G8R8A8Unorm, vk::Format::eB8G8R8A8Snorm };
-            colorSwizzle = !(std::find(formatsBGR.begin(), formatsBGR.end(), (vk::Format)pDefaultTargetSurface->format) != formatsBGR.end());
+            LOG(INFO, "Recorded video: " << encoder.videoPath.string());
         }
+        encoder.spPipe.reset();
+    }
+}
+
+bool render_tiled(VulkanContext& ctx, Scene& scene, const glm::uvec2& outputSize, const glm::uvec2& tileSize, const fs::path& fileName)
+{
+    PROFILE_SCOPE(render_tiled);
+
+    // Tiles step the frame data along as if each were a frame, which would upset a swap chain
+    if (!ctx.headless)
+    {
+        LOG(ERR, "Tiled rendering is only available headless");
+        return false;
+    }
+
+    auto maxDimension = ctx.physicalDevice.getProperties().limits.maxImageDimension2D;
+    if (tileSize.x == 0 || tileSize.y == 0 || tileSize.x > maxDimension || tileSize.y > maxDimension)
+    {
+        LOG(ERR, "Tile size must be between 1 and " << maxDimension);
+        return false;
+    }
+
+    // A fixed size output doesn't follow the tile size, so can't be split up
+    auto itrDefault = scene.surfaces.find("default_color");
+    if (itrDefault == scene.surfaces.end() || itrDefault->second->size != glm::uvec2(0))
+    {
+        LOG(ERR, "Tiled rendering needs the default target to follow the output size");
+        return false;
+    }
+
+    PngStream png;
+    if (!png_stream_begin(png, fileName, outputSize.x, outputSize.y))
+    {
+        return false;
+    }
+
+    // One row of tiles across the whole output; written out, then reused for the next row
+    std::vector<uint8_t> band(size_t(outputSize.x) * tileSize.y * 3);
+    const size_t bandPitch = size_t(outputSize.x) * 3;
 
-        auto pSrc = (char*)malloc(subResourceLayout.rowPitch * sz.y);
-        memcpy(pSrc, pMem, subResourceLayout.rowPitch * sz.y);
+    // Tiles come back from the readback in the order they were captured
+    std::deque<uint32_t> tileColumns;
+    auto fnTileReady = [&](std::shared_ptr<VulkanReadbackFrame> spFrame) {
+        auto x = tileColumns.front();
+        tileColumns.pop_front();
+
+        PROFILE_SCOPE(stitch_tile);
+        for (uint32_t y = 0; y < spFrame->size.y; y++)
+        {
+            pixel_drop_alpha(spFrame->pData + spFrame->rowPitch * y, band.data() + bandPitch * y + size_t(x) * 3, spFrame->size.x, spFrame->bgra);
+        }
+        readback_release(*spFrame);
+    };
 
-        ctx.device.unmapMemory(pDefaultTargetSurface->uploadMemory);
+    auto tiles = (outputSize + tileSize - glm::uvec2(1)) / tileSize;
+    auto frame = Scene::GlobalFrameCount;
+    bool success = true;
+    for (uint32_t row = 0; row < tiles.y && success; row++)
+    {
+        auto bandRows = std::min(tileSize.y, outputSize.y - row * tileSize.y);
+        for (uint32_t column = 0; column < tiles.x; column++)
+        {
+            scene.renderTile.offset = glm::uvec2(column, row) * tileSize;
+            scene.renderTile.size = tileSize;
+            scene.renderTile.outputSize = outputSize;
 
-        threadPool.enqueue([=]() {
-            PROFILE_SCOPE(write_png_thread)
-            std::vector<char> image;
-            image.resize(sz.x * sz.y * 3);
+            // Every tile is drawn at the same moment; the render steps the frame count
+            Scene::GlobalFrameCount = frame;
+            render(ctx, glm::vec4(0.0f, 0.0f, tileSize.x, tileSize.y), scene);
 
-            // ppm binary pixel data
-            uint32_t index = 0;
-            for (uint32_t y = 0; y < sz.y; y++)
+            auto pVulkanSurface = get_default_target(ctx, scene);
+            if (!scene.valid || !pVulkanSurface || !pVulkanSurface->image || pVulkanSurface->format != vk::Format::eR8G8B8A8Unorm)
             {
-                uint32_t* row = (uint32_t*)(pSrc + (subResourceLayout.rowPitch * y));
-                for (uint32_t x = 0; x < sz.x; x++)
-                {
-                    if (colorSwizzle)
-                    {
-                        image[index++] = *((char*)row + 2);
-                        image[index++] = *((char*)row + 1);
-                        image[index++] = *((char*)row);
-                    }
-                    else
-                    {
-                        image[index++] = *((char*)row);
-                        image[index++] = *((char*)row + 1);
-                        image[index++] = *((char*)row + 2);
-                    }
-                    row++;
-                }
+                LOG(ERR, "Tile " << column << ", " << row << " wasn't drawn, or the default target isn't rgba8");
+                success = false;
+                break;
             }
 
-            auto fileName = path / fmt::format("Frame_{:05}.png", scene.GlobalFrameCount);
-            lodepng::encode(fileName.string(), (const unsigned char*)image.data(), sz.x, sz.y, LCT_RGB);
+            // Edge tiles are drawn whole, but only the part inside the output is kept
+            VulkanReadbackRequest request;
+            request.image = pVulkanSurface->image;
+            request.layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+            request.format = pVulkanSurface->format;
+            request.size = glm::min(tileSize, outputSize - scene.renderTile.offset);
+            request.frame = uint64_t(row) * tiles.x + column; // The readback hands back in this order
+            request.signal = false;
 
-            free(pSrc);
-        });
+            tileColumns.push_back(scene.renderTile.offset.x);
+            readback_capture(ctx, request, fnTileReady);
+
+            // The next tile draws with the other frame's pass data, so it needn't wait for this one
+            ctx.mainWindowData.frameIndex = (ctx.mainWindowData.frameIndex + 1) % ctx.mainWindowData.imageCount;
+        }
+
+        readback_collect(ctx, true, fnTileReady);
+        if (success)
+        {
+            PROFILE_SCOPE(write_band);
+            success = png_stream_write_rows(png, band.data(), bandRows, bandPitch);
+        }
     }
+
+    scene.renderTile = RenderTile();
+    readback_collect(ctx, true, fnTileReady);
+
+    success = png_stream_end(png) && success;
+    LOG(INFO, "Tiled render: " << fileName.string() << ", " << outputSize.x << "x" << outputSize.y << " in " << tiles.x * tiles.y << " tiles" << (success ? "" : " FAILED"));
+    return success;
 }
 
 } // namespace vulkan
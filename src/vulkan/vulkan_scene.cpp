@@ -9,6 +9,7 @@
 
 #include <zest/file/runtree.h>
 #include <zest/logger/logger.h>
+#include <zest/time/profiler.h>
 #include <zest/time/timer.h>
 
 #include <vklive/validation.h>
@@ -88,11 +89,17 @@ std::shared_ptr<VulkanScene> vulkan_scene_create(VulkanContext& ctx, Scene& scen
     spVulkanScene->generation = VulkanScene::GlobalGeneration++;
 
     // Load Models
+    vulkan_model_cache_set_budget(ctx, uint64_t(scene.modelCacheMB) << 20);
     for (auto& [_, pGeom] : scene.models)
     {
         vulkan_model_create(ctx, *spVulkanScene, *pGeom);
     }
 
+    auto cacheStats = vulkan_model_cache_stats(ctx);
+    LOG(INFO, fmt::format("Model cache: {} models ({} unused), {:.1f}MB CPU, {:.1f}MB GPU; {} hits, {} misses, {} evictions",
+        cacheStats.models, cacheStats.unused, cacheStats.cpuBytes / (1024.0 * 1024.0), cacheStats.gpuBytes / (1024.0 * 1024.0),
+        cacheStats.hits, cacheStats.misses, cacheStats.evictions));
+
     // Load Shaders
     std::vector<vk::PipelineShaderStageCreateInfo> shaderStages;
     for (auto& [_, pShader] : scene.shaders)
@@ -134,10 +141,17 @@ void vulkan_scene_destroy(VulkanContext& ctx, VulkanScene& vulkanScene)
     }
     vulkanScene.passes.clear();
 
-    // Surfaces
+    // Surfaces; targets are kept for the next scene, which will likely want the same ones
     for (auto& [name, pVulkanSurface] : vulkanScene.surfaces)
     {
-        vulkan_surface_destroy(ctx, *pVulkanSurface);
+        if (pVulkanSurface->pSurface && pVulkanSurface->pSurface->isTarget && pVulkanSurface->image && pVulkanSurface->allocationState == VulkanAllocationState::Loaded)
+        {
+            vulkan_surface_pool_release(ctx, pVulkanSurface, vulkanScene.generation);
+        }
+        else
+        {
+            vulkan_surface_destroy(ctx, *pVulkanSurface);
+        }
     }
     vulkanScene.surfaces.clear();
 
@@ -240,8 +254,8 @@ void vulkan_scene_prepare_output_descriptors(VulkanContext& ctx, VulkanScene& vu
     // ones for the current frame, that have been written.  Then we allocate our descriptors
     for (auto& [initKey, pVulkanSurface] : vulkanScene.surfaces)
     {
-        // If the surface has been rendered and has a sampler, it's a potential for display
-        if (!pVulkanSurface->pSurface->rendered)
+        // If the surface has been rendered (or held from an earlier frame) and has a sampler, it's a potential for display
+        if (!pVulkanSurface->pSurface->rendered && !pVulkanSurface->heldContents)
         {
             continue;
         }
@@ -271,10 +285,97 @@ void vulkan_scene_prepare_output_descriptors(VulkanContext& ctx, VulkanScene& vu
                 vulkanScene.viewableTargets.insert(pVulkanSurface->key);
             }
 
-            // Descriptors renewed each frame
-            vulkan_scene_target_set_imgui_descriptor(ctx, vulkanScene, *pVulkanSurface);
+            // Descriptors renewed each frame; there is no UI to show them in when headless
+            if (!ctx.headless)
+            {
+                vulkan_scene_target_set_imgui_descriptor(ctx, vulkanScene, *pVulkanSurface);
+            }
+        }
+    }
+}
+
+namespace
+{
+
+// Profiler marker for a render scale decision, with the numbers behind it.  The profiler keeps hold of the names,
+// so each one lives as long as the app; the numbers are rounded so that repeats share a marker
+const char* render_scale_marker(const char* decision, float scale, double gpuMilliseconds, double budget)
+{
+    static std::unordered_set<std::string> markers;
+    auto marker = fmt::format("render_scale_{}: {:.3f}, GPU {:.1f}ms, Budget {:.1f}ms", decision, scale, gpuMilliseconds, budget);
+    return markers.insert(marker).first->c_str();
+}
+
+} // namespace
+
+// Adjust the render scale to hold the target frame rate.
+// Pixel cost goes with the square of the scale, so we step down in proportion to the overrun, and creep
+// back up when there is plenty of headroom.  Changes reallocate the scaled targets, so they are rate limited.
+void vulkan_scene_update_render_scale(VulkanContext& ctx, VulkanScene& vulkanScene)
+{
+    auto& scene = *vulkanScene.pScene;
+    auto& dynamic = scene.dynamicResolution;
+    if (!dynamic.enabled || ctx.timestampPeriod == 0.0f)
+    {
+        return;
+    }
+
+    const auto ChangeInterval = std::chrono::milliseconds(500);
+    const float ScaleStep = 1.0f / 32.0f;
+
+    // GPU time of the passes the last time this swap index was used
+    double gpuMilliseconds = 0.0;
+    for (auto& pVulkanPass : vulkanScene.passes)
+    {
+        if (!pVulkanPass->skipped)
+        {
+            gpuMilliseconds += vulkan_pass_frame_data(ctx, *pVulkanPass).gpuMilliseconds;
+        }
+    }
+
+    dynamic.gpuMilliseconds = (dynamic.gpuMilliseconds == 0.0) ? gpuMilliseconds : glm::mix(dynamic.gpuMilliseconds, gpuMilliseconds, 0.1);
+
+    auto budget = 1000.0 / dynamic.targetFps;
+    auto scale = dynamic.scale;
+    const char* decision = "hold";
+
+    auto now = std::chrono::steady_clock::now();
+    if ((now - dynamic.lastChangeTime) < ChangeInterval || scene.outputResizing)
+    {
+        decision = "wait";
+    }
+    else
+    {
+        if (dynamic.gpuMilliseconds > budget * 0.95)
+        {
+            scale = float(scale * std::sqrt((budget * 0.85) / dynamic.gpuMilliseconds));
+            scale = std::floor(scale / ScaleStep) * ScaleStep;
+        }
+        else if (dynamic.gpuMilliseconds < budget * 0.6)
+        {
+            scale += ScaleStep;
+        }
+        scale = std::clamp(scale, dynamic.minScale, dynamic.maxScale);
+
+        if (scale != dynamic.scale)
+        {
+            decision = (scale < dynamic.scale) ? "down" : "up";
         }
     }
+
+    // Every frame, so the profiler shows what the controller measured and picked, not just when it changes
+    PROFILE_SCOPE_STR(render_scale_marker(decision, scale, dynamic.gpuMilliseconds, budget), PROFILE_COL_LOCK);
+
+    if (scale != dynamic.scale)
+    {
+        LOG(DBG, "Render Scale: " << dynamic.scale << " -> " << scale << ", GPU: " << dynamic.gpuMilliseconds << "ms, Budget: " << budget << "ms");
+
+        dynamic.scale = scale;
+        dynamic.lastChangeTime = now;
+
+        // Targets are about to be reallocated; let shaders know their history is gone
+        scene.sceneFlags |= SceneFlags::DefaultTargetResize;
+    }
 }
 
 void vulkan_scene_render(VulkanContext& ctx, VulkanScene& vulkanScene)
@@ -288,7 +389,7 @@ void vulkan_scene_render(VulkanContext& ctx, VulkanScene& vulkanScene)
     if (!vulkanScene.pScene->pause)
     {
         Scene::GlobalFrameCount++;
-        Scene::GlobalElapsedSeconds = vulkanScene.pScene->recording ? (vulkanScene.pScene->GlobalFrameCount * (1.0 / 60.0)) : (Zest::timer_get_elapsed_seconds(Zest::globalTimer));
+        Scene::GlobalElapsedSeconds = vulkanScene.pScene->recording ? (vulkanScene.pScene->GlobalFrameCount / double(vulkanScene.pScene->recordSettings.fps)) : (Zest::timer_get_elapsed_seconds(Zest::globalTimer));
     }
     else
     {
@@ -308,20 +409,72 @@ void vulkan_scene_render(VulkanContext& ctx, VulkanScene& vulkanScene)
 
         // Copy the actual vertices to the GPU, if necessary.
         // TODO: Just the pass vertices instead of all
-        for (auto& [_, pVulkanGeom] : vulkanScene.models)
+        std::vector<VulkanModel*> buildAS;
+        for (auto& [path, pVulkanGeom] : vulkanScene.models)
         {
+            // Still importing; passes draw without it for now
+            if (pVulkanGeom->loading)
+            {
+                continue;
+            }
+
+            if (pVulkanGeom->vertexCount == 0)
+            {
+                auto itrGeom = vulkanScene.pScene->models.find(path);
+                if (itrGeom != vulkanScene.pScene->models.end())
+                {
+                    vulkan_model_report_error(vulkanScene, *itrGeom->second, *pVulkanGeom);
+                }
+                vulkan_scene_destroy(ctx, vulkanScene);
+                return;
+            }
+
+            // Data released after an earlier upload is needed again; skipped until it has been read back
+            bool needAS = pVulkanGeom->createInfo.buildAS && !pVulkanGeom->initAccel;
+            if ((needAS || !pVulkanGeom->indices.buffer) && !vulkan_model_reload_data(pVulkanGeom))
+            {
+                continue;
+            }
+
             vulkan_model_stage(ctx, *pVulkanGeom);
-            if (pVulkanGeom->createInfo.buildAS)
+            if (needAS)
+            {
+                buildAS.push_back(pVulkanGeom.get());
+            }
+        }
+
+        // Acceleration structures are built together, then the CPU copies can go
+        if (!buildAS.empty())
+        {
+            vulkan_model_build_acceleration_structures(ctx, buildAS);
+        }
+
+        // Moved models refit their TLAS instead of rebuilding it
+        for (auto& [path, pVulkanGeom] : vulkanScene.models)
+        {
+            auto itrGeom = vulkanScene.pScene->models.find(path);
+            if (pVulkanGeom->initAccel && !pVulkanGeom->loading && itrGeom != vulkanScene.pScene->models.end())
             {
-                vulkan_model_build_acceleration_structure(ctx, *pVulkanGeom);
+                vulkan_model_update_acceleration_structure(ctx, *pVulkanGeom, itrGeom->second->transform);
             }
         }
+        for (auto& [path, pVulkanGeom] : vulkanScene.models)
+        {
+            vulkan_model_release_data(ctx, *pVulkanGeom);
+        }
 
         vulkanScene.defaultTarget = SurfaceKey();
 
         // Draw the passes
         for (auto& pVulkanPass : vulkanScene.passes)
         {
+            // Passes with a lower update frequency keep their last output
+            if (!vulkan_pass_should_draw(ctx, *pVulkanPass))
+            {
+                vulkan_pass_skip(ctx, *pVulkanPass);
+                continue;
+            }
+
             if (!vulkan_pass_draw(ctx, *pVulkanPass))
             {
                 // Scene not valid, might be deleted
@@ -330,6 +483,14 @@ void vulkan_scene_render(VulkanContext& ctx, VulkanScene& vulkanScene)
         }
 
         vulkan_scene_prepare_output_descriptors(ctx, vulkanScene);
+
+        {
+            PROFILE_SCOPE(dynamic_resolution);
+            vulkan_scene_update_render_scale(ctx, vulkanScene);
+        }
+
+        // This scene has asked for all of its targets now, so older pooled ones can go
+        vulkan_surface_pool_trim(ctx, vulkanScene.generation);
     }
     catch (std::exception& ex)
     {
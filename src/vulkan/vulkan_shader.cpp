@@ -191,6 +191,19 @@ bool shader_reflect(const std::string& spirv, VulkanShader& vulkanShader)
             // TODO: Can we provide the range here?
             // The reflection doesn't give us file offsets, so we would have to scan the file and find the declarations
             meta.line = 0;
+
+            // Remember which parts of a uniform block are referenced, so we know which changes matter
+            if (bindingReflect.descriptor_type == SPV_REFLECT_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+            {
+                for (uint32_t member = 0; member < bindingReflect.block.member_count; member++)
+                {
+                    auto& memberReflect = bindingReflect.block.members[member];
+                    if (!(memberReflect.flags & SPV_REFLECT_VARIABLE_FLAGS_UNUSED))
+                    {
+                        meta.usedRanges.push_back(std::make_pair(memberReflect.offset, memberReflect.size));
+                    }
+                }
+            }
             vulkanShader.bindingSets[set->set].bindingMeta[layout_binding.binding] = meta;
         }
     }
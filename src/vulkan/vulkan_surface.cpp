@@ -7,6 +7,7 @@
 #include "vklive/vulkan/vulkan_command.h"
 #include "vklive/vulkan/vulkan_context.h"
 #include "vklive/vulkan/vulkan_surface.h"
+#include "vklive/vulkan/vulkan_transfer.h"
 #include "vklive/vulkan/vulkan_utils.h"
 
 #include <zest/logger/logger.h>
@@ -57,9 +58,119 @@ void vulkan_surface_destroy(VulkanContext& ctx, VulkanSurface& img)
         img.memory = nullptr;
     }
 
+    if (img.uploadImage)
+    {
+        ctx.device.destroyImage(img.uploadImage);
+        img.uploadImage = nullptr;
+    }
+
+    if (img.uploadMemory)
+    {
+        ctx.device.freeMemory(img.uploadMemory);
+        img.uploadMemory = nullptr;
+    }
+
     img.ImGuiDescriptorSet = nullptr;
 };
 
+// Hand a scene's target to the pool instead of freeing it
+void vulkan_surface_pool_release(VulkanContext& ctx, const std::shared_ptr<VulkanSurface>& spSurface, uint32_t sceneGeneration)
+{
+    if (!ctx.spSurfacePool)
+    {
+        ctx.spSurfacePool = std::make_shared<VulkanSurfacePool>();
+    }
+
+    VulkanSurfacePoolKey poolKey{ spSurface->key, spSurface->format, glm::uvec2(spSurface->extent.width, spSurface->extent.height), spSurface->flags };
+
+    auto& entry = ctx.spSurfacePool->entries[poolKey];
+    if (entry.spSurface)
+    {
+        vulkan_surface_destroy(ctx, *entry.spSurface);
+    }
+
+    LOG(DBG, "Pool Surface: " << *spSurface);
+
+    // The scene surface it pointed to is going away
+    spSurface->pSurface = nullptr;
+    spSurface->ImGuiDescriptorSet = nullptr;
+
+    entry.spSurface = spSurface;
+    entry.sceneGeneration = sceneGeneration;
+}
+
+// Take over an identical surface from a previous scene, if there is one
+bool vulkan_surface_pool_claim(VulkanContext& ctx, VulkanSurface& surface, const glm::uvec2& size, vk::Format format, uint32_t flags)
+{
+    if (!ctx.spSurfacePool)
+    {
+        ctx.spSurfacePool = std::make_shared<VulkanSurfacePool>();
+    }
+
+    auto& pool = *ctx.spSurfacePool;
+    auto itr = pool.entries.find(VulkanSurfacePoolKey{ surface.key, format, size, flags });
+    if (itr == pool.entries.end())
+    {
+        pool.allocated++;
+        return false;
+    }
+
+    // Copy the vulkan objects, but keep our scene identity
+    auto pSurface = surface.pSurface;
+    auto key = surface.key;
+    auto debugName = surface.debugName;
+    auto generation = surface.generation;
+
+    surface = *itr->second.spSurface;
+    surface.pSurface = pSurface;
+    surface.key = key;
+    surface.debugName = debugName;
+    surface.generation = generation + 1;
+
+    pool.entries.erase(itr);
+    pool.reused++;
+
+    LOG(DBG, "Reuse Pooled Surface: " << surface << " (Reused: " << pool.reused << ", Allocated: " << pool.allocated << ")");
+    return true;
+}
+
+// Anything left over from an older scene wasn't wanted by the current one
+void vulkan_surface_pool_trim(VulkanContext& ctx, uint32_t sceneGeneration)
+{
+    if (!ctx.spSurfacePool)
+    {
+        return;
+    }
+
+    auto& entries = ctx.spSurfacePool->entries;
+    for (auto itr = entries.begin(); itr != entries.end();)
+    {
+        if (itr->second.sceneGeneration < sceneGeneration)
+        {
+            vulkan_surface_destroy(ctx, *itr->second.spSurface);
+            itr = entries.erase(itr);
+        }
+        else
+        {
+            itr++;
+        }
+    }
+}
+
+void vulkan_surface_pool_destroy(VulkanContext& ctx)
+{
+    if (!ctx.spSurfacePool)
+    {
+        return;
+    }
+
+    for (auto& [key, entry] : ctx.spSurfacePool->entries)
+    {
+        vulkan_surface_destroy(ctx, *entry.spSurface);
+    }
+    ctx.spSurfacePool.reset();
+}
+
 // Internal helper
 void vulkan_surface_create_image_internal(VulkanContext& ctx, VulkanSurface& vulkanSurface, const vk::ImageCreateInfo& imageCreateInfo, const vk::MemoryPropertyFlags& memoryPropertyFlags)
 {
@@ -67,6 +178,7 @@ void vulkan_surface_create_image_internal(VulkanContext& ctx, VulkanSurface& vul
 
     vulkanSurface.image = ctx.device.createImage(imageCreateInfo);
     vulkanSurface.format = imageCreateInfo.format;
+    vulkanSurface.flags = 0;
     vulkanSurface.extent = imageCreateInfo.extent;
     vk::MemoryRequirements memReqs = ctx.device.getImageMemoryRequirements(vulkanSurface.image);
     vk::MemoryAllocateInfo memAllocInfo;
@@ -130,7 +242,7 @@ void vulkan_surface_create(VulkanContext& ctx, VulkanSurface& vulkanSurface, con
     image.samples = vk::SampleCountFlagBits::e1;
     image.tiling = vk::ImageTiling::eOptimal;
     image.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc | colorUsage;
-    if (vulkanSurface.pSurface->isRayTarget)
+    if (flags & VulkanSurfaceFlags::Storage)
     {
         image.usage |= vk::ImageUsageFlagBits::eStorage;
     }
@@ -165,6 +277,7 @@ void vulkan_surface_create(VulkanContext& ctx, VulkanSurface& vulkanSurface, con
 
     debug_set_surface_name(ctx.device, vulkanSurface, vulkanSurface.debugName);
 
+    vulkanSurface.flags = flags;
     vulkanSurface.allocationState = VulkanAllocationState::Loaded;
 
     vulkanSurface.generation++;
@@ -297,48 +410,38 @@ void surface_set_layout(VulkanContext& ctx, vk::Image image, vk::ImageAspectFlag
 
 void surface_stage_to_device(VulkanContext& ctx, VulkanSurface& surface, vk::ImageCreateInfo imageCreateInfo, const vk::MemoryPropertyFlags& memoryPropertyFlags, vk::DeviceSize size, const void* data, const std::vector<MipData>& mipData, const vk::ImageLayout layout)
 {
-    VulkanBuffer staging = buffer_create_staging(ctx, size, data);
     imageCreateInfo.usage = imageCreateInfo.usage | vk::ImageUsageFlagBits::eTransferDst;
-
-    debug_set_buffer_name(ctx.device, staging.buffer, "Staging");
+    transfer_set_sharing(ctx, imageCreateInfo);
 
     vulkan_surface_create_image_internal(ctx, surface, imageCreateInfo, memoryPropertyFlags);
 
     LOG(DBG, "Surface Stage To Device");
-    utils_with_command_buffer(ctx, [&](const vk::CommandBuffer& copyCmd) {
-        debug_set_commandbuffer_name(ctx.device, copyCmd, "Buffer::StageToDevice");
-        vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, imageCreateInfo.mipLevels, 0, 1);
+    vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, imageCreateInfo.mipLevels, 0, 1);
 
-        // Prepare for transfer
-        surface_set_layout(ctx, copyCmd, surface, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, range);
-
-        // Prepare for transfer
-        std::vector<vk::BufferImageCopy> bufferCopyRegions;
+    std::vector<vk::BufferImageCopy> bufferCopyRegions;
+    {
+        vk::BufferImageCopy bufferCopyRegion;
+        bufferCopyRegion.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+        bufferCopyRegion.imageSubresource.layerCount = 1;
+        if (!mipData.empty())
         {
-            vk::BufferImageCopy bufferCopyRegion;
-            bufferCopyRegion.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
-            bufferCopyRegion.imageSubresource.layerCount = 1;
-            if (!mipData.empty())
+            for (uint32_t i = 0; i < imageCreateInfo.mipLevels; i++)
             {
-                for (uint32_t i = 0; i < imageCreateInfo.mipLevels; i++)
-                {
-                    bufferCopyRegion.imageSubresource.mipLevel = i;
-                    bufferCopyRegion.imageExtent = mipData[i].first;
-                    bufferCopyRegions.push_back(bufferCopyRegion);
-                    bufferCopyRegion.bufferOffset += mipData[i].second;
-                }
-            }
-            else
-            {
-                bufferCopyRegion.imageExtent = imageCreateInfo.extent;
+                bufferCopyRegion.imageSubresource.mipLevel = i;
+                bufferCopyRegion.imageExtent = mipData[i].first;
                 bufferCopyRegions.push_back(bufferCopyRegion);
+                bufferCopyRegion.bufferOffset += mipData[i].second;
             }
         }
-        copyCmd.copyBufferToImage(staging.buffer, surface.image, vk::ImageLayout::eTransferDstOptimal, bufferCopyRegions);
-        // Prepare for shader read
-        surface_set_layout(ctx, copyCmd, surface, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eTransferDstOptimal, layout, range);
-    });
-    vulkan_buffer_destroy(ctx, staging);
+        else
+        {
+            bufferCopyRegion.imageExtent = imageCreateInfo.extent;
+            bufferCopyRegions.push_back(bufferCopyRegion);
+        }
+    }
+
+    // Layout transitions and the copy are batched on the transfer queue; graphics submits wait for it
+    transfer_upload_image(ctx, surface.image, range, bufferCopyRegions, size, data, layout);
 }
 
 void surface_stage_to_device(VulkanContext& ctx, VulkanSurface& surface, const vk::ImageCreateInfo& imageCreateInfo, const vk::MemoryPropertyFlags& memoryPropertyFlags, const gli::texture2d& tex2D, const vk::ImageLayout& layout)
@@ -0,0 +1,331 @@
+#include <zest/logger/logger.h>
+#include <zest/time/profiler.h>
+
+#include "vklive/vulkan/vulkan_context.h"
+#include "vklive/vulkan/vulkan_debug.h"
+#include "vklive/vulkan/vulkan_transfer.h"
+#include "vklive/vulkan/vulkan_utils.h"
+
+namespace vulkan
+{
+
+namespace
+{
+
+// Release any batches the transfer queue has finished with
+void transfer_retire(VulkanContext& ctx, VulkanTransfer& transfer)
+{
+    if (transfer.inFlight.empty())
+    {
+        return;
+    }
+
+    auto completed = ctx.device.getSemaphoreCounterValue(transfer.timeline);
+    auto itr = transfer.inFlight.begin();
+    while (itr != transfer.inFlight.end() && itr->value <= completed)
+    {
+        transfer.ringTail = itr->ringEnd;
+        for (auto& buffer : itr->oversized)
+        {
+            vulkan_buffer_destroy(ctx, buffer);
+        }
+        transfer.freeCommandBuffers.push_back(itr->commandBuffer);
+        itr++;
+    }
+    transfer.inFlight.erase(transfer.inFlight.begin(), itr);
+
+    // Nothing left in use, start again at the front
+    if (transfer.inFlight.empty() && transfer.pendingBuffers.empty() && transfer.pendingImages.empty())
+    {
+        transfer.ringHead = transfer.ringTail = 0;
+    }
+}
+
+void transfer_wait(VulkanContext& ctx, VulkanTransfer& transfer, uint64_t value)
+{
+    PROFILE_SCOPE(transfer_wait);
+    LOG(DBG, "Transfer Wait: " << value);
+    auto res = ctx.device.waitSemaphores(vk::SemaphoreWaitInfo({}, transfer.timeline, value), UINT64_MAX);
+    (void)res;
+    transfer_retire(ctx, transfer);
+}
+
+uint64_t transfer_flush_locked(VulkanContext& ctx, VulkanTransfer& transfer)
+{
+    if (transfer.pendingBuffers.empty() && transfer.pendingImages.empty())
+    {
+        return transfer.submittedValue;
+    }
+
+    PROFILE_SCOPE(transfer_flush);
+
+    vk::CommandBuffer cmd;
+    if (!transfer.freeCommandBuffers.empty())
+    {
+        cmd = transfer.freeCommandBuffers.back();
+        transfer.freeCommandBuffers.pop_back();
+    }
+    else
+    {
+        cmd = ctx.device.allocateCommandBuffers(vk::CommandBufferAllocateInfo(transfer.commandPool, vk::CommandBufferLevel::ePrimary, 1))[0];
+        debug_set_commandbuffer_name(ctx.device, cmd, "Transfer::CommandBuffer");
+    }
+
+    cmd.begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+    debug_begin_region(cmd, "Transfer:Batch", glm::vec4(0.5f, 0.5f, 1.0f, 1.0f));
+
+    // All images to transfer destination in one go
+    std::vector<vk::ImageMemoryBarrier> barriers;
+    for (auto& copy : transfer.pendingImages)
+    {
+        barriers.push_back(vk::ImageMemoryBarrier({}, vk::AccessFlagBits::eTransferWrite, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, copy.image, copy.range));
+    }
+    if (!barriers.empty())
+    {
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, {}, {}, {}, barriers);
+    }
+
+    for (auto& copy : transfer.pendingImages)
+    {
+        cmd.copyBufferToImage(copy.source, copy.image, vk::ImageLayout::eTransferDstOptimal, copy.regions);
+    }
+
+    for (auto& copy : transfer.pendingBuffers)
+    {
+        cmd.copyBuffer(copy.source, copy.target, copy.region);
+    }
+
+    // Final layouts; visibility to the graphics queue comes from the timeline semaphore wait
+    barriers.clear();
+    for (auto& copy : transfer.pendingImages)
+    {
+        barriers.push_back(vk::ImageMemoryBarrier(vk::AccessFlagBits::eTransferWrite, {}, vk::ImageLayout::eTransferDstOptimal, copy.finalLayout, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, copy.image, copy.range));
+    }
+    if (!barriers.empty())
+    {
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, {}, {}, {}, barriers);
+    }
+
+    debug_end_region(cmd);
+    cmd.end();
+
+    VulkanTransferBatch batch;
+    batch.value = ++transfer.submittedValue;
+    batch.commandBuffer = cmd;
+    batch.ringEnd = transfer.ringHead;
+    batch.oversized = std::move(transfer.pendingOversized);
+
+    vk::TimelineSemaphoreSubmitInfo timelineInfo(0, nullptr, 1, &batch.value);
+    vk::SubmitInfo submitInfo(0, nullptr, nullptr, 1, &cmd, 1, &transfer.timeline);
+    submitInfo.pNext = &timelineInfo;
+
+    LOG(DBG, "Transfer Flush: Buffers: " << transfer.pendingBuffers.size() << ", Images: " << transfer.pendingImages.size() << ", Bytes: " << transfer.pendingBytes << ", Value: " << batch.value);
+    {
+        std::lock_guard<std::mutex> queueLock(ctx.queueMutex);
+        transfer.queue.submit(submitInfo, vk::Fence());
+    }
+
+    transfer.inFlight.push_back(std::move(batch));
+    transfer.pendingBuffers.clear();
+    transfer.pendingImages.clear();
+    transfer.pendingOversized.clear();
+    transfer.pendingBytes = 0;
+
+    return transfer.submittedValue;
+}
+
+// Find space in the ring, waiting for older batches if necessary.
+// Returns the source buffer and offset to copy from
+std::pair<vk::Buffer, vk::DeviceSize> transfer_allocate(VulkanContext& ctx, VulkanTransfer& transfer, vk::DeviceSize size, const void* pData)
+{
+    auto alignedSize = (size + transfer.alignment - 1) & ~(transfer.alignment - 1);
+
+    // Large uploads would stall the ring; give them a staging buffer of their own
+    if (alignedSize > transfer.ring.size / 2)
+    {
+        auto staging = buffer_create_staging(ctx, size, pData);
+        debug_set_buffer_name(ctx.device, staging.buffer, "Transfer::Oversized");
+        transfer.pendingOversized.push_back(staging);
+        return { staging.buffer, 0 };
+    }
+
+    for (;;)
+    {
+        transfer_retire(ctx, transfer);
+
+        vk::DeviceSize offset = VK_WHOLE_SIZE;
+        if (transfer.ringHead >= transfer.ringTail)
+        {
+            if (transfer.ringHead + alignedSize <= transfer.ring.size)
+            {
+                offset = transfer.ringHead;
+            }
+            else if (alignedSize < transfer.ringTail)
+            {
+                // Wrap; the head never catches the tail, so head == tail always means empty
+                offset = 0;
+            }
+        }
+        else if (transfer.ringHead + alignedSize < transfer.ringTail)
+        {
+            offset = transfer.ringHead;
+        }
+
+        if (offset != VK_WHOLE_SIZE)
+        {
+            transfer.ringHead = offset + alignedSize;
+            memcpy(transfer.pRingData + offset, pData, size);
+            return { transfer.ring.buffer, offset };
+        }
+
+        // Full; make sure what we have is on its way, then wait for the oldest batch
+        transfer_flush_locked(ctx, transfer);
+        transfer_wait(ctx, transfer, transfer.inFlight.front().value);
+    }
+}
+
+} // namespace
+
+void transfer_init(VulkanContext& ctx)
+{
+    ctx.spTransfer = std::make_shared<VulkanTransfer>();
+    auto& transfer = *ctx.spTransfer;
+
+    transfer.queueFamily = ctx.transferQueue;
+    transfer.queue = ctx.device.getQueue(ctx.transferQueue, ctx.transferQueueIndex);
+    debug_set_queue_name(ctx.device, transfer.queue, "Transfer::Queue");
+
+    if (ctx.transferQueue != ctx.graphicsQueue)
+    {
+        transfer.sharedFamilies = { ctx.graphicsQueue, ctx.transferQueue };
+    }
+
+    transfer.commandPool = ctx.device.createCommandPool(vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer, ctx.transferQueue));
+    debug_set_commandpool_name(ctx.device, transfer.commandPool, "Transfer::CommandPool");
+
+    vk::SemaphoreTypeCreateInfo typeInfo(vk::SemaphoreType::eTimeline, 0);
+    vk::SemaphoreCreateInfo semaphoreInfo;
+    semaphoreInfo.pNext = &typeInfo;
+    transfer.timeline = ctx.device.createSemaphore(semaphoreInfo);
+    debug_set_semaphore_name(ctx.device, transfer.timeline, "Transfer::Timeline");
+
+    transfer.ring = buffer_create(ctx, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, TransferRingSize);
+    transfer.pRingData = buffer_map<uint8_t>(ctx, transfer.ring);
+    debug_set_buffer_name(ctx.device, transfer.ring.buffer, "Transfer::StagingRing");
+
+    transfer.alignment = std::max(vk::DeviceSize(16), ctx.physicalDevice.getProperties().limits.optimalBufferCopyOffsetAlignment);
+
+    LOG(DBG, "Transfer Queue Family: " << ctx.transferQueue << ", Index: " << ctx.transferQueueIndex << (transfer.sharedFamilies.empty() ? " (Shared with graphics)" : " (Dedicated)"));
+}
+
+void transfer_destroy(VulkanContext& ctx)
+{
+    if (!ctx.spTransfer)
+    {
+        return;
+    }
+
+    auto& transfer = *ctx.spTransfer;
+    {
+        std::lock_guard<std::mutex> lock(transfer.mutex);
+        transfer_flush_locked(ctx, transfer);
+        transfer_wait(ctx, transfer, transfer.submittedValue);
+    }
+
+    vulkan_buffer_destroy(ctx, transfer.ring);
+    ctx.device.destroyCommandPool(transfer.commandPool);
+    ctx.device.destroySemaphore(transfer.timeline);
+
+    ctx.spTransfer.reset();
+}
+
+void transfer_set_sharing(VulkanContext& ctx, vk::BufferCreateInfo& info)
+{
+    if (ctx.spTransfer && !ctx.spTransfer->sharedFamilies.empty())
+    {
+        info.setSharingMode(vk::SharingMode::eConcurrent);
+        info.setQueueFamilyIndices(ctx.spTransfer->sharedFamilies);
+    }
+}
+
+void transfer_set_sharing(VulkanContext& ctx, vk::ImageCreateInfo& info)
+{
+    if (ctx.spTransfer && !ctx.spTransfer->sharedFamilies.empty())
+    {
+        info.setSharingMode(vk::SharingMode::eConcurrent);
+        info.setQueueFamilyIndices(ctx.spTransfer->sharedFamilies);
+    }
+}
+
+void transfer_upload_buffer(VulkanContext& ctx, vk::Buffer target, vk::DeviceSize size, const void* pData)
+{
+    auto& transfer = *ctx.spTransfer;
+    std::lock_guard<std::mutex> lock(transfer.mutex);
+
+    auto [source, offset] = transfer_allocate(ctx, transfer, size, pData);
+    transfer.pendingBuffers.push_back(VulkanTransferBufferCopy{ source, target, vk::BufferCopy(offset, 0, size) });
+    transfer.pendingBytes += size;
+}
+
+void transfer_upload_image(VulkanContext& ctx, vk::Image target, const vk::ImageSubresourceRange& range, const std::vector<vk::BufferImageCopy>& regions, vk::DeviceSize size, const void* pData, vk::ImageLayout finalLayout)
+{
+    auto& transfer = *ctx.spTransfer;
+    std::lock_guard<std::mutex> lock(transfer.mutex);
+
+    auto [source, offset] = transfer_allocate(ctx, transfer, size, pData);
+
+    VulkanTransferImageCopy copy;
+    copy.image = target;
+    copy.range = range;
+    copy.finalLayout = finalLayout;
+    copy.source = source;
+    copy.regions = regions;
+    for (auto& region : copy.regions)
+    {
+        region.bufferOffset += offset;
+    }
+    transfer.pendingImages.push_back(copy);
+    transfer.pendingBytes += size;
+}
+
+uint64_t transfer_flush(VulkanContext& ctx)
+{
+    auto& transfer = *ctx.spTransfer;
+    std::lock_guard<std::mutex> lock(transfer.mutex);
+    return transfer_flush_locked(ctx, transfer);
+}
+
+void transfer_graphics_submit(VulkanContext& ctx, const vk::SubmitInfo& submitInfo, vk::Fence fence)
+{
+    auto& transfer = *ctx.spTransfer;
+    auto value = transfer_flush(ctx);
+
+    // Nothing outstanding; the usual case once everything is loaded
+    if (value == 0 || ctx.device.getSemaphoreCounterValue(transfer.timeline) >= value)
+    {
+        std::lock_guard<std::mutex> queueLock(ctx.queueMutex);
+        context_get_queue(ctx).submit(submitInfo, fence);
+        return;
+    }
+
+    std::vector<vk::Semaphore> waitSemaphores(submitInfo.pWaitSemaphores, submitInfo.pWaitSemaphores + submitInfo.waitSemaphoreCount);
+    std::vector<vk::PipelineStageFlags> waitStages(submitInfo.pWaitDstStageMask, submitInfo.pWaitDstStageMask + submitInfo.waitSemaphoreCount);
+    std::vector<uint64_t> waitValues(submitInfo.waitSemaphoreCount, 0);
+
+    waitSemaphores.push_back(transfer.timeline);
+    waitStages.push_back(vk::PipelineStageFlagBits::eAllCommands);
+    waitValues.push_back(value);
+
+    vk::TimelineSemaphoreSubmitInfo timelineInfo;
+    timelineInfo.setWaitSemaphoreValues(waitValues);
+
+    auto info = submitInfo;
+    info.setWaitSemaphores(waitSemaphores);
+    info.setWaitDstStageMask(waitStages);
+    info.pNext = &timelineInfo;
+
+    std::lock_guard<std::mutex> queueLock(ctx.queueMutex);
+    context_get_queue(ctx).submit(info, fence);
+}
+
+} // namespace vulkan
@@ -263,7 +263,7 @@ uint32_t utils_find_queue(VulkanContext& ctx, const vk::QueueFlags& desiredFlags
     return bestMatch;
 }
 
-vk::Device utils_create_device(vk::PhysicalDevice const& physicalDevice, uint32_t queueFamilyIndex, std::vector<std::string> const& extensions, vk::PhysicalDeviceFeatures const* physicalDeviceFeatures, void const* pNext)
+vk::Device utils_create_device(vk::PhysicalDevice const& physicalDevice, std::vector<vk::DeviceQueueCreateInfo> const& queueCreateInfos, std::vector<std::string> const& extensions, vk::PhysicalDeviceFeatures const* physicalDeviceFeatures, void const* pNext)
 {
     std::vector<char const*> enabledExtensions;
     enabledExtensions.reserve(extensions.size());
@@ -272,9 +272,7 @@ vk::Device utils_create_device(vk::PhysicalDevice const& physicalDevice, uint32_
         enabledExtensions.push_back(ext.data());
     }
 
-    float queuePriority = 0.0f;
-    vk::DeviceQueueCreateInfo deviceQueueCreateInfo({}, queueFamilyIndex, 1, &queuePriority);
-    vk::DeviceCreateInfo deviceCreateInfo({}, deviceQueueCreateInfo, {}, enabledExtensions, physicalDeviceFeatures);
+    vk::DeviceCreateInfo deviceCreateInfo({}, queueCreateInfos, {}, enabledExtensions, physicalDeviceFeatures);
     deviceCreateInfo.pNext = pNext;
 
     vk::Device device = physicalDevice.createDevice(deviceCreateInfo);
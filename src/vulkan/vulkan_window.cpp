@@ -321,15 +321,25 @@ void main_window_validate_swapchain(VulkanContext& ctx)
 // swap the main window
 void main_window_present(VulkanContext& ctx)
 {
+    auto wnd = &ctx.mainWindowData;
+    vk::Semaphore render_complete_semaphore = wnd->frameSemaphores[wnd->semaphoreIndex].renderCompleteSemaphore;
+    if (wnd->presentWaitSemaphore)
+    {
+        render_complete_semaphore = wnd->presentWaitSemaphore;
+        wnd->presentWaitSemaphore = nullptr;
+    }
+
     if (ctx.swapChainRebuild)
     {
         return;
     }
 
-    auto wnd = &ctx.mainWindowData;
-    vk::Semaphore render_complete_semaphore = wnd->frameSemaphores[wnd->semaphoreIndex].renderCompleteSemaphore;
     auto info = vk::PresentInfoKHR(1, &render_complete_semaphore, 1, &wnd->swapchain, &wnd->frameIndex);
-    vk::Result err = context_get_queue(ctx).presentKHR(&info);
+    vk::Result err;
+    {
+        std::lock_guard<std::mutex> queueLock(ctx.queueMutex);
+        err = context_get_queue(ctx).presentKHR(&info);
+    }
     if (err == vk::Result::eErrorOutOfDateKHR || err == vk::Result::eSuboptimalKHR)
     {
         ctx.swapChainRebuild = true;